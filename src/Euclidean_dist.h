@@ -2,8 +2,16 @@
 #define EUCLIDEAN_DIST_H
 
 #include <vector>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
 
-/** \brief Euclidean distance squared.
+#include "metric.h"
+
+/** \brief Euclidean distance squared. Uses the vectorized kernel
+ * of the element type, if there is one.
  *
  * @param it1       - first point
  * @param it1_end   - end of first point
@@ -13,58 +21,58 @@
 template<typename iterator>
 float squared_Eucl_distance(iterator it1, iterator it1_end, iterator it2)
 {
-  float squared_distance = 0.;
-  float diff;
-  for (; it1 < it1_end; ++it1, ++it2)
-  {
-    diff = *it1 - *it2;
-    squared_distance += diff * diff;
-  }
-  return squared_distance;
+  return L2Metric::distance(it1, it1_end, it2);
 }
 
-/** \brief Report a point's index (if any) that has Euclidean distance
- * less or equal than a given radius.
+/** \brief Report a point's index (if any) that has Euclidean distance, or the
+ * distance of 'Metric', less or equal than a given radius.
  *
  * @param pointset        - 1D vector of all points
  * @param points_idxs     - indices of candidate points
+ * @param size            - number of candidate points
  * @param D               - dimension of points
  * @param query_point     - vector containing only the coordinates of the query point
- * @param squared_radius  - square value of given radius
+ * @param squared_radius  - square value of given radius, or 'Metric::radius_threshold()' of it
  * @param threshold       - max number of points to check
+ * @param stride          - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
  * @return                - the index of the point. -1 if not found.
  */
-template <typename iterator>
-int Euclidean_distance_within_radius(iterator pointset, const std::vector<int>& points_idxs,
- const int D, iterator query_point, const int squared_radius, const int threshold)
+template <typename iterator, typename Metric = L2Metric>
+int Euclidean_distance_within_radius(iterator pointset, const int* points_idxs, const int size,
+ const int D, iterator query_point, const float squared_radius, const int threshold, size_t stride = 0)
 {
-  const int size = points_idxs.size();
+  if(!stride)
+    stride = D;
   for(int i = 0; i < threshold && i < size; ++i)
   {
-    if(squared_Eucl_distance(query_point, query_point + D, pointset + points_idxs[i] * D) <= squared_radius)
+    if(Metric::distance(query_point, query_point + D, pointset + points_idxs[i] * stride) <= squared_radius)
       return points_idxs[i];
   }
   return -1;
 }
 
 /** \brief Report Nearest Neighbor's index, if something better than the current NN is found.
+ * Distances are squared Euclidean, or those of 'Metric'.
  *
  * @param pointset              - 1D vector of all points
  * @param points_idxs           - indices of candidate points
+ * @param size                  - number of candidate points
  * @param D                     - dimension of points
  * @param query_point           - vector containing only the coordinates of the query point
  * @param answer_point_idx_dist - current best NN point. Will be updated if a point closer to the query is found.
  * @param threshold             - max number of points to check
+ * @param stride                - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
  */
-template <typename iterator>
-void find_Nearest_Neighbor_index(iterator pointset, const std::vector<int>& points_idxs,
- const int D, iterator query_point, std::pair<int, float>& answer_point_idx_dist, const int threshold)
+template <typename iterator, typename Metric = L2Metric>
+void find_Nearest_Neighbor_index(iterator pointset, const int* points_idxs, const int size,
+ const int D, iterator query_point, std::pair<int, float>& answer_point_idx_dist, const int threshold, size_t stride = 0)
 {
-  const int size = points_idxs.size();
+  if(!stride)
+    stride = D;
   float current_dist;
   for(int i = 0; i < threshold && i < size; ++i)
   {
-    current_dist = squared_Eucl_distance(query_point, query_point + D, pointset + points_idxs[i] * D);
+    current_dist = Metric::distance(query_point, query_point + D, pointset + points_idxs[i] * stride);
     if(current_dist < answer_point_idx_dist.second)
     {
       answer_point_idx_dist.second = current_dist;
@@ -73,6 +81,57 @@ void find_Nearest_Neighbor_index(iterator pointset, const std::vector<int>& poin
   }
 }
 
+/** \brief Update the 'k' Nearest Neighbors with the candidates. A candidate
+ * enters only if it is closer than the worst of the 'k' found so far. Distances
+ * are squared Euclidean, or those of 'Metric'.
+ *
+ * @param pointset      - 1D vector of all points
+ * @param points_idxs   - indices of candidate points
+ * @param size          - number of candidate points
+ * @param D             - dimension of points
+ * @param query_point   - vector containing only the coordinates of the query point
+ * @param best          - (squared distance, index) of the best points so far, as a max-heap. Will be updated.
+ * @param k             - number of neighbors to keep
+ * @param threshold     - max number of points to check
+ * @param stride        - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+ */
+template <typename iterator, typename Metric = L2Metric>
+void find_k_Nearest_Neighbors(iterator pointset, const int* points_idxs, const int size,
+ const int D, iterator query_point, std::vector<std::pair<float, int>>& best, const int k, const int threshold, size_t stride = 0)
+{
+  if(!stride)
+    stride = D;
+  for(int i = 0; i < threshold && i < size; ++i)
+  {
+    const float current_dist = Metric::distance(query_point, query_point + D, pointset + (size_t)points_idxs[i] * stride);
+    if((int)best.size() < k)
+    {
+      best.push_back(std::make_pair(current_dist, points_idxs[i]));
+      std::push_heap(best.begin(), best.end());
+    }
+    else if(current_dist < best.front().first)
+    {
+      std::pop_heap(best.begin(), best.end());
+      best.back() = std::make_pair(current_dist, points_idxs[i]);
+      std::push_heap(best.begin(), best.end());
+    }
+  }
+}
+
+/** \brief Write the 'k' best points of a max-heap, closest first.
+ * Missing neighbors are written as (-1, 1000000.0).
+ *
+ * @param best  - (squared distance, index) of the best points, as a max-heap. Is sorted.
+ * @param k     - number of neighbors to write
+ * @param out   - k (index, squared distance) pairs (to be populated)
+ */
+inline void write_k_Nearest_Neighbors(std::vector<std::pair<float, int>>& best, const int k, std::pair<int, float>* out)
+{
+  std::sort_heap(best.begin(), best.end());
+  for(int i = 0; i < k; ++i)
+    out[i] = (i < (int)best.size()) ? std::make_pair(best[i].second, best[i].first) : std::make_pair(-1, 1000000.0f);
+}
+
 /** \brief Report a point's index (if any) that has Euclidean distance
  * less or equal than a given radius. Usage in a parallel environment.
  *
@@ -102,4 +161,192 @@ void Euclidean_distance_within_radius(iterator pointset, const std::vector<int>&
   }
 }
 
+/**
+ * Checks the candidate points of one query with the exact Euclidean distance, or that of 'Metric'.
+ * The Hamming cube hands it the points of every vertex it visits.
+ */
+template <typename iterator, typename Metric = L2Metric>
+class ExactCandidateChecker
+{
+    // 1D vector of all points
+    iterator pointset;
+    // vector containing only the coordinates of the query point
+    iterator query_point;
+    // dimension of points
+    const int D;
+    // square value of the radius, or 'Metric::radius_threshold()' of it, for radius queries
+    const float squared_radius;
+    // elements from the start of a point to the start of the next one
+    const size_t stride;
+    // current best NN point, for Nearest Neighbor queries
+    std::pair<int, float> answer_point_idx_dist;
+  public:
+    /** \brief Constructor.
+     *
+     * @param pointset        - 1D vector of all points
+     * @param query_point     - vector containing only the coordinates of the query point
+     * @param D               - dimension of points
+     * @param squared_radius  - square value of given radius, or 'Metric::radius_threshold()' of it. Not used by Nearest Neighbor queries.
+     * @param stride          - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     */
+    ExactCandidateChecker(iterator pointset, iterator query_point, const int D, const float squared_radius = 0, const size_t stride = 0)
+      : pointset(pointset), query_point(query_point), D(D), squared_radius(squared_radius), stride(stride ? stride : D), answer_point_idx_dist(-1, 1000000.0)
+    {}
+
+    /** \brief Report a point's index (if any) that lies within the radius.
+     *
+     * @param points_idxs     - indices of candidate points
+     * @param size            - number of candidate points
+     * @param threshold       - max number of points to check
+     * @return                - the index of the point. -1 if not found.
+     */
+    int within_radius(const int* points_idxs, const int size, const int threshold)
+    {
+      return Euclidean_distance_within_radius<iterator, Metric>(pointset, points_idxs, size, D, query_point, squared_radius, threshold, stride);
+    }
+
+    /** \brief Update the Nearest Neighbor with the candidates.
+     *
+     * @param points_idxs     - indices of candidate points
+     * @param size            - number of candidate points
+     * @param threshold       - max number of points to check
+     */
+    void nearest_neighbor(const int* points_idxs, const int size, const int threshold)
+    {
+      find_Nearest_Neighbor_index<iterator, Metric>(pointset, points_idxs, size, D, query_point, answer_point_idx_dist, threshold, stride);
+    }
+
+    /** \brief The Nearest Neighbor found so far.
+     *
+     * @return - its index and squared distance from the query. (-1, 1000000.0) if no point was checked.
+     */
+    std::pair<int, float> nearest_neighbor_result() const
+    {
+      return answer_point_idx_dist;
+    }
+};
+
+/**
+ * Checks the candidate points of one query with the exact Euclidean distance, or that of
+ * 'Metric', and keeps the 'k' closest, for k Nearest Neighbor queries.
+ */
+template <typename iterator, typename Metric = L2Metric>
+class KNearestCandidateChecker
+{
+    // 1D vector of all points
+    iterator pointset;
+    // vector containing only the coordinates of the query point
+    iterator query_point;
+    // dimension of points
+    const int D;
+    // number of neighbors to keep
+    const int k;
+    // elements from the start of a point to the start of the next one
+    const size_t stride;
+    // the 'k' best (squared distance, index) pairs, as a max-heap
+    std::vector<std::pair<float, int>> best;
+  public:
+    /** \brief Constructor.
+     *
+     * @param pointset        - 1D vector of all points
+     * @param query_point     - vector containing only the coordinates of the query point
+     * @param D               - dimension of points
+     * @param k               - number of neighbors to keep
+     * @param stride          - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     */
+    KNearestCandidateChecker(iterator pointset, iterator query_point, const int D, const int k, const size_t stride = 0)
+      : pointset(pointset), query_point(query_point), D(D), k(k), stride(stride ? stride : D)
+    {
+      best.reserve(k);
+    }
+
+    /** \brief Update the 'k' Nearest Neighbors with the candidates.
+     *
+     * @param points_idxs     - indices of candidate points
+     * @param size            - number of candidate points
+     * @param threshold       - max number of points to check
+     */
+    void nearest_neighbor(const int* points_idxs, const int size, const int threshold)
+    {
+      find_k_Nearest_Neighbors<iterator, Metric>(pointset, points_idxs, size, D, query_point, best, k, threshold, stride);
+    }
+
+    /** \brief Write the Nearest Neighbors found, closest first. Can be called once.
+     *
+     * @param k    - number of neighbors to write, at most the 'k' of the constructor
+     * @param out  - k (index, squared distance) pairs, (-1, 1000000.0) where fewer points were checked
+     */
+    void nearest_neighbors_result(const int k, std::pair<int, float>* out)
+    {
+      write_k_Nearest_Neighbors(best, k, out);
+    }
+};
+
+/**
+ * Hands another checker only the candidate points that are not erased, see 'Hypercube::erase()'.
+ * Erased points still count towards the threshold, as they were visited.
+ */
+template <typename Checker>
+class ErasedPointsFilter
+{
+    // candidates are filtered in blocks of this many points
+    static const int BLOCK = 256;
+    Checker& checker;
+    // per point, non zero if it is erased
+    const char* erased;
+
+    /** \brief Copy the candidates that are not erased.
+     *
+     * @param points_idxs  - indices of candidate points
+     * @param size         - number of candidate points
+     * @param live         - the ones that are not erased (to be populated)
+     * @return             - number of points that are not erased
+     */
+    int filter(const int* points_idxs, const int size, int* live) const
+    {
+      int live_no = 0;
+      for(int i = 0; i < size; ++i)
+      {
+        live[live_no] = points_idxs[i];
+        live_no += !erased[points_idxs[i]];
+      }
+      return live_no;
+    }
+  public:
+    /** \brief Constructor.
+     *
+     * @param checker  - checker of the points that are not erased
+     * @param erased   - per point, non zero if it is erased
+     */
+    ErasedPointsFilter(Checker& checker, const char* erased)
+      : checker(checker), erased(erased)
+    {}
+
+    int within_radius(const int* points_idxs, const int size, const int threshold)
+    {
+      int live[BLOCK];
+      const int n = std::min(size, threshold);
+      for(int start = 0; start < n; start += BLOCK)
+      {
+        const int live_no = filter(points_idxs + start, std::min(BLOCK, n - start), live);
+        const int answer_point_idx = live_no ? checker.within_radius(live, live_no, live_no) : -1;
+        if(answer_point_idx != -1)
+          return answer_point_idx;
+      }
+      return -1;
+    }
+
+    void nearest_neighbor(const int* points_idxs, const int size, const int threshold)
+    {
+      int live[BLOCK];
+      const int n = std::min(size, threshold);
+      for(int start = 0; start < n; start += BLOCK)
+      {
+        const int live_no = filter(points_idxs + start, std::min(BLOCK, n - start), live);
+        if(live_no)
+          checker.nearest_neighbor(live, live_no, live_no);
+      }
+    }
+};
+
 #endif /*EUCLIDEAN_DIST_H*/
\ No newline at end of file
@@ -0,0 +1,627 @@
+#ifndef EUCLIDEAN_DIST_SIMD_H
+#define EUCLIDEAN_DIST_SIMD_H
+
+#include <cstdint>
+#include <cmath>
+
+/**
+ * Hand-vectorized squared Euclidean distance for float, int and uint8_t points, and inner
+ * product, L1 distance and cosine distance for float points (see metric.h); other types use
+ * the scalar kernels. Every kernel has an SSE2, an AVX2 and an AVX-512 variant, compiled with
+ * the matching target attribute, and the best one for the CPU is picked on the first call.
+ * The '_fixed' kernels take the dimension as a template parameter, see FixedDimension of metric.h.
+ * Define DOLPHINN_NO_SIMD to use only the scalar kernels.
+ */
+
+#if !defined(DOLPHINN_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define DOLPHINN_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/** \brief Scalar squared Euclidean distance of two rows. Also used for the
+ * elements left after the last full vector of the SIMD kernels.
+ *
+ * @param a       - first point
+ * @param b       - second point
+ * @param start   - first coordinate to add
+ * @param D       - dimension of points
+ * @return        - sum of (a[d] - b[d])^2, for start <= d < D
+ */
+template <typename V>
+inline float squared_distance_scalar(const V* a, const V* b, int start, const int D)
+{
+  float squared_distance = 0.;
+  float diff;
+  for(; start < D; ++start)
+  {
+    diff = a[start] - b[start];
+    squared_distance += diff * diff;
+  }
+  return squared_distance;
+}
+
+/** \brief Scalar inner product of two rows.
+ *
+ * @param a       - first point
+ * @param b       - second point
+ * @param start   - first coordinate to add
+ * @param D       - dimension of points
+ * @return        - sum of a[d] * b[d], for start <= d < D
+ */
+template <typename V>
+inline float inner_product_scalar(const V* a, const V* b, int start, const int D)
+{
+  float product = 0.;
+  for(; start < D; ++start)
+    product += (float)a[start] * b[start];
+  return product;
+}
+
+/** \brief Scalar L1 distance of two rows.
+ *
+ * @param a       - first point
+ * @param b       - second point
+ * @param start   - first coordinate to add
+ * @param D       - dimension of points
+ * @return        - sum of |a[d] - b[d]|, for start <= d < D
+ */
+template <typename V>
+inline float l1_distance_scalar(const V* a, const V* b, int start, const int D)
+{
+  float distance = 0.;
+  for(; start < D; ++start)
+    distance += std::fabs((float)a[start] - (float)b[start]);
+  return distance;
+}
+
+/** \brief Scalar sums of the cosine of two rows: their inner product and squared norms.
+ *
+ * @param a        - first point
+ * @param b        - second point
+ * @param start    - first coordinate to add
+ * @param D        - dimension of points
+ * @param product  - sum of a[d] * b[d], added to
+ * @param norm_a   - sum of a[d]^2, added to
+ * @param norm_b   - sum of b[d]^2, added to
+ */
+template <typename V>
+inline void cosine_sums_scalar(const V* a, const V* b, int start, const int D, float& product, float& norm_a, float& norm_b)
+{
+  for(; start < D; ++start)
+  {
+    const float x = a[start], y = b[start];
+    product += x * y;
+    norm_a += x * x;
+    norm_b += y * y;
+  }
+}
+
+/** \brief 1 - cosine similarity, from the sums of 'cosine_sums_scalar()'; 1 if a row is zero.
+ */
+inline float cosine_distance_of(const float product, const float norm_a, const float norm_b)
+{
+  const float norms = norm_a * norm_b;
+  return norms > 0 ? 1 - product / std::sqrt(norms) : 1;
+}
+
+#ifdef DOLPHINN_X86_SIMD
+
+enum Simd_level { SIMD_SSE2 = 0, SIMD_AVX2 = 1, SIMD_AVX512 = 2 };
+
+/** \brief Detect the best instruction set supported by the CPU (and the OS).
+ * The result is computed once.
+ *
+ * @return - the SIMD level
+ */
+inline Simd_level simd_level()
+{
+  struct Detect
+  {
+    static Simd_level run()
+    {
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return SIMD_AVX512;
+      if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+      return SIMD_SSE2;
+    }
+  };
+  static const Simd_level level = Detect::run();
+  return level;
+}
+
+inline float horizontal_sum(__m128 v)
+{
+  __m128 shuffled = _mm_movehl_ps(v, v);
+  v = _mm_add_ps(v, shuffled);
+  shuffled = _mm_shuffle_ps(v, v, 1);
+  return _mm_cvtss_f32(_mm_add_ss(v, shuffled));
+}
+
+inline int horizontal_sum(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+// SSE2
+
+inline float squared_distance_sse2(const float* a, const float* b, const int D)
+{
+  __m128 sum = _mm_setzero_ps();
+  int d = 0;
+  for(; d + 4 <= D; d += 4)
+  {
+    const __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d));
+    sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+  }
+  return horizontal_sum(sum) + squared_distance_scalar(a, b, d, D);
+}
+
+inline float squared_distance_sse2(const int* a, const int* b, const int D)
+{
+  __m128 sum = _mm_setzero_ps();
+  int d = 0;
+  for(; d + 4 <= D; d += 4)
+  {
+    const __m128i diff_i = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(a + d)), _mm_loadu_si128((const __m128i*)(b + d)));
+    const __m128 diff = _mm_cvtepi32_ps(diff_i);
+    sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+  }
+  return horizontal_sum(sum) + squared_distance_scalar(a, b, d, D);
+}
+
+inline float squared_distance_sse2(const uint8_t* a, const uint8_t* b, const int D)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = _mm_setzero_si128();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m128i va = _mm_loadu_si128((const __m128i*)(a + d));
+    const __m128i vb = _mm_loadu_si128((const __m128i*)(b + d));
+    const __m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+    const __m128i diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_lo, diff_lo));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_hi, diff_hi));
+  }
+  return (float)horizontal_sum(sum) + squared_distance_scalar(a, b, d, D);
+}
+
+inline float inner_product_sse2(const float* a, const float* b, const int D)
+{
+  __m128 sum = _mm_setzero_ps();
+  int d = 0;
+  for(; d + 4 <= D; d += 4)
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d)));
+  return horizontal_sum(sum) + inner_product_scalar(a, b, d, D);
+}
+
+inline float l1_distance_sse2(const float* a, const float* b, const int D)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 sum = _mm_setzero_ps();
+  int d = 0;
+  for(; d + 4 <= D; d += 4)
+    sum = _mm_add_ps(sum, _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d))));
+  return horizontal_sum(sum) + l1_distance_scalar(a, b, d, D);
+}
+
+inline float cosine_distance_sse2(const float* a, const float* b, const int D)
+{
+  __m128 products = _mm_setzero_ps(), norms_a = _mm_setzero_ps(), norms_b = _mm_setzero_ps();
+  int d = 0;
+  for(; d + 4 <= D; d += 4)
+  {
+    const __m128 va = _mm_loadu_ps(a + d), vb = _mm_loadu_ps(b + d);
+    products = _mm_add_ps(products, _mm_mul_ps(va, vb));
+    norms_a = _mm_add_ps(norms_a, _mm_mul_ps(va, va));
+    norms_b = _mm_add_ps(norms_b, _mm_mul_ps(vb, vb));
+  }
+  float product = horizontal_sum(products), norm_a = horizontal_sum(norms_a), norm_b = horizontal_sum(norms_b);
+  cosine_sums_scalar(a, b, d, D, product, norm_a, norm_b);
+  return cosine_distance_of(product, norm_a, norm_b);
+}
+
+// AVX2
+
+/** \brief Sum of the 8 lanes of a vector.
+ */
+__attribute__((target("avx2,fma")))
+inline float horizontal_sum(__m256 v)
+{
+  return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+__attribute__((target("avx2,fma")))
+inline float squared_distance_avx2(const float* a, const float* b, const int D)
+{
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d));
+    const __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8));
+    sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+    sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+  }
+  for(; d + 8 <= D; d += 8)
+  {
+    const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d));
+    sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+  }
+  sum0 = _mm256_add_ps(sum0, sum1);
+  return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1))) + squared_distance_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx2,fma")))
+inline float squared_distance_avx2(const int* a, const int* b, const int D)
+{
+  __m256 sum = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 8 <= D; d += 8)
+  {
+    const __m256i diff_i = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(a + d)), _mm256_loadu_si256((const __m256i*)(b + d)));
+    const __m256 diff = _mm256_cvtepi32_ps(diff_i);
+    sum = _mm256_fmadd_ps(diff, diff, sum);
+  }
+  return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1))) + squared_distance_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx2,fma")))
+inline float squared_distance_avx2(const uint8_t* a, const uint8_t* b, const int D)
+{
+  __m256i sum = _mm256_setzero_si256();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a + d)));
+    const __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b + d)));
+    const __m256i diff = _mm256_sub_epi16(va, vb);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+  }
+  return (float)horizontal_sum(_mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1))) + squared_distance_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx2,fma")))
+inline float inner_product_avx2(const float* a, const float* b, const int D)
+{
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8), sum1);
+  }
+  for(; d + 8 <= D; d += 8)
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d), sum0);
+  return horizontal_sum(_mm256_add_ps(sum0, sum1)) + inner_product_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx2,fma")))
+inline float l1_distance_avx2(const float* a, const float* b, const int D)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d))));
+    sum1 = _mm256_add_ps(sum1, _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(a + d + 8), _mm256_loadu_ps(b + d + 8))));
+  }
+  for(; d + 8 <= D; d += 8)
+    sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d))));
+  return horizontal_sum(_mm256_add_ps(sum0, sum1)) + l1_distance_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx2,fma")))
+inline float cosine_distance_avx2(const float* a, const float* b, const int D)
+{
+  __m256 products = _mm256_setzero_ps(), norms_a = _mm256_setzero_ps(), norms_b = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 8 <= D; d += 8)
+  {
+    const __m256 va = _mm256_loadu_ps(a + d), vb = _mm256_loadu_ps(b + d);
+    products = _mm256_fmadd_ps(va, vb, products);
+    norms_a = _mm256_fmadd_ps(va, va, norms_a);
+    norms_b = _mm256_fmadd_ps(vb, vb, norms_b);
+  }
+  float product = horizontal_sum(products), norm_a = horizontal_sum(norms_a), norm_b = horizontal_sum(norms_b);
+  cosine_sums_scalar(a, b, d, D, product, norm_a, norm_b);
+  return cosine_distance_of(product, norm_a, norm_b);
+}
+
+// AVX-512. The tail of float and int rows is read with a masked load.
+// Some GCC versions warn about the undefined vectors used inside their own intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline float squared_distance_avx512(const float* a, const float* b, const int D)
+{
+  __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+  int d = 0;
+  for(; d + 32 <= D; d += 32)
+  {
+    const __m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d));
+    const __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(a + d + 16), _mm512_loadu_ps(b + d + 16));
+    sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+    sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+  }
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d));
+    sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+  }
+  if(d < D)
+  {
+    const __mmask16 mask = (__mmask16)((1u << (D - d)) - 1);
+    const __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + d), _mm512_maskz_loadu_ps(mask, b + d));
+    sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+inline float squared_distance_avx512(const int* a, const int* b, const int D)
+{
+  __m512 sum = _mm512_setzero_ps();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m512i diff_i = _mm512_sub_epi32(_mm512_loadu_si512(a + d), _mm512_loadu_si512(b + d));
+    const __m512 diff = _mm512_cvtepi32_ps(diff_i);
+    sum = _mm512_fmadd_ps(diff, diff, sum);
+  }
+  if(d < D)
+  {
+    const __mmask16 mask = (__mmask16)((1u << (D - d)) - 1);
+    const __m512i diff_i = _mm512_sub_epi32(_mm512_maskz_loadu_epi32(mask, a + d), _mm512_maskz_loadu_epi32(mask, b + d));
+    const __m512 diff = _mm512_cvtepi32_ps(diff_i);
+    sum = _mm512_fmadd_ps(diff, diff, sum);
+  }
+  return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline float squared_distance_avx512(const uint8_t* a, const uint8_t* b, const int D)
+{
+  __m512i sum = _mm512_setzero_si512();
+  int d = 0;
+  for(; d + 32 <= D; d += 32)
+  {
+    const __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(a + d)));
+    const __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(b + d)));
+    const __m512i diff = _mm512_sub_epi16(va, vb);
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(diff, diff));
+  }
+  return (float)_mm512_reduce_add_epi32(sum) + squared_distance_scalar(a, b, d, D);
+}
+
+__attribute__((target("avx512f")))
+inline float inner_product_avx512(const float* a, const float* b, const int D)
+{
+  __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+  int d = 0;
+  for(; d + 32 <= D; d += 32)
+  {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d), sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + d + 16), _mm512_loadu_ps(b + d + 16), sum1);
+  }
+  for(; d + 16 <= D; d += 16)
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d), sum0);
+  if(d < D)
+  {
+    const __mmask16 mask = (__mmask16)((1u << (D - d)) - 1);
+    sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + d), _mm512_maskz_loadu_ps(mask, b + d), sum1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+inline float l1_distance_avx512(const float* a, const float* b, const int D)
+{
+  __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+  int d = 0;
+  for(; d + 32 <= D; d += 32)
+  {
+    sum0 = _mm512_add_ps(sum0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d))));
+    sum1 = _mm512_add_ps(sum1, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(a + d + 16), _mm512_loadu_ps(b + d + 16))));
+  }
+  for(; d + 16 <= D; d += 16)
+    sum0 = _mm512_add_ps(sum0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d))));
+  if(d < D)
+  {
+    const __mmask16 mask = (__mmask16)((1u << (D - d)) - 1);
+    sum1 = _mm512_add_ps(sum1, _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + d), _mm512_maskz_loadu_ps(mask, b + d))));
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+inline float cosine_distance_avx512(const float* a, const float* b, const int D)
+{
+  __m512 products = _mm512_setzero_ps(), norms_a = _mm512_setzero_ps(), norms_b = _mm512_setzero_ps();
+  for(int d = 0; d < D; d += 16)
+  {
+    const __mmask16 mask = (D - d >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (D - d)) - 1);
+    const __m512 va = _mm512_maskz_loadu_ps(mask, a + d), vb = _mm512_maskz_loadu_ps(mask, b + d);
+    products = _mm512_fmadd_ps(va, vb, products);
+    norms_a = _mm512_fmadd_ps(va, va, norms_a);
+    norms_b = _mm512_fmadd_ps(vb, vb, norms_b);
+  }
+  return cosine_distance_of(_mm512_reduce_add_ps(products), _mm512_reduce_add_ps(norms_a), _mm512_reduce_add_ps(norms_b));
+}
+
+#pragma GCC diagnostic pop
+
+/** \brief Squared Euclidean distance of two rows, with the best kernel for the CPU.
+ *
+ * @param a       - first point
+ * @param b       - second point
+ * @param D       - dimension of points
+ * @return        - the Euclidean distance of a-b, squared
+ */
+template <typename V>
+inline float squared_distance_simd(const V* a, const V* b, const int D)
+{
+  typedef float (*kernel_t)(const V*, const V*, const int);
+  static const kernel_t kernel = (simd_level() == SIMD_AVX512) ? (kernel_t)squared_distance_avx512
+                               : (simd_level() == SIMD_AVX2) ? (kernel_t)squared_distance_avx2
+                               : (kernel_t)squared_distance_sse2;
+  return kernel(a, b, D);
+}
+
+// The float kernels of the other metrics; other types use the scalar ones, below.
+typedef float (*float_kernel_t)(const float*, const float*, const int);
+
+/** \brief Inner product of two float rows, with the best kernel for the CPU.
+ */
+inline float inner_product_simd(const float* a, const float* b, const int D)
+{
+  static const float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? inner_product_avx512 : (simd_level() == SIMD_AVX2) ? inner_product_avx2 : inner_product_sse2;
+  return kernel(a, b, D);
+}
+
+/** \brief L1 distance of two float rows, with the best kernel for the CPU.
+ */
+inline float l1_distance_simd(const float* a, const float* b, const int D)
+{
+  static const float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? l1_distance_avx512 : (simd_level() == SIMD_AVX2) ? l1_distance_avx2 : l1_distance_sse2;
+  return kernel(a, b, D);
+}
+
+/** \brief 1 - cosine similarity of two float rows, with the best kernel for the CPU.
+ */
+inline float cosine_distance_simd(const float* a, const float* b, const int D)
+{
+  static const float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? cosine_distance_avx512 : (simd_level() == SIMD_AVX2) ? cosine_distance_avx2 : cosine_distance_sse2;
+  return kernel(a, b, D);
+}
+
+// Kernels of a dimension known at compile time: the kernels above, inlined with a constant D, so
+// that their loops are unrolled and the remainder loops drop out when D is a multiple of the width.
+
+template <typename V, float (*kernel)(const V*, const V*, const int), int D>
+__attribute__((flatten))
+inline float fixed_sse2(const V* a, const V* b)
+{
+  return kernel(a, b, D);
+}
+
+template <typename V, float (*kernel)(const V*, const V*, const int), int D>
+__attribute__((target("avx2,fma"), flatten))
+inline float fixed_avx2(const V* a, const V* b)
+{
+  return kernel(a, b, D);
+}
+
+template <typename V, float (*kernel)(const V*, const V*, const int), int D>
+__attribute__((target("avx512f,avx512bw"), flatten))
+inline float fixed_avx512(const V* a, const V* b)
+{
+  return kernel(a, b, D);
+}
+
+/** \brief Squared Euclidean distance of two rows of dimension D, with the best kernel for the CPU.
+ */
+template <int D, typename V>
+inline float squared_distance_fixed(const V* a, const V* b)
+{
+  typedef float (*fixed_kernel_t)(const V*, const V*);
+  static const fixed_kernel_t kernel = (simd_level() == SIMD_AVX512) ? fixed_avx512<V, squared_distance_avx512, D>
+                                     : (simd_level() == SIMD_AVX2) ? fixed_avx2<V, squared_distance_avx2, D>
+                                     : fixed_sse2<V, squared_distance_sse2, D>;
+  return kernel(a, b);
+}
+
+typedef float (*fixed_float_kernel_t)(const float*, const float*);
+
+template <int D>
+inline float inner_product_fixed(const float* a, const float* b)
+{
+  static const fixed_float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? fixed_avx512<float, inner_product_avx512, D>
+                                           : (simd_level() == SIMD_AVX2) ? fixed_avx2<float, inner_product_avx2, D>
+                                           : fixed_sse2<float, inner_product_sse2, D>;
+  return kernel(a, b);
+}
+
+template <int D>
+inline float l1_distance_fixed(const float* a, const float* b)
+{
+  static const fixed_float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? fixed_avx512<float, l1_distance_avx512, D>
+                                           : (simd_level() == SIMD_AVX2) ? fixed_avx2<float, l1_distance_avx2, D>
+                                           : fixed_sse2<float, l1_distance_sse2, D>;
+  return kernel(a, b);
+}
+
+template <int D>
+inline float cosine_distance_fixed(const float* a, const float* b)
+{
+  static const fixed_float_kernel_t kernel = (simd_level() == SIMD_AVX512) ? fixed_avx512<float, cosine_distance_avx512, D>
+                                           : (simd_level() == SIMD_AVX2) ? fixed_avx2<float, cosine_distance_avx2, D>
+                                           : fixed_sse2<float, cosine_distance_sse2, D>;
+  return kernel(a, b);
+}
+
+#else
+
+template <typename V>
+inline float squared_distance_simd(const V* a, const V* b, const int D)
+{
+  return squared_distance_scalar(a, b, 0, D);
+}
+
+template <int D, typename V>
+inline float squared_distance_fixed(const V* a, const V* b)
+{
+  return squared_distance_scalar(a, b, 0, D);
+}
+
+#endif /*DOLPHINN_X86_SIMD*/
+
+// The other metrics, for the types without a vectorized kernel. The non-template float
+// kernels above are preferred for float rows.
+
+template <typename V>
+inline float inner_product_simd(const V* a, const V* b, const int D)
+{
+  return inner_product_scalar(a, b, 0, D);
+}
+
+template <typename V>
+inline float l1_distance_simd(const V* a, const V* b, const int D)
+{
+  return l1_distance_scalar(a, b, 0, D);
+}
+
+template <typename V>
+inline float cosine_distance_simd(const V* a, const V* b, const int D)
+{
+  float product = 0, norm_a = 0, norm_b = 0;
+  cosine_sums_scalar(a, b, 0, D, product, norm_a, norm_b);
+  return cosine_distance_of(product, norm_a, norm_b);
+}
+
+template <int D, typename V>
+inline float inner_product_fixed(const V* a, const V* b)
+{
+  return inner_product_scalar(a, b, 0, D);
+}
+
+template <int D, typename V>
+inline float l1_distance_fixed(const V* a, const V* b)
+{
+  return l1_distance_scalar(a, b, 0, D);
+}
+
+template <int D, typename V>
+inline float cosine_distance_fixed(const V* a, const V* b)
+{
+  return cosine_distance_simd(a, b, D);
+}
+
+#endif /*EUCLIDEAN_DIST_SIMD_H*/
@@ -1,236 +1,557 @@
 #ifndef IO_H
 #define IO_H
 
-#include <fstream>
 #include <vector>
 #include <iostream>
-#include <sstream>
 #include <utility>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+
+#include "memory.h"
+#include "pointset_view.h"
+#include "thread_pool.h"
+
+/** \brief Report a failed read.
+ *
+ * @param error    - where the message goes, or NULL
+ * @param message  - what went wrong
+ * @return         - false
+ */
+inline bool io_error(std::string* error, const std::string& message)
+{
+  if(error)
+    *error = message;
+  return false;
+}
+
+inline bool is_value_separator(const char c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == '[' || c == ']' || c == '\v' || c == '\f';
+}
+
+/** \brief Parse a decimal number. Plain numbers of up to 19 significant digits and small exponents,
+ * i.e. almost every number written by a program, are parsed without 'strtod()'.
+ *
+ * @param p      - first character of the number, moved past it
+ * @param end    - end of the text, which need not be NUL terminated
+ * @param value  - the number (to be populated)
+ * @return       - false if the text is not a number
+ */
+inline bool parse_number(const char*& p, const char* end, double& value)
+{
+  static const double powers_of_10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char* token = p;
+  bool negative = false;
+  if(p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  uint64_t mantissa = 0;
+  int significant_digits = 0, exponent = 0;
+  bool any_digit = false, exact = true;
+  for(; p < end && (unsigned)(*p - '0') < 10; ++p, any_digit = true)
+  {
+    if(significant_digits < 19)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      significant_digits += mantissa != 0;
+    }
+    else
+      exact = false;
+  }
+  if(p < end && *p == '.')
+    for(++p; p < end && (unsigned)(*p - '0') < 10; ++p, any_digit = true)
+    {
+      if(significant_digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        significant_digits += mantissa != 0;
+        --exponent;
+      }
+      else
+        exact = false;
+    }
+  if(any_digit && p < end && (*p == 'e' || *p == 'E'))
+  {
+    ++p;
+    bool negative_exponent = false;
+    if(p < end && (*p == '-' || *p == '+'))
+      negative_exponent = *p++ == '-';
+    int written_exponent = 0;
+    bool any_exponent_digit = false;
+    for(; p < end && (unsigned)(*p - '0') < 10; ++p, any_exponent_digit = true)
+      written_exponent = std::min(written_exponent * 10 + (*p - '0'), 100000);
+    exponent += negative_exponent ? -written_exponent : written_exponent;
+    any_digit = any_exponent_digit;
+  }
+  if(any_digit && (p == end || is_value_separator(*p)) && exact && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+  {
+    value = exponent < 0 ? (double)mantissa / powers_of_10[-exponent] : (double)mantissa * powers_of_10[exponent];
+    if(negative)
+      value = -value;
+    return true;
+  }
+  // anything else, e.g. 'inf', hexadecimal, or many digits
+  p = token;
+  while(p < end && !is_value_separator(*p))
+    ++p;
+  char buffer[128];
+  if(p - token >= (long)sizeof(buffer))
+    return false;
+  std::memcpy(buffer, token, p - token);
+  buffer[p - token] = '\0';
+  char* parsed_end;
+  value = std::strtod(buffer, &parsed_end);
+  return parsed_end == buffer + (p - token) && p != token;
+}
+
+/** \brief Read the numbers of a text file, separated by white space, commas or brackets.
+ * The file is cut into chunks at line ends, which threads parse in parallel.
+ *
+ * @param v           - the numbers (to be populated)
+ * @param count       - number of numbers to read; the file may hold more
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that parse the file
+ * @return            - false if the file cannot be read, holds something other than numbers, or holds fewer than 'count'
+ */
+template<typename T>
+bool read_text_values(std::vector<T>& v, const size_t count, const char* filename, std::string* error, const int threads_no)
+{
+  MappedFile file(filename);
+  if(!file.is_open())
+    return io_error(error, std::string("Unable to open the file (or it is empty) ") + filename);
+  const char* data = file.data();
+  const size_t size = file.size();
+  ThreadPool pool(threads_no);
+  // a few chunks per thread, but not so many that they are tiny
+  const int chunks_no = (int)std::max<size_t>(1, std::min<size_t>(4 * pool.size(), size >> 16));
+  std::vector<size_t> bounds(chunks_no + 1, size);
+  bounds[0] = 0;
+  for(int c = 1; c < chunks_no; ++c)
+  {
+    size_t bound = std::max(bounds[c - 1], (size_t)((double)size * c / chunks_no));
+    while(bound < size && bound > 0 && data[bound - 1] != '\n')
+      ++bound;
+    bounds[c] = bound;
+  }
+  std::vector<std::vector<T>> chunk_values(chunks_no);
+  // offset of the first malformed number of every chunk, or 'size'
+  std::vector<size_t> malformed(chunks_no, size);
+  pool.parallel_for(0, chunks_no, 1, [&](const int c_start, const int c_end)
+  {
+    for(int c = c_start; c < c_end; ++c)
+    {
+      std::vector<T>& values = chunk_values[c];
+      values.reserve((bounds[c + 1] - bounds[c]) / 4);
+      const char* p = data + bounds[c];
+      const char* chunk_end = data + bounds[c + 1];
+      double value;
+      while(true)
+      {
+        while(p < chunk_end && is_value_separator(*p))
+          ++p;
+        if(p == chunk_end)
+          break;
+        const char* number = p;
+        if(!parse_number(p, chunk_end, value))
+        {
+          malformed[c] = number - data;
+          break;
+        }
+        values.push_back((T)value);
+      }
+    }
+  });
+  size_t found = 0;
+  for(int c = 0; c < chunks_no; ++c)
+  {
+    if(malformed[c] != size && found + chunk_values[c].size() < count)
+      return io_error(error, std::string("Not a number at byte ") + std::to_string((unsigned long long)malformed[c]) + " of " + filename);
+    found += chunk_values[c].size();
+  }
+  if(found < count)
+    return io_error(error, std::string("Found ") + std::to_string((unsigned long long)found) + " numbers in " + filename +
+      ", expected " + std::to_string((unsigned long long)count));
+  v.resize(count);
+  size_t offset = 0;
+  for(int c = 0; c < chunks_no && offset < count; ++c)
+  {
+    const size_t n = std::min(chunk_values[c].size(), count - offset);
+    std::copy(chunk_values[c].begin(), chunk_values[c].begin() + n, v.begin() + offset);
+    offset += n;
+  }
+  return true;
+}
 
-/** \brief Read a collection of points from file.
+/** \brief Read a collection of points from a text file, separated by white space.
  *
  * Dimension and number of points should have been
  * assigned a value before reaching this function.
  *
- * @param v        - vector of points
- * @param N        - number of points
- * @param D        - dimension of points
- * @param filename - input file
+ * @param v           - vector of points
+ * @param N           - number of points
+ * @param D           - dimension of points
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that parse the file. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file does not hold N x D numbers
  */
 template<typename T>
-void read_points(std::vector<T>& v, int N, int D, const char* filename)
+bool read_points(std::vector<T>& v, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
 {
-  std::ifstream infile;
-
-  infile.open(filename);
-  if (!infile)
-    std::cout << "File not found!" << std::endl;
+  return read_text_values(v, (size_t)N * D, filename, error, threads_no);
+}
 
-  int hRead = 0;
-  for (int i = 0; i < N && infile; ++i) {
-    for (int j = 0; j < D; ++j)
-      infile >> v[i * D + j];
-    hRead++;
-  }
-  if (hRead != N)
-    std::cout << "ERROR, read less than " << N << " points!!\n\n";
+/** \brief Read the first N rows of a file of rows of the form: D (int32) x_1 ... x_D,
+ * in one pass over the mapped file.
+ *
+ * @param v           - vector of points
+ * @param N           - number of points
+ * @param D           - dimension of points
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed
+ * @param threads_no  - number of threads that copy the rows
+ * @return            - false if the file has fewer rows, or rows of another dimension
+ */
+template<typename T, typename V>
+bool read_vecs(std::vector<T>& v, const int N, const int D, const char* filename, std::string* error, const int threads_no)
+{
+  MappedFile file(filename);
+  if(!file.is_open())
+    return io_error(error, std::string("Unable to open the file (or it is empty) ") + filename);
+  const size_t row_bytes = sizeof(int32_t) + (size_t)D * sizeof(V);
+  if(file.size() % row_bytes)
+    return io_error(error, std::string(filename) + " is not made of rows of dimension " + std::to_string((long long)D));
+  if(file.size() / row_bytes < (size_t)N)
+    return io_error(error, std::string(filename) + " holds " + std::to_string((unsigned long long)(file.size() / row_bytes)) +
+      " points, expected " + std::to_string((long long)N));
+  v.resize((size_t)N * D);
+  ThreadPool pool(threads_no);
+  std::atomic<bool> valid(true);
+  pool.parallel_for(0, N, std::max(1, N / (4 * pool.size())), [&](const int start, const int end)
+  {
+    for(int i = start; i < end; ++i)
+    {
+      const char* row = file.data() + (size_t)i * row_bytes;
+      int32_t row_D;
+      std::memcpy(&row_D, row, sizeof(row_D));
+      if(row_D != D)
+      {
+        valid = false;
+        return;
+      }
+      const V* coordinates = (const V*)(row + sizeof(row_D));
+      std::copy(coordinates, coordinates + D, v.begin() + (size_t)i * D);
+    }
+  });
+  if(!valid)
+    return io_error(error, std::string(filename) + " has rows of dimension other than " + std::to_string((long long)D));
+  return true;
 }
 
-/** \brief Read a collection of points from file. Every line of the file has this format: D x_1 ... x_D
+/** \brief Read a collection of points from a file in fvecs format. Every row of the file has this format: D x_1 ... x_D,
+ * where D is an int32 and the coordinates are floats.
  *
  * Dimension and number of points should have been
  * assigned a value before reaching this function.
  *
- * @param v        - vector of points
- * @param N        - number of points
- * @param D        - dimension of points
- * @param filename - input file
+ * @param v           - vector of points
+ * @param N           - number of points. The file may hold more; the first N are read.
+ * @param D           - dimension of points
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that copy the rows. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file has fewer than N rows, or rows of another dimension
  */
 template<typename T>
-void readfvecs(std::vector<T>& v, int N, int D, const char* filename) {
-  if(!std::is_same<T, float>::value && !std::is_same<T, double>::value)
-    std::cout << "WARNING!!!!!!!!! You are reasding fvecs, but T is neither float nor double!" << std::endl;
-  FILE* fid;
-  fid = fopen(filename, "rb");
+bool readfvecs(std::vector<T>& v, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  return read_vecs<T, float>(v, N, D, filename, error, threads_no);
+}
 
-  if (!fid) {
-    printf("I/O error : Unable to open the file %s\n", filename);
-    //std::cerr << "Error: " << strerror(errno) << std::endl;
-  }
+/** \brief Read a collection of points from a file in bvecs format, like 'readfvecs()' with unsigned bytes.
+ *
+ * @param v           - vector of points
+ * @param N           - number of points. The file may hold more; the first N are read.
+ * @param D           - dimension of points
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that copy the rows. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file has fewer than N rows, or rows of another dimension
+ */
+template<typename T>
+bool readbvecs(std::vector<T>& v, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  return read_vecs<T, uint8_t>(v, N, D, filename, error, threads_no);
+}
 
-  // we assign the return value of fread() to 'sz' just to suppress a warning
-  int foundD;
-  size_t sz = fread(&foundD, sizeof(foundD), 1, fid);
-  fseek(fid, 0L, SEEK_END);
-  sz = ftell(fid);
-  int foundN = sz / (1 * 4 + D * 4);
-  printf("foundN = %d, N = %d, foundD = %d, D = %d, |%s|\n", foundN, N, foundD, D, filename);
-  if(N != foundN || D != foundD)
-    std::cout << "WARNING, see above!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
+/** \brief Read a collection of points from a file in ivecs format, like 'readfvecs()' with int32, e.g. ground truth.
+ *
+ * @param v           - vector of points
+ * @param N           - number of points. The file may hold more; the first N are read.
+ * @param D           - dimension of points
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that copy the rows. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file has fewer than N rows, or rows of another dimension
+ */
+template<typename T>
+bool readivecs(std::vector<T>& v, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  return read_vecs<T, int32_t>(v, N, D, filename, error, threads_no);
+}
 
-  fseek(fid, 0L, SEEK_SET);
-  //std::cout << ds.dim() << " " << ds.size() << "\n";
-  int c = 0;
-  float value;
-  int i, j;
-  for(i = 0; i < N; ++i) {
-    sz = fread(&D, sizeof(D), 1, fid);
-    //printf("%d\n", D);
-    for (j = 0; j < D; ++j) {
-      sz = fread(&value, sizeof(value), 1, fid);
-      //if(c >= 279619)
-      //printf("j = %d, value = %f, read up to point %d\n", j, value, c);
-      v[i * D + j] = value;
+/** \brief Write N rows of the form: D (int32) x_1 ... x_D. The rows go to a temporary file,
+ * which replaces 'filename' when complete, so that readers never see a partial file.
+ *
+ * @param v         - N x D values, of the type of the file
+ * @param N         - number of rows
+ * @param D         - dimension of rows
+ * @param filename  - output file
+ * @param error     - what went wrong, if writing failed. Default value is NULL.
+ * @return          - false if the file could not be written
+ */
+template<typename V>
+bool write_vecs(const V* v, const int N, const int D, const char* filename, std::string* error = NULL)
+{
+  const std::string temporary = std::string(filename) + ".tmp";
+  {
+    std::ofstream out(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    const int32_t row_D = D;
+    for(int i = 0; i < N && out; ++i)
+    {
+      out.write((const char*)&row_D, sizeof(row_D));
+      out.write((const char*)(v + (size_t)i * D), (size_t)D * sizeof(V));
+    }
+    out.flush();
+    if(!out)
+    {
+      std::remove(temporary.c_str());
+      return io_error(error, std::string("Unable to write ") + temporary);
     }
-    ++c;
-    //printf("read up to %d\n", c);
   }
-  if(c != N)
-    printf("WARNING! Read less points than expected.\n");
+  if(std::rename(temporary.c_str(), filename))
+  {
+    std::remove(temporary.c_str());
+    return io_error(error, std::string("Unable to write ") + filename);
+  }
+  return true;
+}
+
+/** \brief Write a collection of points in fvecs format, see 'readfvecs()'.
+ *
+ * @param v         - 1D vector of N x D floats
+ * @param N         - number of points
+ * @param D         - dimension of points
+ * @param filename  - output file
+ * @param error     - what went wrong, if writing failed. Default value is NULL.
+ * @return          - false if the file could not be written
+ */
+inline bool writefvecs(const std::vector<float>& v, int N, int D, const char* filename, std::string* error = NULL)
+{
+  return write_vecs(v.data(), N, D, filename, error);
+}
+
+/** \brief Write a collection of rows in ivecs format, see 'readivecs()', e.g. ground truth.
+ *
+ * @param v         - 1D vector of N x D ints
+ * @param N         - number of rows
+ * @param D         - dimension of rows
+ * @param filename  - output file
+ * @param error     - what went wrong, if writing failed. Default value is NULL.
+ * @return          - false if the file could not be written
+ */
+inline bool writeivecs(const std::vector<int>& v, int N, int D, const char* filename, std::string* error = NULL)
+{
+  return write_vecs(v.data(), N, D, filename, error);
+}
+
+/**
+ * Points of a file mapped in memory, used in place. The view is valid while 'file' is
+ * held; an empty view means that the file could not be mapped or is not well formed.
+ */
+template<typename T>
+struct MappedPointset
+{
+  std::shared_ptr<const MappedFile> file;
+  PointsetView<T> view;
+};
+
+/** \brief Map a file of rows of the form: D (int32) x_1 ... x_D. The rows are not copied;
+ * the view skips the D that starts every row.
+ *
+ * @param filename  - input file
+ * @return          - the mapped points, or an empty view
+ */
+template<typename T>
+MappedPointset<T> map_vecs(const char* filename)
+{
+  MappedPointset<T> points;
+  points.file = std::make_shared<const MappedFile>(filename);
+  const char* data = points.file->data();
+  const size_t size = points.file->size();
+  int32_t D;
+  if(!points.file->is_open() || size < sizeof(D))
+    return points;
+  std::memcpy(&D, data, sizeof(D));
+  const size_t row_bytes = sizeof(D) + (size_t)D * sizeof(T);
+  if(D <= 0 || size % row_bytes || sizeof(D) % sizeof(T))
+    return points;
+  const size_t N = size / row_bytes;
+  if(N > (size_t)INT32_MAX)
+    return points;
+  for(size_t i = 1; i < N; ++i)
+  {
+    int32_t row_D;
+    std::memcpy(&row_D, data + i * row_bytes, sizeof(row_D));
+    if(row_D != D)
+      return points;
+  }
+  points.view = PointsetView<T>((const T*)(data + sizeof(D)), N, D, row_bytes / sizeof(T));
+  return points;
 }
 
-/** \brief Helper function to read a file in IDX format.
+/** \brief Map a file in fvecs format (rows of D (int32) and D floats), without reading it.
  *
- * @param i - integer to reversed
- * @return  - reversed integer
+ * @param filename  - input file
+ * @return          - the mapped points, or an empty view
  */
-int reverseInt (int i) 
+inline MappedPointset<float> map_fvecs(const char* filename)
 {
-    unsigned char c1, c2, c3, c4;
+  return map_vecs<float>(filename);
+}
 
-    c1 = i & 255;
-    c2 = (i >> 8) & 255;
-    c3 = (i >> 16) & 255;
-    c4 = (i >> 24) & 255;
+/** \brief Map a file in bvecs format (rows of D (int32) and D unsigned bytes), without reading it.
+ *
+ * @param filename  - input file
+ * @return          - the mapped points, or an empty view
+ */
+inline MappedPointset<uint8_t> map_bvecs(const char* filename)
+{
+  return map_vecs<uint8_t>(filename);
+}
 
-    return ((int)c1 << 24) + ((int)c2 << 16) + ((int)c3 << 8) + c4;
+/** \brief Map a file in IDX format of unsigned bytes, e.g. MNIST, without reading it.
+ * The first dimension of the file is the number of points, the rest make up a point.
+ *
+ * @param filename  - input file
+ * @return          - the mapped points, or an empty view
+ */
+inline MappedPointset<uint8_t> map_IDX(const char* filename)
+{
+  MappedPointset<uint8_t> points;
+  points.file = std::make_shared<const MappedFile>(filename);
+  const unsigned char* data = (const unsigned char*)points.file->data();
+  const size_t size = points.file->size();
+  // two zero bytes, the type of the values (0x08 is unsigned byte) and the number of dimensions
+  if(!points.file->is_open() || size < 4 || data[0] != 0 || data[1] != 0 || data[2] != 0x08 || data[3] == 0)
+    return points;
+  const int dimensions = data[3];
+  const size_t header = 4 + 4 * (size_t)dimensions;
+  if(size < header)
+    return points;
+  size_t sizes[256];
+  for(int i = 0; i < dimensions; ++i)
+  {
+    const unsigned char* big_endian = data + 4 + 4 * i;
+    sizes[i] = ((size_t)big_endian[0] << 24) | ((size_t)big_endian[1] << 16) | ((size_t)big_endian[2] << 8) | big_endian[3];
+  }
+  size_t D = 1;
+  for(int i = 1; i < dimensions; ++i)
+    D *= sizes[i];
+  if(!sizes[0] || !D || D > (size_t)INT32_MAX || sizes[0] > (size_t)INT32_MAX || (size - header) / D < sizes[0])
+    return points;
+  points.view = PointsetView<uint8_t>(data + header, sizes[0], D);
+  return points;
 }
 
-/** \brief Read a file in IDX format.
+/** \brief Read a file in IDX format of unsigned bytes, e.g. MNIST, in one pass over the mapped file.
  *
  * Dimension and number of points should have been
  * assigned a value before reaching this function.
  *
- * @param v        - vector of points
- * @param N        - number of points
- * @param D        - dimension of points
- * @param filename - input file
+ * @param v           - vector of points
+ * @param N           - number of points. The file may hold more; the first N are read.
+ * @param D           - dimension of points, the product of all but the first dimension of the file
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that copy the points. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file is not in IDX format, has fewer than N points, or points of another dimension
  */
 template<typename T>
-void read_points_IDX_format(std::vector<T>& v, int N, int D, const char* filename)
+bool read_points_IDX_format(std::vector<T>& v, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
 {
-  if(!std::is_same<T, int>::value)
-    std::cout << "WARNING!!!!!!!!! You are reasding IDX format (usually MNIST), but T is not int!" << std::endl;
-  std::ifstream file (filename);
-
-  int magic_number=0;
-  int number_of_images=0;
-  int n_rows=0;
-  int n_cols=0;
-  int coord_idx = 0;
-  if (file.is_open())
+  const MappedPointset<uint8_t> points = map_IDX(filename);
+  if(!points.view.size())
+    return io_error(error, std::string("Unable to open the file, or it is not in IDX format of unsigned bytes: ") + filename);
+  if(points.view.dimension() != D)
+    return io_error(error, std::string(filename) + " has points of dimension " + std::to_string((long long)points.view.dimension()) +
+      ", expected " + std::to_string((long long)D));
+  if(points.view.size() < N)
+    return io_error(error, std::string(filename) + " holds " + std::to_string((long long)points.view.size()) +
+      " points, expected " + std::to_string((long long)N));
+  v.resize((size_t)N * D);
+  ThreadPool pool(threads_no);
+  pool.parallel_for(0, N, std::max(1, N / (4 * pool.size())), [&](const int start, const int end)
   {
-    file.read((char*)&magic_number,sizeof(magic_number)); 
-    magic_number= reverseInt(magic_number);
-    file.read((char*)&number_of_images,sizeof(number_of_images));
-    number_of_images= reverseInt(number_of_images);
-    file.read((char*)&n_rows,sizeof(n_rows));
-    n_rows= reverseInt(n_rows);
-    file.read((char*)&n_cols,sizeof(n_cols));
-    n_cols= reverseInt(n_cols);
-    //std::cout << "Read IDX formatted file, with n_rows = " << n_rows <<" and n_cols = " << n_cols << std::endl;
-    for(int i = 0; i < number_of_images && i < N; ++i)
-    {
-      for(int r=0;r<n_rows;++r)
-      {
-        for(int c=0;c<n_cols;++c)
-        {
-          unsigned char temp = -1;
-          file.read((char*)&temp,sizeof(temp));
-          //std::cout << (int)temp << std::endl;
-          v[coord_idx++] = (int)temp;
-        }
-      }
-    }
-  }
-  std::cout << "Read IDX formatted file, with number_of_images = " << number_of_images << " and dimension (n_rows x n_cols) = " << (n_rows * n_cols) << std::endl;
-  if (number_of_images != N)
-    std::cout << "ERROR, read less than " << N << " points!!\n\n";
-  if (n_rows * n_cols != D)
-    std::cout << "ERROR, dimension less than " << D << " points!!\n\n";
+    std::copy(points.view.row(start), points.view.row(end), v.begin() + (size_t)start * D);
+  });
+  return true;
 }
 
 /** \brief Read a custom format of Crow features,
- * based on the Oxford dataset.
+ * based on the Oxford dataset: every point is a bracketed list of numbers, which may span lines.
  *
  * Dimension and number of points should have been
  * assigned a value before reaching this function.
  *
- * @param data     - vector of points
- * @param N        - number of points. Usually 5063.
- * @param D        - dimension of points. Usually 512.
- * @param filename - input file
+ * @param data        - vector of points
+ * @param N           - number of points. Usually 5063.
+ * @param D           - dimension of points. Usually 512.
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that parse the file. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file does not hold N x D numbers
  */
 template<typename T>
-void read_crow_features_oxford(std::vector<T>& data, int N, int D, const char* filename) {
-  if(!std::is_same<T, float>::value && !std::is_same<T, double>::value)
-    std::cout << "WARNING!!!!!!!!! You are reasding CROW features for Oxford dataset, but T is neither float nor double!" << std::endl;
-
-    std::string line;
-    std::ifstream infile(filename);
-    int i = 0, j = 0;
-    while(std::getline(infile, line)) {
-        bool exists = line.find("[") != std::string::npos;
-        if(exists) {
-            std::istringstream iss(line);
-            char bracket;
-            iss >> bracket;
-            float v;
-            while (iss >> v) {
-                data[i * D + j++] = v;
-            }
-            continue;
-        }
-        exists = line.find("]") != std::string::npos;
-        std::istringstream iss(line);
-        float v;
-        while (iss >> v) {
-            data[i * D + j++] = v;
-        }
-        if(exists) {
-            j = 0;
-            ++i;
-        }
-        //break;
-    }
-    if(i != N)
-        std::cout << "WARNING!!!!!!!! READ less/more points (" << i << ") than N =" << N << std::endl;
-    infile.close();
+bool read_crow_features_oxford(std::vector<T>& data, int N, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  return read_text_values(data, (size_t)N * D, filename, error, threads_no);
 }
 
 /** \brief Read a custom format of Crow features,
- * based on the Oxford dataset's queries.
+ * based on the Oxford dataset's queries: numbers separated by white space.
  *
  * Dimension and number of points should have been
  * assigned a value before reaching this function.
  *
- * @param query     - vector of points
- * @param N        - number of points. Usually 55.
- * @param D        - dimension of points. Usually 512.
- * @param filename - input file
+ * @param query       - vector of points
+ * @param Q           - number of points. Usually 55.
+ * @param D           - dimension of points. Usually 512.
+ * @param filename    - input file
+ * @param error       - what went wrong, if reading failed. Default value is NULL.
+ * @param threads_no  - number of threads that parse the file. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - false if the file does not hold Q x D numbers
  */
 template<typename T>
-void read_crow_features_oxford_queries(std::vector<T>& query, int Q, int D, const char* filename) {
-    std::ifstream query_file;
-    float v;
-    query_file.open (filename);
-    for(int i = 0; i < Q; ++i) {
-        for(int j = 0; j < D; ++j) {
-            query_file >> v;
-            query[i * D + j] = v;
-        }
-    }
-    query_file.close();
+bool read_crow_features_oxford_queries(std::vector<T>& query, int Q, int D, const char* filename, std::string* error = NULL,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  return read_text_values(query, (size_t)Q * D, filename, error, threads_no);
 }
 
 /** \brief Print 2D vector.
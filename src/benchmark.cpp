@@ -0,0 +1,563 @@
+/**
+ * Benchmark of Dolphinn. Builds a Hypercube over a dataset for every combination of the swept
+ * parameters, serves the queries from concurrent threads, one query per call, and reports build
+ * time, peak memory of the build, throughput, latency percentiles and recall against the exact answers.
+ *
+ *   make benchmark
+ *   ./benchmark --data=gaussian --N=100000 --D=128 --Q=1000 --K=8,10,12 --budget=1000,5000 --threads=1,4
+ *   ./benchmark --data=fvecs:sift_base.fvecs --queries=sift_query.fvecs --Q=1000 --format=json
+ *   ./benchmark --data=clustered --tune-recall=0.9
+ *
+ * Run './benchmark --help' for all the options.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "IO.h"
+#include "hypercube.h"
+#include "exact_search.h"
+#include "tuner.h"
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+struct Options
+{
+  // gaussian, clustered, or <format>:<path> with format fvecs, bvecs or idx
+  std::string data;
+  // file of the queries, in the format of the data; if empty, queries are drawn or held out
+  std::string queries;
+  int N;
+  int D;
+  int Q;
+  // clusters and their standard deviation, for the clustered dataset
+  int clusters;
+  float sigma;
+  uint64_t seed;
+  std::vector<int> Ks;
+  std::vector<float> rs;
+  std::vector<int> budgets;
+  std::vector<int> threads;
+  int build_threads;
+  // knn, or radius
+  std::string query;
+  int k;
+  int radius;
+  // hamming, or margin
+  std::string probing;
+  // csv, or json
+  std::string format;
+  std::string output;
+  // directory of the cached exact answers, see 'exact_knn_cached()'; empty to recompute them
+  std::string cache;
+  // if set, K, r and the budget are chosen by 'tune()' for this recall@k, or this p99 latency in milliseconds
+  double tune_recall;
+  double tune_p99_ms;
+
+  Options()
+    : data("gaussian"), N(100000), D(128), Q(1000), clusters(100), sigma(0.2), seed(1), build_threads(std::thread::hardware_concurrency()),
+    query("knn"), k(10), radius(1), probing("hamming"), format("csv"), cache("."),
+    tune_recall(0), tune_p99_ms(0)
+  {}
+};
+
+/** \brief Print the options.
+ */
+void usage()
+{
+  std::cerr <<
+    "Usage: benchmark [--option=value ...]\n"
+    "  --data=gaussian|clustered|fvecs:PATH|bvecs:PATH|idx:PATH   dataset (default gaussian)\n"
+    "  --queries=PATH        queries, in the format of the dataset. Default: drawn like the\n"
+    "                        synthetic points, or the last Q points of a file, held out\n"
+    "  --N=INT               points of a synthetic dataset, at most this many of a file (default 100000)\n"
+    "  --D=INT               dimension of a synthetic dataset (default 128)\n"
+    "  --Q=INT               number of queries (default 1000)\n"
+    "  --clusters=INT        clusters of the clustered dataset (default 100)\n"
+    "  --sigma=FLOAT         standard deviation of a cluster, centers have 1 (default 0.2)\n"
+    "  --seed=INT            seed of the synthetic datasets (default 1)\n"
+    "  --K=LIST              dimensions of the Hypercube (default floor(log2(N)/2))\n"
+    "  --r=LIST              hashing windows (default 4)\n"
+    "  --budget=LIST         MAX_PNTS_TO_SEARCH (default N/100)\n"
+    "  --threads=LIST        threads serving queries, one query per call (default 1)\n"
+    "  --build-threads=INT   threads of the construction (default all)\n"
+    "  --query=knn|radius    query type (default knn)\n"
+    "  --k=INT               neighbors per knn query, recall@k (default 10)\n"
+    "  --radius=INT          radius of radius queries (default 1)\n"
+    "  --probing=hamming|margin  probing order (default hamming)\n"
+    "  --format=csv|json     output format (default csv)\n"
+    "  --output=PATH         output file (default stdout)\n"
+    "  --cache=DIR           directory of the cached exact answers, empty to recompute them (default .)\n"
+    "  --tune-recall=FLOAT   measure only the K, r and budget chosen by the tuner for this recall@k\n"
+    "  --tune-p99=FLOAT      measure only the K, r and budget chosen by the tuner for this p99 latency (ms)\n"
+    "Lists are comma separated, e.g. --K=8,10,12.\n";
+}
+
+template <typename V>
+bool parse_list(const std::string& text, std::vector<V>& values)
+{
+  values.clear();
+  std::stringstream in(text);
+  std::string item;
+  while(std::getline(in, item, ','))
+  {
+    std::stringstream item_in(item);
+    V value;
+    if(!(item_in >> value))
+      return false;
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+/** \brief Parse '--name=value' arguments.
+ *
+ * @param argc     - number of arguments
+ * @param argv     - the arguments
+ * @param options  - the options (to be populated)
+ * @return         - false on an unknown or malformed option
+ */
+bool parse_options(int argc, char** argv, Options& options)
+{
+  for(int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    const size_t equals = argument.find('=');
+    if(argument.compare(0, 2, "--") || equals == std::string::npos)
+      return false;
+    const std::string name = argument.substr(2, equals - 2), value = argument.substr(equals + 1);
+    bool ok = true;
+    if(name == "data") options.data = value;
+    else if(name == "queries") options.queries = value;
+    else if(name == "N") options.N = std::atoi(value.c_str());
+    else if(name == "D") options.D = std::atoi(value.c_str());
+    else if(name == "Q") options.Q = std::atoi(value.c_str());
+    else if(name == "clusters") options.clusters = std::atoi(value.c_str());
+    else if(name == "sigma") options.sigma = std::atof(value.c_str());
+    else if(name == "seed") options.seed = std::strtoull(value.c_str(), NULL, 10);
+    else if(name == "K") ok = parse_list(value, options.Ks);
+    else if(name == "r") ok = parse_list(value, options.rs);
+    else if(name == "budget") ok = parse_list(value, options.budgets);
+    else if(name == "threads") ok = parse_list(value, options.threads);
+    else if(name == "build-threads") options.build_threads = std::atoi(value.c_str());
+    else if(name == "query") { options.query = value; ok = value == "knn" || value == "radius"; }
+    else if(name == "k") options.k = std::atoi(value.c_str());
+    else if(name == "radius") options.radius = std::atoi(value.c_str());
+    else if(name == "probing") { options.probing = value; ok = value == "hamming" || value == "margin"; }
+    else if(name == "format") { options.format = value; ok = value == "csv" || value == "json"; }
+    else if(name == "output") options.output = value;
+    else if(name == "cache") options.cache = value;
+    else if(name == "tune-recall") options.tune_recall = std::atof(value.c_str());
+    else if(name == "tune-p99") options.tune_p99_ms = std::atof(value.c_str());
+    else ok = false;
+    if(!ok)
+      return false;
+  }
+  return options.N > 0 && options.D > 0 && options.Q > 0 && options.k > 0;
+}
+
+/** \brief Draw points with independent N(0,1) coordinates.
+ *
+ * @param points     - 1D vector of n x D points (to be populated)
+ * @param n          - number of points
+ * @param D          - dimension of points
+ * @param generator  - random generator
+ */
+void generate_gaussian(std::vector<float>& points, const int n, const int D, std::mt19937_64& generator)
+{
+  std::normal_distribution<float> normal(0, 1);
+  points.resize((size_t)n * D);
+  for(auto& x: points)
+    x = normal(generator);
+}
+
+/** \brief Draw points around centers: every point picks a center uniformly and adds N(0, sigma) noise.
+ *
+ * @param points     - 1D vector of n x D points (to be populated)
+ * @param n          - number of points
+ * @param centers    - 1D vector of the centers, D coordinates each
+ * @param D          - dimension of points
+ * @param sigma      - standard deviation of the noise
+ * @param generator  - random generator
+ */
+void generate_clustered(std::vector<float>& points, const int n, const std::vector<float>& centers, const int D, const float sigma, std::mt19937_64& generator)
+{
+  std::normal_distribution<float> normal(0, sigma);
+  std::uniform_int_distribution<int> pick(0, centers.size() / D - 1);
+  points.resize((size_t)n * D);
+  for(int i = 0; i < n; ++i)
+  {
+    const float* center = &centers[(size_t)pick(generator) * D];
+    for(int j = 0; j < D; ++j)
+      points[(size_t)i * D + j] = center[j] + normal(generator);
+  }
+}
+
+/** \brief Map a file of points and copy up to 'limit' of them as floats.
+ *
+ * @param format  - fvecs, bvecs or idx
+ * @param path    - path of the file
+ * @param limit   - most points to copy
+ * @param points  - 1D vector of the points (to be populated)
+ * @param D       - dimension of points (to be populated)
+ * @param error   - what went wrong (to be populated)
+ * @return        - false if the file could not be read
+ */
+bool load_points(const std::string& format, const std::string& path, const int limit, std::vector<float>& points, int& D, std::string& error)
+{
+  PointsetView<float> floats;
+  PointsetView<uint8_t> bytes;
+  MappedPointset<float> float_file;
+  MappedPointset<uint8_t> byte_file;
+  if(format == "fvecs")
+    floats = (float_file = map_fvecs(path.c_str())).view;
+  else if(format == "bvecs")
+    bytes = (byte_file = map_bvecs(path.c_str())).view;
+  else if(format == "idx")
+    bytes = (byte_file = map_IDX(path.c_str())).view;
+  else
+  {
+    error = "Unknown format " + format + ".";
+    return false;
+  }
+  const int n = std::min(limit, std::max(floats.size(), bytes.size()));
+  D = std::max(floats.dimension(), bytes.dimension());
+  if(!n || !D)
+  {
+    error = "Could not read " + path + ".";
+    return false;
+  }
+  points.resize((size_t)n * D);
+  for(int i = 0; i < n; ++i)
+  {
+    if(floats.size())
+      std::copy(floats.row(i), floats.row(i) + D, points.begin() + (size_t)i * D);
+    else
+      std::copy(bytes.row(i), bytes.row(i) + D, points.begin() + (size_t)i * D);
+  }
+  return true;
+}
+
+/** \brief Build the points and queries of the benchmark.
+ *
+ * @param options  - the options; N and D are updated to those of a file
+ * @param points   - 1D vector of the points (to be populated)
+ * @param queries  - 1D vector of the queries (to be populated)
+ * @param error    - what went wrong (to be populated)
+ * @return         - false if the dataset could not be made
+ */
+bool make_dataset(Options& options, std::vector<float>& points, std::vector<float>& queries, std::string& error)
+{
+  std::mt19937_64 generator(options.seed);
+  if(options.data == "gaussian")
+  {
+    generate_gaussian(points, options.N, options.D, generator);
+    generate_gaussian(queries, options.Q, options.D, generator);
+    return true;
+  }
+  if(options.data == "clustered")
+  {
+    std::vector<float> centers;
+    generate_gaussian(centers, std::max(1, options.clusters), options.D, generator);
+    generate_clustered(points, options.N, centers, options.D, options.sigma, generator);
+    generate_clustered(queries, options.Q, centers, options.D, options.sigma, generator);
+    return true;
+  }
+  const size_t colon = options.data.find(':');
+  if(colon == std::string::npos)
+  {
+    error = "Unknown dataset " + options.data + ".";
+    return false;
+  }
+  const std::string format = options.data.substr(0, colon);
+  const int held_out = options.queries.empty() ? options.Q : 0;
+  if(!load_points(format, options.data.substr(colon + 1), options.N + held_out, points, options.D, error))
+    return false;
+  options.N = points.size() / options.D;
+  if(options.queries.empty())
+  {
+    if(options.N <= options.Q)
+    {
+      error = "The dataset has no more points than queries.";
+      return false;
+    }
+    queries.assign(points.end() - (size_t)options.Q * options.D, points.end());
+    points.resize(points.size() - queries.size());
+    options.N -= options.Q;
+    return true;
+  }
+  int query_D;
+  if(!load_points(format, options.queries, options.Q, queries, query_D, error))
+    return false;
+  if(query_D != options.D)
+  {
+    error = "The queries do not have the dimension of the points.";
+    return false;
+  }
+  options.Q = queries.size() / query_D;
+  return true;
+}
+
+/**
+ * Outcome of serving all the queries with one configuration.
+ */
+struct Measurement
+{
+  double seconds;
+  // seconds of every query
+  std::vector<double> latencies;
+};
+
+/** \brief Serve the queries from 'threads_no' threads, which take the next query until none is left.
+ *
+ * @param Q           - number of queries
+ * @param threads_no  - number of threads
+ * @param run_query   - runs a query, given its index
+ * @return            - wall time and latency of every query
+ */
+template <typename Run>
+Measurement serve(const int Q, const int threads_no, const Run& run_query)
+{
+  Measurement measurement;
+  measurement.latencies.resize(Q);
+  std::atomic<int> next(0);
+  const benchmark_clock::time_point start = benchmark_clock::now();
+  std::vector<std::thread> servers;
+  for(int t = 0; t < std::max(1, threads_no); ++t)
+    servers.push_back(std::thread([&]()
+    {
+      for(int q = next++; q < Q; q = next++)
+      {
+        const benchmark_clock::time_point query_start = benchmark_clock::now();
+        run_query(q);
+        measurement.latencies[q] = std::chrono::duration<double>(benchmark_clock::now() - query_start).count();
+      }
+    }));
+  for(auto& server: servers)
+    server.join();
+  measurement.seconds = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+  return measurement;
+}
+
+double percentile(std::vector<double> values, const double fraction)
+{
+  if(values.empty())
+    return 0;
+  const size_t i = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+/**
+ * Peak resident memory of a build, over the resident memory before it. The peak of the process
+ * is reset first, so that the dataset, the exact answers and earlier builds do not count; if it
+ * cannot be reset, the peak of the whole process so far is used, and the figure is an upper bound.
+ */
+class BuildMemory
+{
+    size_t resident_kb;
+  public:
+    BuildMemory()
+    {
+      static bool warned = false;
+      if(!reset_peak_memory() && !warned)
+      {
+        std::cerr << "Could not reset the peak memory; build_peak_mb is an upper bound." << std::endl;
+        warned = true;
+      }
+      resident_kb = process_memory_kb("VmRSS");
+    }
+
+    /** \brief Peak memory since the constructor, over the resident memory then.
+     *
+     * @return - megabytes
+     */
+    double peak_mb() const
+    {
+      const size_t peak_kb = process_memory_kb("VmHWM");
+      return peak_kb > resident_kb ? (peak_kb - resident_kb) / 1024.0 : 0;
+    }
+};
+
+/**
+ * One line of the report.
+ */
+struct Row
+{
+  int K;
+  float r;
+  int budget;
+  int threads;
+  double build_seconds;
+  // peak memory of the build over the memory before it, see BuildMemory
+  double build_peak_mb;
+  double qps;
+  double p50_ms;
+  double p99_ms;
+  double recall;
+};
+
+void write_report(std::ostream& out, const Options& options, const std::vector<Row>& rows)
+{
+  const std::string dataset = options.data;
+  if(options.format == "csv")
+  {
+    out << "dataset,N,D,Q,query,k,K,r,budget,threads,build_s,build_peak_mb,qps,p50_ms,p99_ms,recall\n";
+    for(auto& row: rows)
+      out << dataset << ',' << options.N << ',' << options.D << ',' << options.Q << ',' << options.query << ',' << options.k << ','
+        << row.K << ',' << row.r << ',' << row.budget << ',' << row.threads << ',' << row.build_seconds << ',' << row.build_peak_mb << ','
+        << row.qps << ',' << row.p50_ms << ',' << row.p99_ms << ',' << row.recall << '\n';
+    return;
+  }
+  out << "[\n";
+  for(size_t i = 0; i < rows.size(); ++i)
+  {
+    const Row& row = rows[i];
+    out << "  {\"dataset\": \"" << dataset << "\", \"N\": " << options.N << ", \"D\": " << options.D << ", \"Q\": " << options.Q
+      << ", \"query\": \"" << options.query << "\", \"k\": " << options.k << ", \"K\": " << row.K << ", \"r\": " << row.r
+      << ", \"budget\": " << row.budget << ", \"threads\": " << row.threads << ", \"build_s\": " << row.build_seconds
+      << ", \"build_peak_mb\": " << row.build_peak_mb << ", \"qps\": " << row.qps << ", \"p50_ms\": " << row.p50_ms
+      << ", \"p99_ms\": " << row.p99_ms << ", \"recall\": " << row.recall << "}" << (i + 1 < rows.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  if(!parse_options(argc, argv, options))
+  {
+    usage();
+    return -1;
+  }
+  std::vector<float> points, queries;
+  std::string error;
+  if(!make_dataset(options, points, queries, error))
+  {
+    std::cerr << error << std::endl;
+    return -1;
+  }
+  const int N = options.N, D = options.D, Q = options.Q;
+  if(options.tune_recall > 0 || options.tune_p99_ms > 0)
+  {
+    // tuned on queries held out of the points, not on those measured
+    Dolphinn::TuningOptions tuning;
+    tuning.target_recall = options.tune_recall;
+    tuning.target_p99_ms = options.tune_p99_ms;
+    tuning.k = options.k;
+    tuning.threads_no = options.build_threads;
+    tuning.seed = options.seed;
+    const benchmark_clock::time_point tune_start = benchmark_clock::now();
+    const Dolphinn::HypercubeConfig config = Dolphinn::tune(PointsetView<float>(points, D), tuning);
+    std::cerr << "Tuned in " << std::chrono::duration<double>(benchmark_clock::now() - tune_start).count() << " seconds: K = " << config.K
+      << ", r = " << config.r << ", budget = " << config.budget << (config.meets_target ? "" : " (target not met)") << std::endl;
+    options.Ks.assign(1, config.K);
+    options.rs.assign(1, config.r);
+    options.budgets.assign(1, config.budget);
+  }
+  if(options.Ks.empty())
+    options.Ks.push_back(std::max(1, (int)std::floor(std::log2(N) / 2)));
+  if(options.rs.empty())
+    options.rs.push_back(4);
+  if(options.budgets.empty())
+    options.budgets.push_back(std::max(1, N / 100));
+  if(options.threads.empty())
+    options.threads.push_back(1);
+  const bool knn = options.query == "knn";
+  const int k = knn ? options.k : 1;
+  std::cerr << "N = " << N << ", D = " << D << ", Q = " << Q << std::endl;
+
+  const benchmark_clock::time_point exact_start = benchmark_clock::now();
+  std::vector<std::pair<int, float>> exact;
+  const PointsetView<float> point_view(points, D), query_view(queries, D);
+  bool cached = false;
+  if(options.cache.empty())
+    exact_knn(point_view, query_view, k, exact, options.build_threads);
+  else
+    cached = exact_knn_cached(point_view, query_view, k, exact, options.cache, options.build_threads);
+  std::cerr << "Exact answers" << (cached ? " (cached): " : ": ") << std::chrono::duration<double>(benchmark_clock::now() - exact_start).count() << " seconds." << std::endl;
+  const float squared_radius = (float)options.radius * options.radius;
+  int answerable = 0;
+  for(int q = 0; q < Q; ++q)
+    answerable += exact[(size_t)q * k].second <= squared_radius;
+
+  std::vector<Row> rows;
+  for(const int K: options.Ks)
+    for(const float r: options.rs)
+    {
+      const BuildMemory memory;
+      const benchmark_clock::time_point build_start = benchmark_clock::now();
+      std::unique_ptr<Dolphinn::Hypercube<float, char>> cube(new Dolphinn::Hypercube<float, char>(points, N, D, K, options.build_threads, r));
+      Row row;
+      row.build_seconds = std::chrono::duration<double>(benchmark_clock::now() - build_start).count();
+      row.build_peak_mb = memory.peak_mb();
+      row.K = K;
+      row.r = r;
+      cube->set_probing(options.probing == "margin" ? MARGIN_PROBING : HAMMING_PROBING);
+      for(const int budget: options.budgets)
+        for(const int threads_no: options.threads)
+        {
+          std::vector<std::pair<int, float>> found((size_t)Q * k, std::make_pair(-1, 0.0f));
+          std::vector<int> found_within(Q, -1);
+          const Measurement measurement = serve(Q, threads_no, [&](const int q)
+          {
+            // one query per call, as a server would run it
+            std::vector<float> query(queries.begin() + (size_t)q * D, queries.begin() + (size_t)(q + 1) * D);
+            if(knn)
+            {
+              std::vector<std::pair<int, float>> answers(k);
+              cube->knn_query(query, 1, k, budget, answers, 1);
+              std::copy(answers.begin(), answers.end(), found.begin() + (size_t)q * k);
+            }
+            else
+            {
+              std::vector<int> answer(1);
+              cube->radius_query(query, 1, options.radius, budget, answer, 1);
+              found_within[q] = answer[0];
+            }
+          });
+          double recall = 0;
+          if(knn)
+            recall = knn_recall(found, exact, Q, k);
+          else
+          {
+            // the fraction of the queries with a point within the radius that found one
+            for(int q = 0; q < Q; ++q)
+              recall += found_within[q] != -1;
+            recall = answerable ? recall / answerable : 1;
+          }
+          row.budget = budget;
+          row.threads = threads_no;
+          row.qps = Q / measurement.seconds;
+          row.p50_ms = 1000 * percentile(measurement.latencies, 0.5);
+          row.p99_ms = 1000 * percentile(measurement.latencies, 0.99);
+          row.recall = recall;
+          rows.push_back(row);
+          std::cerr << "K = " << K << ", r = " << r << ", budget = " << budget << ", threads = " << threads_no
+            << ": " << row.qps << " queries/s, recall " << recall << std::endl;
+        }
+    }
+
+  if(options.output.empty())
+    write_report(std::cout, options, rows);
+  else
+  {
+    std::ofstream out(options.output.c_str());
+    write_report(out, options, rows);
+    if(!out.good())
+    {
+      std::cerr << "Could not write " << options.output << std::endl;
+      return -1;
+    }
+  }
+  return 0;
+}
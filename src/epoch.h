@@ -0,0 +1,178 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+
+/**
+ * Epoch-based reclamation of objects that readers use without locks. A reader pins the
+ * current epoch while it uses the objects it found; a writer that replaces an object retires
+ * it, and the object is freed once every reader pinned at or before the epoch of its
+ * retirement has unpinned. Pinning is two atomic stores to a slot of the calling thread.
+ */
+class EpochDomain
+{
+    // number of threads that can be pinned at the same time; more wait for a free slot
+    static const int SLOTS = 256;
+    // epoch announced by the thread of the slot, 0 when not pinned. Padded to a cache line,
+    // so that readers do not contend.
+    struct alignas(64) Slot
+    {
+      std::atomic<uint64_t> epoch;
+      std::atomic<bool> taken;
+    };
+    // slot of the calling thread, and how deep it is pinned
+    struct Participant
+    {
+      EpochDomain* domain;
+      int slot;
+      int depth;
+      Participant() : domain(NULL), slot(-1), depth(0) {}
+      ~Participant()
+      {
+        if(domain)
+          domain->slots[slot].taken.store(false, std::memory_order_release);
+      }
+    };
+    Slot slots[SLOTS];
+    std::atomic<uint64_t> global_epoch;
+    // retired objects, with the epoch of their retirement
+    std::vector<std::pair<uint64_t, std::shared_ptr<const void>>> retired;
+    std::mutex retired_mutex;
+
+    EpochDomain()
+      : global_epoch(1)
+    {
+      for(auto& slot: slots)
+      {
+        slot.epoch.store(0);
+        slot.taken.store(false);
+      }
+    }
+
+    Participant& participant()
+    {
+      static thread_local Participant self;
+      if(!self.domain)
+      {
+        for(int i = 0; ; i = (i + 1) % SLOTS)
+        {
+          bool expected = false;
+          if(!slots[i].taken.load(std::memory_order_relaxed) && slots[i].taken.compare_exchange_strong(expected, true))
+          {
+            self.slot = i;
+            break;
+          }
+          if(i == SLOTS - 1)
+            std::this_thread::yield();
+        }
+        self.domain = this;
+      }
+      return self;
+    }
+
+    /** \brief Free the retired objects that no pinned reader can hold. The caller holds 'retired_mutex'.
+    */
+    void reclaim_locked()
+    {
+      uint64_t oldest = UINT64_MAX;
+      for(auto& slot: slots)
+      {
+        const uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+        if(epoch && epoch < oldest)
+          oldest = epoch;
+      }
+      size_t kept = 0;
+      for(size_t i = 0; i < retired.size(); ++i)
+        if(retired[i].first >= oldest)
+          retired[kept++] = std::move(retired[i]);
+      retired.resize(kept);
+    }
+  public:
+    /** \brief The domain of the process. A thread keeps its slot until it exits.
+      *
+      * @return - the domain
+    */
+    static EpochDomain& global()
+    {
+      static EpochDomain domain;
+      return domain;
+    }
+
+    /** \brief Start using shared objects. Pins nest; only the outermost one announces the epoch.
+    */
+    void pin()
+    {
+      Participant& self = participant();
+      if(self.depth++ == 0)
+        slots[self.slot].epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    /** \brief Stop using shared objects, after the matching 'pin()'.
+    */
+    void unpin()
+    {
+      Participant& self = participant();
+      if(--self.depth == 0)
+        slots[self.slot].epoch.store(0, std::memory_order_release);
+    }
+
+    /** \brief Free an object once the readers that may hold it have unpinned. Call it after the
+      * object was made unreachable to new readers.
+      *
+      * @param object  - the object, freed when its last reference is dropped
+    */
+    void retire(std::shared_ptr<const void> object)
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex);
+      retired.push_back(std::make_pair(global_epoch.fetch_add(1, std::memory_order_seq_cst), std::move(object)));
+      reclaim_locked();
+    }
+
+    /** \brief Free the retired objects that no pinned reader can hold.
+    */
+    void reclaim()
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex);
+      reclaim_locked();
+    }
+
+    /** \brief Number of retired objects not freed yet.
+      *
+      * @return - the number of objects
+    */
+    size_t pending()
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex);
+      return retired.size();
+    }
+};
+
+/**
+ * Pins the epoch of a domain for the lifetime of the guard.
+ */
+class EpochGuard
+{
+    EpochDomain& domain;
+  public:
+    explicit EpochGuard(EpochDomain& domain)
+      : domain(domain)
+    {
+      domain.pin();
+    }
+
+    ~EpochGuard()
+    {
+      domain.unpin();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+#endif /*EPOCH_H*/
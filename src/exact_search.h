@@ -0,0 +1,272 @@
+#ifndef EXACT_SEARCH_H
+#define EXACT_SEARCH_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include "Euclidean_dist.h"
+#include "pointset_view.h"
+#include "thread_pool.h"
+#include "IO.h"
+
+/**
+ * Exact search by brute force, e.g. the ground truth of benchmarks and tuning. Threads take
+ * blocks of queries, and every block scans the points one cache-sized block at a time, so that
+ * a block of points is loaded once for all the queries of the block. Distances are those of a
+ * metric of metric.h, squared Euclidean by default, and use the vectorized kernels of
+ * Euclidean_dist_simd.h. The '_cached' variants, which are Euclidean, keep their results in
+ * ivecs/fvecs files named after a hash of the points and the queries, and read them back on the next run.
+ */
+
+// queries of a block, which share every block of points
+const int EXACT_QUERY_BLOCK = 32;
+// bytes of a block of points, about half of a typical L2 cache
+const size_t EXACT_POINT_BLOCK_BYTES = 256 * 1024;
+
+/** \brief Run 'scan' on every (block of queries, block of points), block of points in order
+ * for every block of queries, with blocks of queries in parallel.
+ *
+ * @param points      - the N points
+ * @param queries     - the Q queries
+ * @param threads_no  - number of threads
+ * @param scan        - called with (q_start, q_end, p_start, p_end); a block of queries is handled by one thread at a time
+ */
+template <typename T, typename Scan>
+void scan_blocks(const PointsetView<T>& points, const PointsetView<T>& queries, const int threads_no, const Scan& scan)
+{
+  const int N = points.size(), Q = queries.size();
+  const int point_block = std::max<int>(64, EXACT_POINT_BLOCK_BYTES / (sizeof(T) * std::max(1, points.dimension())));
+  ThreadPool pool(threads_no);
+  // smaller blocks of queries when there are few, so that every thread gets some
+  const int query_block = std::max(1, std::min(EXACT_QUERY_BLOCK, Q / pool.size()));
+  pool.parallel_for(0, Q, query_block, [&](const int q_start, const int q_end)
+  {
+    for(int p_start = 0; p_start < N; p_start += point_block)
+      scan(q_start, q_end, p_start, std::min(N, p_start + point_block));
+  });
+}
+
+/** \brief The k nearest points of every query.
+ *
+ * @param points      - the N points
+ * @param queries     - the Q queries, of the dimension of the points
+ * @param k           - number of neighbors
+ * @param results     - Q x k indices and squared distances (or those of 'Metric'), nearest first, padded with (-1, 1000000.0) (to be populated)
+ * @param threads_no  - number of threads. Default value is 'std::thread::hardware_concurrency()'.
+ */
+template <typename T, typename Metric = L2Metric>
+void exact_knn(const PointsetView<T>& points, const PointsetView<T>& queries, const int k, std::vector<std::pair<int, float>>& results,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  const int Q = queries.size(), D = points.dimension();
+  // padding of every query, kept if there are no points to scan
+  results.assign((size_t)Q * k, std::make_pair(-1, 1000000.0f));
+  // (squared distance, index) of the best points of every query, as max-heaps
+  std::vector<std::vector<std::pair<float, int>>> best(Q);
+  scan_blocks(points, queries, threads_no, [&](const int q_start, const int q_end, const int p_start, const int p_end)
+  {
+    for(int q = q_start; q < q_end; ++q)
+    {
+      const T* query = queries.row(q);
+      std::vector<std::pair<float, int>>& heap = best[q];
+      for(int p = p_start; p < p_end; ++p)
+      {
+        const float distance = Metric::distance(query, query + D, points.row(p));
+        if((int)heap.size() < k)
+        {
+          heap.push_back(std::make_pair(distance, p));
+          std::push_heap(heap.begin(), heap.end());
+        }
+        else if(distance < heap.front().first)
+        {
+          std::pop_heap(heap.begin(), heap.end());
+          heap.back() = std::make_pair(distance, p);
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+      if(p_end == points.size())
+      {
+        write_k_Nearest_Neighbors(heap, k, &results[(size_t)q * k]);
+        std::vector<std::pair<float, int>>().swap(heap);
+      }
+    }
+  });
+}
+
+/** \brief The nearest point of every query.
+ *
+ * @param points      - the N points
+ * @param queries     - the Q queries, of the dimension of the points
+ * @param results     - Q indices and squared distances (or those of 'Metric'), (-1, 1000000.0) if there are no points (to be populated)
+ * @param threads_no  - number of threads. Default value is 'std::thread::hardware_concurrency()'.
+ */
+template <typename T, typename Metric = L2Metric>
+void exact_nearest_neighbor(const PointsetView<T>& points, const PointsetView<T>& queries, std::vector<std::pair<int, float>>& results,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  exact_knn<T, Metric>(points, queries, 1, results, threads_no);
+}
+
+/** \brief The first point within a radius of every query. A query stops scanning at its first point.
+ *
+ * @param points          - the N points
+ * @param queries         - the Q queries, of the dimension of the points
+ * @param radius          - the radius, see 'Metric::radius_threshold()'
+ * @param results         - Q indices of the first point within the radius, -1 if there is none (to be populated)
+ * @param threads_no      - number of threads. Default value is 'std::thread::hardware_concurrency()'.
+ */
+template <typename T, typename Metric = L2Metric>
+void exact_radius(const PointsetView<T>& points, const PointsetView<T>& queries, const float radius, std::vector<int>& results,
+  const int threads_no = std::thread::hardware_concurrency())
+{
+  const int D = points.dimension();
+  const float squared_radius = Metric::radius_threshold(radius);
+  results.assign(queries.size(), -1);
+  scan_blocks(points, queries, threads_no, [&](const int q_start, const int q_end, const int p_start, const int p_end)
+  {
+    for(int q = q_start; q < q_end; ++q)
+    {
+      const T* query = queries.row(q);
+      for(int p = p_start; p < p_end && results[q] == -1; ++p)
+        if(Metric::distance(query, query + D, points.row(p)) <= squared_radius)
+          results[q] = p;
+    }
+  });
+}
+
+/** \brief Recall@k of approximate k nearest neighbors: the fraction of the exact k nearest that were reported.
+ *
+ * @param found  - Q x k indices (and distances) of the approximate neighbors, -1 for none
+ * @param exact  - Q x k indices (and distances) of the exact neighbors, see 'exact_knn()'
+ * @param Q      - number of queries
+ * @param k      - number of neighbors
+ * @return       - the recall, in [0, 1]
+ */
+inline double knn_recall(const std::vector<std::pair<int, float>>& found, const std::vector<std::pair<int, float>>& exact, const int Q, const int k)
+{
+  if(Q <= 0 || k <= 0)
+    return 1;
+  double recall = 0;
+  for(int q = 0; q < Q; ++q)
+    for(int i = 0; i < k; ++i)
+      for(int j = 0; j < k; ++j)
+        if(found[(size_t)q * k + i].first != -1 && found[(size_t)q * k + i].first == exact[(size_t)q * k + j].first)
+          recall += 1;
+  return recall / ((double)Q * k);
+}
+
+/** \brief Hash of a pointset: its size, dimension, element size and coordinates.
+ *
+ * @param points  - the points
+ * @return        - the hash
+ */
+template <typename T>
+uint64_t fingerprint(const PointsetView<T>& points)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL ^ ((uint64_t)points.size() << 32) ^ ((uint64_t)points.dimension() << 8) ^ sizeof(T);
+  const size_t row_bytes = (size_t)points.dimension() * sizeof(T);
+  for(int i = 0; i < points.size(); ++i)
+  {
+    const unsigned char* row = (const unsigned char*)points.row(i);
+    size_t b = 0;
+    for(; b + sizeof(uint64_t) <= row_bytes; b += sizeof(uint64_t))
+    {
+      uint64_t word;
+      std::memcpy(&word, row + b, sizeof(word));
+      hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+      hash ^= hash >> 29;
+    }
+    for(; b < row_bytes; ++b)
+      hash = (hash ^ row[b]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/** \brief Path of the cached results of a search, without extension.
+ *
+ * @param directory  - directory of the cache
+ * @param points     - the points
+ * @param queries    - the queries
+ * @param search     - the search and its parameter, e.g. "knn10"
+ * @return           - the path
+ */
+template <typename T>
+std::string exact_cache_path(const std::string& directory, const PointsetView<T>& points, const PointsetView<T>& queries, const std::string& search)
+{
+  const uint64_t key = fingerprint(points) * 31 + fingerprint(queries);
+  char name[64];
+  std::snprintf(name, sizeof(name), "exact_%016llx_", (unsigned long long)key);
+  return directory + "/" + name + search;
+}
+
+/** \brief 'exact_knn()', with the results kept in '<directory>/exact_<hash>_knn<k>.ivecs' (indices)
+ * and '.fvecs' (squared distances). Failing to write the cache is not an error.
+ *
+ * @param points      - the N points
+ * @param queries     - the Q queries, of the dimension of the points
+ * @param k           - number of neighbors
+ * @param results     - Q x k indices and squared distances, see 'exact_knn()' (to be populated)
+ * @param directory   - directory of the cache
+ * @param threads_no  - number of threads. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - true if the results were read from the cache
+ */
+template <typename T>
+bool exact_knn_cached(const PointsetView<T>& points, const PointsetView<T>& queries, const int k, std::vector<std::pair<int, float>>& results,
+  const std::string& directory, const int threads_no = std::thread::hardware_concurrency())
+{
+  const int Q = queries.size();
+  const std::string path = exact_cache_path(directory, points, queries, "knn" + std::to_string((long long)k));
+  std::vector<int> indices;
+  std::vector<float> distances;
+  if(readivecs(indices, Q, k, (path + ".ivecs").c_str(), NULL, threads_no) && readfvecs(distances, Q, k, (path + ".fvecs").c_str(), NULL, threads_no))
+  {
+    results.resize((size_t)Q * k);
+    for(size_t i = 0; i < results.size(); ++i)
+      results[i] = std::make_pair(indices[i], distances[i]);
+    return true;
+  }
+  exact_knn(points, queries, k, results, threads_no);
+  indices.resize(results.size());
+  distances.resize(results.size());
+  for(size_t i = 0; i < results.size(); ++i)
+  {
+    indices[i] = results[i].first;
+    distances[i] = results[i].second;
+  }
+  writefvecs(distances, Q, k, (path + ".fvecs").c_str());
+  writeivecs(indices, Q, k, (path + ".ivecs").c_str());
+  return false;
+}
+
+/** \brief 'exact_radius()', with the results kept in '<directory>/exact_<hash>_radius<radius>.ivecs'.
+ * Failing to write the cache is not an error.
+ *
+ * @param points      - the N points
+ * @param queries     - the Q queries, of the dimension of the points
+ * @param radius      - the radius
+ * @param results     - Q indices, see 'exact_radius()' (to be populated)
+ * @param directory   - directory of the cache
+ * @param threads_no  - number of threads. Default value is 'std::thread::hardware_concurrency()'.
+ * @return            - true if the results were read from the cache
+ */
+template <typename T>
+bool exact_radius_cached(const PointsetView<T>& points, const PointsetView<T>& queries, const float radius, std::vector<int>& results,
+  const std::string& directory, const int threads_no = std::thread::hardware_concurrency())
+{
+  char search[64];
+  std::snprintf(search, sizeof(search), "radius%g", radius);
+  const std::string path = exact_cache_path(directory, points, queries, search) + ".ivecs";
+  if(readivecs(results, queries.size(), 1, path.c_str(), NULL, threads_no))
+    return true;
+  exact_radius(points, queries, radius, results, threads_no);
+  writeivecs(results, queries.size(), 1, path.c_str());
+  return false;
+}
+
+#endif /*EXACT_SEARCH_H*/
@@ -7,337 +7,689 @@
 #include <cmath>
 #include <iostream>
 #include <numeric>
-#include <unordered_map>
 #include <string>
 #include <thread>
 #include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
 
 #include "Euclidean_dist.h"
+#include "probing.h"
+#include "thread_pool.h"
+#include "memory.h"
+#include "serialization.h"
+#include "query_stats.h"
 
 /**
  * We want an h from a family of hash functions H. We implement:
  * https://en.wikipedia.org/wiki/Locality-sensitive_hashing#Stable_distributions
  */
 
+/** \brief Integer mix (the finalizer of splitmix64).
+ *
+ * @param x - value to be mixed
+ * @return  - mixed value
+ */
+inline uint64_t mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// vertex of a query on the sub-cubes of split vertices, when it has none; see 'split_vertex()'
+const vertex_t NO_SUB_VERTEX = ~(vertex_t)0;
+
+/** \brief Position of a vertex in the Gray code order of the Hypercube
+ * (the inverse of the Gray code). Consecutive positions differ in one bit.
+ *
+ * @param vertex - vertex id
+ * @return       - its position in Gray code order
+ */
+inline vertex_t gray_rank(vertex_t vertex)
+{
+  vertex ^= vertex >> 16;
+  vertex ^= vertex >> 8;
+  vertex ^= vertex >> 4;
+  vertex ^= vertex >> 2;
+  vertex ^= vertex >> 1;
+  return vertex;
+}
+
+/** \brief Pack a mapped point (K bits, one per element) into a vertex id.
+ *
+ * @param mapped_begin - iterator at the first bit of the mapped point
+ * @param K            - dimension of the Hypercube
+ * @return             - the vertex id
+ */
+template <typename bit_iterator>
+vertex_t pack_vertex(bit_iterator mapped_begin, const int K)
+{
+  vertex_t vertex = 0;
+  for(int k = 0; k < K; ++k)
+    vertex |= (vertex_t)(*(mapped_begin + k) != 0) << k;
+  return vertex;
+}
+
 template <class T>
 class StableHashFunction
 {
     // of original pointset
     int dimension; 
-    float r;
-    float b;
-    std::vector<T> a;
-    std::uniform_int_distribution<int> uni_distribution;
     std::uniform_int_distribution<int> uni_bit_distribution;
     std::default_random_engine generator;
-    // key and a vector of the indices of the associated points
-    std::unordered_map<int, std::vector<int> > hashtable;
-    // for every key remember its random bit
-    std::unordered_map<int, char> hashtable_for_random_bit;
-    // Hamming cube vertex and vertices of assigned points.
+    // every key seen during construction, sorted, and its random bit
+    Buffer<int> bit_keys;
+    Buffer<char> key_bits;
+    // If set, the bit of a key is mix64(bit_seed ^ key) and 'bit_keys' stays empty.
+    // Keys unseen during construction get their bit this way in either mode.
+    bool hashed_bits;
+    uint64_t bit_seed;
+    // If set, keys are the signs of the projections, 0 or 1, and are their own bits, see SIGN_PROJECTION.
+    bool sign_bits;
+    // Hamming cube in CSR form, with the vertices in Gray code order, so that neighboring
+    // vertices are stored close to each other. The points assigned to vertex 'v', with
+    // g = gray_rank(v), are cube_points[cube_offsets[g]] ... cube_points[cube_offsets[g + 1] - 1].
+    // This is used *only* by the last hash.
+    Buffer<int> cube_offsets;
+    Buffer<int> cube_points;
+    // Points inserted after construction, by Gray code position of their vertex, until 'compact()'.
+    // This is used *only* by the last hash.
+    std::unordered_map<vertex_t, std::vector<int>> inserted_points;
+    // All the 2^K masks of K bits, by increasing number of set bits. Probing the vertex
+    // 'query ^ probe_masks[i]' for i = 0, 1, ... visits the vertices by Hamming distance.
     // This is used *only* by the last hash.
-    std::unordered_map< std::string, std::vector<int> > hashtable_cube;
+    std::vector<vertex_t> probe_masks;
+    // Sub-cubes of the vertices with more than 'split_threshold' points, see 'split_vertex()'. The
+    // points of the i-th split vertex, whose Gray code position is split_positions[i], are sorted by
+    // their vertex on its sub-cube of 'split_bits' bits; those of sub-vertex s start at
+    // cube_offsets[g] + split_offsets[i * (2^split_bits + 1) + s]. This is used *only* by the last hash.
+    std::vector<vertex_t> split_positions;
+    std::vector<int> split_offsets;
+    int split_bits;
+    int split_threshold;
+    // most points of a split vertex checked when it is probed, 0 for all
+    int split_points_per_probe;
+    // masks of the 2^split_bits sub-vertices by increasing number of set bits
+    std::vector<vertex_t> split_masks;
   public:
-  	/** \brief Constructor that creates a 
-  	 * vector from a stable distribution.
- 	 *
-	 * Assign 'D' random values from a normal distribution
-	 * N(0,1/sqrt(D)).
+  	/** \brief Constructor of a hash function. Its projection vector 'a' and
+     * offset 'b' live in the ProjectionMatrix of the Hypercube, which computes
+     * the keys; this object maps keys to bits.
 	 *
 	 * @param D  		 - dimension of points
-	 * @param r  		 - parameter of Stable Distribution
-	 * @param mean  	 - optional parameter of Normal Distribution. Default is 0.0.
-	 * @param deviation  - optional parameter of Normal Distribution. Default is 1.0.
 	 */
-  	StableHashFunction(const int D, const float r, const float mean = 0.0, const float deviation = 1.0)
-  		: dimension(D), r(r), uni_distribution(0, r), uni_bit_distribution(0, 1),
-  		generator(std::chrono::system_clock::now().time_since_epoch().count())
+  	StableHashFunction(const int D)
+  		: dimension(D), uni_bit_distribution(0, 1),
+  		generator(std::chrono::system_clock::now().time_since_epoch().count()), hashed_bits(false), sign_bits(false), split_bits(0), split_threshold(0), split_points_per_probe(0)
   	{  		
-  		std::normal_distribution<typename std::conditional<std::is_same<T, int>::value, float, T>::type> distribution(mean, deviation);
-      for(int i = 0; i < D; ++i)
-      {
-  			a.push_back(distribution(generator));
-      }
-
-  		b = distribution(generator);
+      bit_seed = mix64(generator());
   	}
 
-    /** \brief Constructor that creates a 
-     * vector from a stable distribution,
-     * in a distributed environment.
-     *
-     * Assign 'D' random values from a normal distribution
-     * N(0,1/sqrt(D)).
+    /** \brief Constructor of a hash function, in a distributed environment.
      *
      * @param D            - dimension of points
-     * @param r            - parameter of Stable Distribution
      * @param thread_info  - Something that identifies the thread, so that every thread
      *                       creates its own random numbers, and not the same - as is the
      *                       case with just seeding the random generator with the time.
-     * @param mean         - optional parameter of Normal Distribution. Default is 0.0.
-     * @param deviation    - optional parameter of Normal Distribution. Default is 1.0.
     */
-    StableHashFunction(const int D, const float r, const int thread_info, const float mean = 0.0, const float deviation = 1.0)
-      : dimension(D), r(r), uni_distribution(0, r), uni_bit_distribution(0, 1),
-      generator(thread_info + std::chrono::system_clock::now().time_since_epoch().count())
+    StableHashFunction(const int D, const int thread_info)
+      : dimension(D), uni_bit_distribution(0, 1),
+      generator(thread_info + std::chrono::system_clock::now().time_since_epoch().count()), hashed_bits(false), sign_bits(false), split_bits(0), split_threshold(0), split_points_per_probe(0)
     {     
-      std::normal_distribution<typename std::conditional<std::is_same<T, int>::value, float, T>::type> distribution(mean, deviation);
-      for(int i = 0; i < D; ++i)
-      {
-        a.push_back(distribution(generator));
-      }
+      bit_seed = mix64(generator() ^ thread_info);
+    }
 
-      b = distribution(generator);
+    /** \brief Derive the bit of every key from the key itself, instead of drawing
+     * and storing it. Must be called before any bit is assigned.
+     *
+     * @param function_id - index of this hash function in the Hypercube
+     * @param seed        - seed shared by all the hash functions of the Hypercube
+    */
+    void use_hashed_bits(const int function_id, const uint64_t seed)
+    {
+      hashed_bits = true;
+      bit_seed = mix64(seed + mix64(function_id));
+      bit_keys = Buffer<int>();
+      key_bits = Buffer<char>();
     }
 
-  	/** \brief Hash a pointset.
-	 *
-	 * @param v  	- vector of points
-	 * @param N   - number of points
-	 * @param D   - dimension of points
-	 */
-  	void hash(const std::vector<T>& v, const int N, const int D)
-  	{
-  		for(int i = 0; i < N; ++i)
-  		{
-  			hashtable[hash(std::begin(v) + i * D)].push_back(i);
-  		}
-  	}
+    /** \brief Use the keys as bits, for keys that are signs of projections. Must be called
+     * before any bit is assigned.
+    */
+    void use_sign_bits()
+    {
+      sign_bits = true;
+      bit_keys = Buffer<int>();
+      key_bits = Buffer<char>();
+    }
 
-  	/** \brief Hash a point.
-	 *
-	 * @param v_begin  - iterator at the start of the point to be hashed
-	 * @return 		     - result of hash function
-	 */
-  	template <typename iterator>
-  	int hash(iterator v_begin)
-  	{
-  		const T scalar_product = std::inner_product(std::begin(a), std::end(a), v_begin, 0.0);
-  		//std::cout << scalar_product << " " << b << " " << r << std::endl;
-  		//std::cout << (scalar_product + b) << " " << (scalar_product + b) / r << " " << (scalar_product + b) / (float)r << std::endl;
-  		return floor((scalar_product + b) / r);
-  	}
+    /** \brief Assign a random bit to every key. Nothing to do if 'use_hashed_bits()' or 'use_sign_bits()' was called.
+     *
+     * @param keys  - the distinct keys of the points for this hash function, sorted
+    */
+    void assign_random_bits(const std::vector<int>& keys)
+    {
+      if(hashed_bits || sign_bits)
+        return;
+      bit_keys.vector() = keys;
+      std::vector<char>& bits = key_bits.vector();
+      bits.resize(keys.size());
+      for(auto& bit: bits)
+        bit = uni_bit_distribution(generator);
+    }
 
-   	/** \brief Assing random bit for every key.
- 	 *
- 	 * @param v 	- vector of (to be) mapped points
- 	 * @param k		- iteration (assign the k-th bit of the points)
- 	 * @param K   - dimension of the cube that awaits for
- 	 *				  the points to be mapped on its vertices
-	 */
-    template<typename bitT>
-  	void assign_random_bit(std::vector<bitT>& v, const int k, const int K)
-  	{
-  		bitT random_bit;
-  		for(auto& key_value: hashtable)
-  		{
-  			random_bit = uni_bit_distribution(generator);
-        hashtable_for_random_bit[key_value.first] = random_bit;
-  			for(auto const& point_idx: key_value.second)
-  			{
-  				v[k + point_idx * K] = random_bit;
-  			}
-  		}
-  	} 
-
-    /** \brief Assing random bit for every key and fill cube's hashtable.
+    /** \brief Fill cube's hashtable, with a parallel counting sort of the points by vertex.
+     * Every thread counts the vertices of a contiguous range of points, and then writes
+     * its points after those of the previous ranges, so the result does not depend on
+     * the number of threads.
      *
-     * @param v   - vector of (to be) mapped points
-     * @param K   - dimension of the cube that awaits for
-     *          the points to be mapped on its vertices
+     * @param vertices  - vertex of every point. Replaced by its position in Gray code order.
+     * @param K         - dimension of the cube
+     * @param pool        - threads that sort the points
+     * @param threads_no  - most threads of 'pool' that sort them, see 'ThreadPool::size()'. Default value is 0, i.e. all.
     */
-    template<typename bitT>
-    void assign_random_bit_and_fill_hashtable_cube(std::vector<bitT>& v, const int K)
+    void fill_hashtable_cube(std::vector<vertex_t>& vertices, const int K, ThreadPool& pool, const int threads_no = 0)
     {
-      bitT random_bit;
-      for(auto& key_value: hashtable)
+      const int N = vertices.size();
+      const size_t vertices_no = (size_t)1 << K;
+      // one histogram per range, as long as they take no more than 2^24 counters
+      const int ranges_no = std::max(1, std::min(pool.size(threads_no), (int)std::max((size_t)1, ((size_t)1 << 24) / vertices_no)));
+      const int range = std::max(1, (N + ranges_no - 1) / ranges_no);
+      std::vector<int> counts(ranges_no * vertices_no, 0);
+      pool.parallel_for(0, N, range, [&](const int start, const int end)
       {
-        random_bit = uni_bit_distribution(generator);
-        hashtable_for_random_bit[key_value.first] = random_bit;
-        for(auto const& point_idx: key_value.second)
+        int* range_counts = &counts[(size_t)(start / range) * vertices_no];
+        for(int i = start; i < end; ++i)
         {
-          v[(K - 1) + point_idx * K] = random_bit;
-          //std::cout << (int)(std::string(v.begin() + point_idx * K, v.begin() + (point_idx + 1) * K))[2] << std::endl;
-          hashtable_cube[std::string(v.begin() + point_idx * K, v.begin() + (point_idx + 1) * K)].push_back(point_idx);
+          vertices[i] = gray_rank(vertices[i]);
+          ++range_counts[vertices[i]];
+        }
+      }, threads_no);
+
+      // where every range writes the points of every vertex
+      std::vector<int>& offsets = cube_offsets.vector();
+      offsets.resize(vertices_no + 1);
+      int offset = 0;
+      for(size_t g = 0; g < vertices_no; ++g)
+      {
+        offsets[g] = offset;
+        for(int r = 0; r < ranges_no; ++r)
+        {
+          const int count = counts[r * vertices_no + g];
+          counts[r * vertices_no + g] = offset;
+          offset += count;
         }
       }
-    }	
+      offsets[vertices_no] = offset;
+
+      std::vector<int>& points = cube_points.vector();
+      points.resize(N);
+      pool.parallel_for(0, N, range, [&](const int start, const int end)
+      {
+        int* next = &counts[(size_t)(start / range) * vertices_no];
+        for(int i = start; i < end; ++i)
+          points[next[vertices[i]]++] = i;
+      }, threads_no);
+
+      probe_masks = probe_masks_by_popcount(K);
+    }
 
-    /** \brief Assing random bit for queries.
+    /** \brief Bit of a key, derived from the key and the seed of this function.
+     *
+     * @param key - key of the hash function
+     * @return    - the bit of the key
+    */
+    char hashed_bit(const int key) const
+    {
+      return mix64(bit_seed ^ (uint32_t)key) & 1;
+    }
+
+    /** \brief Assing random bit for queries. Does not modify the hash function,
+     * so it is safe to be called concurrently.
    *
-   * @param q_begin   			- query
+   * @param q_key   			  - key of the query for this hash function
    * @param mapped_q_begin   	- (to be) mapped query
    * @param k   				- iteration (assign the k-th bit of the query)
    */
-    template <typename iterator, typename bit_iterator>
-    void assign_random_bit_query(iterator q_begin, bit_iterator mapped_q_begin, const int k)
+    template <typename bit_iterator>
+    void assign_random_bit_query(const int q_key, bit_iterator mapped_q_begin, const int k) const
+    {
+      *(mapped_q_begin + k) = query_bit(q_key);
+    }
+
+    /** \brief Bit of a query's key. Keys not seen during construction
+     * get a bit derived from the key. Safe to be called concurrently.
+     *
+     * @param q_key - key of the query for this hash function
+     * @return      - the bit of the key
+    */
+    char query_bit(const int q_key) const
     {
-      int q_key = hash(q_begin);
-      const auto& q_key_it = hashtable_for_random_bit.find(q_key);
-    	if(q_key_it != hashtable_for_random_bit.end())
+      if(sign_bits)
+        return q_key != 0;
+      if(hashed_bits)
+        return hashed_bit(q_key);
+      // binary search without branches, as the keys of the points are looked up in no particular order
+      size_t n = bit_keys.size();
+      if(n == 0)
+        return hashed_bit(q_key);
+      const int* key = bit_keys.begin();
+      while(n > 1)
       {
-      	*(mapped_q_begin + k) = q_key_it->second;
-    	}
-    	else
-    	{
-       	*(mapped_q_begin + k) = uni_bit_distribution(generator);
-    	}
-    }   
-
-    /** \brief Radius query the Hamming cube.
+        const size_t half = n / 2;
+        key = (key[half] <= q_key) ? key + half : key;
+        n -= half;
+      }
+      return (*key == q_key) ? key_bits[key - bit_keys.begin()] : hashed_bit(q_key);
+    }
+
+    /** \brief Masks of the vertices by increasing Hamming distance, for HammingProber.
+     *
+     * @return - the masks
+    */
+    const std::vector<vertex_t>& get_probe_masks() const
+    {
+      return probe_masks;
+    }
+
+    /** \brief Points assigned to a vertex of the Hamming cube.
       *
-      * @param mapped_query        - mapped query
-      * @param radius              - find a point within r with query
-      * @param K                   - dimension of the mapped query
-      * @param MAX_PNTS_TO_SEARCH  - threshold
-      * @param pointset            - original points
-      * @param query_point         - original query
-      * @return                    - index of a point, where Eucl(point[i], query_point) <= r
+      * @param vertex  - vertex id
+      * @param size    - number of points of the vertex
+      * @return        - pointer to their indices
     */
-    template <typename iterator>
-    int radius_query(std::string mapped_query, const int radius, const int K, const int MAX_PNTS_TO_SEARCH, iterator pointset, iterator query_point)
+    const int* vertex_points(const vertex_t vertex, int& size) const
     {
-      int points_checked = 0;
-      int answer_point_idx = -1;
-      int squared_radius = radius * radius;
-      const auto& q_key_it = hashtable_cube.find(mapped_query);
-      // search query's cube vertex, if pointsets' points exist there
-      if(q_key_it != hashtable_cube.end())
+      const vertex_t g = gray_rank(vertex);
+      size = cube_offsets[g + 1] - cube_offsets[g];
+      return cube_points.data() + cube_offsets[g];
+    }
+
+    /** \brief Points inserted to a vertex of the Hamming cube after construction.
+      *
+      * @param vertex  - vertex id
+      * @param size    - number of inserted points of the vertex
+      * @return        - pointer to their indices
+    */
+    const int* inserted_vertex_points(const vertex_t vertex, int& size) const
+    {
+      size = 0;
+      if(inserted_points.empty())
+        return NULL;
+      const auto inserted = inserted_points.find(gray_rank(vertex));
+      if(inserted == inserted_points.end())
+        return NULL;
+      size = inserted->second.size();
+      return inserted->second.data();
+    }
+
+    /** \brief Assign a point to a vertex of the Hamming cube, after construction.
+      *
+      * @param vertex     - vertex id
+      * @param point_idx  - index of the point
+    */
+    void insert_point(const vertex_t vertex, const int point_idx)
+    {
+      inserted_points[gray_rank(vertex)].push_back(point_idx);
+    }
+
+    /** \brief Number of points of the Hamming cube, not counting the inserted ones.
+      *
+      * @return - the number of points
+    */
+    int cube_size() const
+    {
+      return cube_points.size();
+    }
+
+    /** \brief True if points were inserted since construction or the last 'compact()'.
+    */
+    bool has_inserted_points() const
+    {
+      return !inserted_points.empty();
+    }
+
+    /** \brief Merge the inserted points into the Hamming cube, drop points, and renumber the rest.
+      * Takes time linear in the number of points and vertices.
+      *
+      * @param new_index  - new index of every point, -1 to drop it
+    */
+    void compact(const std::vector<int>& new_index)
+    {
+      const vertex_t vertices_no = cube_offsets.size() - 1;
+      std::vector<int> offsets(vertices_no + 1);
+      std::vector<int> points;
+      points.reserve(cube_points.size());
+      for(vertex_t g = 0; g < vertices_no; ++g)
+      {
+        offsets[g] = points.size();
+        for(int i = cube_offsets[g]; i < cube_offsets[g + 1]; ++i)
+          if(new_index[cube_points[i]] != -1)
+            points.push_back(new_index[cube_points[i]]);
+        const auto inserted = inserted_points.find(g);
+        if(inserted != inserted_points.end())
+          for(const int point_idx: inserted->second)
+            if(new_index[point_idx] != -1)
+              points.push_back(new_index[point_idx]);
+      }
+      offsets[vertices_no] = points.size();
+      cube_offsets.assign(std::move(offsets));
+      cube_points.assign(std::move(points));
+      inserted_points.clear();
+      reset_splits(0, 0, 0);
+    }
+
+    /** \brief Drop the sub-cubes of the split vertices, and set those of the next 'split_vertex()' calls.
+      *
+      * @param bits              - dimension of the sub-cubes, 0 for none
+      * @param threshold         - split vertices have more points than this
+      * @param points_per_probe  - most points of a split vertex checked when it is probed, 0 for all
+    */
+    void reset_splits(const int bits, const int threshold, const int points_per_probe)
+    {
+      split_positions.clear();
+      split_offsets.clear();
+      split_bits = bits;
+      split_threshold = threshold;
+      split_points_per_probe = points_per_probe;
+      split_masks = bits ? probe_masks_by_popcount(bits) : std::vector<vertex_t>();
+    }
+
+    /** \brief Give a vertex of the Hamming cube a sub-cube: sort its points by their vertex on the sub-cube,
+      * with a counting sort. Probing the vertex then checks its points sub-vertex by sub-vertex, by Hamming
+      * distance from the sub-vertex of the query, and at most 'split_points_per_probe' of them (see 'reset_splits()').
+      *
+      * @param vertex        - vertex id, of more than 'split_threshold' points
+      * @param sub_vertices  - vertex on the sub-cube of every point of the vertex, in the order of 'vertex_points()'
+    */
+    void split_vertex(const vertex_t vertex, const std::vector<vertex_t>& sub_vertices)
+    {
+      const vertex_t g = gray_rank(vertex);
+      const size_t sub_vertices_no = (size_t)1 << split_bits;
+      std::vector<int> offsets(sub_vertices_no + 1, 0);
+      for(const vertex_t sub_vertex: sub_vertices)
+        ++offsets[sub_vertex + 1];
+      std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+      int* points = cube_points.vector().data() + cube_offsets[g];
+      std::vector<int> sorted(sub_vertices.size());
+      std::vector<int> next(offsets.begin(), offsets.end() - 1);
+      for(size_t i = 0; i < sub_vertices.size(); ++i)
+        sorted[next[sub_vertices[i]]++] = points[i];
+      std::copy(sorted.begin(), sorted.end(), points);
+
+      const size_t at = std::lower_bound(split_positions.begin(), split_positions.end(), g) - split_positions.begin();
+      split_positions.insert(split_positions.begin() + at, g);
+      split_offsets.insert(split_offsets.begin() + at * (sub_vertices_no + 1), offsets.begin(), offsets.end());
+    }
+
+    /** \brief Number of vertices with a sub-cube, see 'split_vertex()'.
+    */
+    int split_vertices_no() const
+    {
+      return split_positions.size();
+    }
+
+    /** \brief Dimension of the sub-cubes, 0 if there are none, see 'reset_splits()'.
+    */
+    int get_split_bits() const
+    {
+      return split_bits;
+    }
+
+    /** \brief Replace the indices of the points of the Hamming cube with
+      * their positions, in vertex order, i.e. with 0 ... N - 1.
+      * Used when the pointset is copied in the order of the Hamming cube.
+      *
+      * @return - the previous indices, i.e. the index of the point at every position
+    */
+    std::vector<int> relayout()
+    {
+      std::vector<int> permutation(cube_points.begin(), cube_points.end());
+      std::vector<int>& points = cube_points.vector();
+      std::iota(points.begin(), points.end(), 0);
+      return permutation;
+    }
+
+    /** \brief Write the bits of the keys and, for the last hash, the Hamming cube and its sub-cubes.
+      *
+      * @param out  - the file
+    */
+    void save(Serialization::Writer& out) const
+    {
+      out.value((char)(hashed_bits | sign_bits << 1));
+      out.value(bit_seed);
+      out.array(bit_keys.data(), bit_keys.size());
+      out.array(key_bits.data(), key_bits.size());
+      out.array(cube_offsets.data(), cube_offsets.size());
+      out.array(cube_points.data(), cube_points.size());
+      out.value(split_bits);
+      out.value(split_threshold);
+      out.value(split_points_per_probe);
+      out.array(split_positions.data(), split_positions.size());
+      out.array(split_offsets.data(), split_offsets.size());
+    }
+
+    /** \brief Read a hash function written by 'save()'. Its arrays are used in place.
+      *
+      * @param in  - the file, which must outlive the hash function
+      * @param K   - dimension of the Hypercube
+      * @param N   - number of points; a cube may hold fewer, if points were erased
+      * @return    - false if the file is not valid
+    */
+    bool load(Serialization::Reader& in, const int K, const int N)
+    {
+      char hashed;
+      const int* keys;
+      const char* bits;
+      const int* offsets;
+      const int* points;
+      const vertex_t* positions;
+      const int* sub_offsets;
+      uint64_t keys_size, bits_size, offsets_size, points_size, positions_size, sub_offsets_size;
+      int bits_no, threshold, points_per_probe;
+      if(!in.value(hashed) || !in.value(bit_seed) || !in.array(keys, keys_size) || !in.array(bits, bits_size) ||
+        !in.array(offsets, offsets_size) || !in.array(points, points_size) || !in.value(bits_no) || !in.value(threshold) ||
+        !in.value(points_per_probe) || !in.array(positions, positions_size) || !in.array(sub_offsets, sub_offsets_size))
+        return false;
+      // a cube, if any, must hold the N points, and its offsets must be in range, as queries trust them
+      bool valid = keys_size == bits_size;
+      if(offsets_size)
       {
-        //print_string_cast_int(q_key_it->first); std::cout << " " << q_key_it->second.size() << std::endl;
-        answer_point_idx = Euclidean_distance_within_radius<iterator>(pointset, q_key_it->second, dimension, query_point, squared_radius, MAX_PNTS_TO_SEARCH);
-        //if(answer_point_idx!=-1) std::cout << squared_Eucl_distance(query_point, query_point + dimension, pointset + answer_point_idx * dimension) << std::endl;
-        points_checked += q_key_it->second.size();
+        valid = valid && offsets_size == ((uint64_t)1 << K) + 1 && points_size <= (uint64_t)N && offsets[0] == 0 && offsets[offsets_size - 1] == (int)points_size;
+        for(uint64_t g = 0; valid && g + 1 < offsets_size; ++g)
+          valid = offsets[g] <= offsets[g + 1];
+        for(uint64_t i = 0; valid && i < points_size; ++i)
+          valid = points[i] >= 0 && points[i] < N;
       }
-      // check neighboring vertices from query's cube vertex
-      int Hamming_dist = 1;
-      while (points_checked < MAX_PNTS_TO_SEARCH && answer_point_idx == -1)
+      // so must the sub-cubes: every split vertex, in increasing order, has the sorted offsets of its points
+      valid = valid && bits_no >= 0 && bits_no <= 16 && threshold >= 0 && points_per_probe >= 0 && (bits_no || !positions_size) &&
+        (!positions_size || offsets_size) && sub_offsets_size == positions_size * (((uint64_t)1 << bits_no) + 1);
+      for(uint64_t i = 0; valid && i < positions_size; ++i)
       {
-        find_strings_with_fixed_Hamming_dist_for_radius_query<iterator>(mapped_query, K - 1, Hamming_dist++, points_checked, MAX_PNTS_TO_SEARCH, squared_radius, pointset, query_point, answer_point_idx);
+        const uint64_t g = positions[i];
+        const int* sub = sub_offsets + i * (((uint64_t)1 << bits_no) + 1);
+        valid = g + 1 < offsets_size && (i == 0 || positions[i - 1] < g) && sub[0] == 0 && sub[(uint64_t)1 << bits_no] == offsets[g + 1] - offsets[g];
+        for(uint64_t s = 0; valid && s < ((uint64_t)1 << bits_no); ++s)
+          valid = sub[s] <= sub[s + 1];
       }
-      //std::cout << "ANSWER = " << answer_point_idx << ", checked points = " << points_checked << std::endl;
-      return answer_point_idx;
+      if(!valid)
+      {
+        in.fail();
+        return false;
+      }
+      hashed_bits = hashed & 1;
+      sign_bits = hashed & 2;
+      bit_keys.view(keys, keys_size);
+      key_bits.view(bits, bits_size);
+      cube_offsets.view(offsets, offsets_size);
+      cube_points.view(points, points_size);
+      if(offsets_size)
+        probe_masks = probe_masks_by_popcount(K);
+      reset_splits(bits_no, threshold, points_per_probe);
+      split_positions.assign(positions, positions + positions_size);
+      split_offsets.assign(sub_offsets, sub_offsets + sub_offsets_size);
+      return true;
     }
 
-    /** \brief Find strings within a given Hamming distance. Used by 'radius_query()'.
+    /** \brief Hand the points of a probed vertex to 'check': those of the cube, then the inserted ones.
+      * The points of a split vertex go sub-vertex by sub-vertex, by Hamming distance from the sub-vertex
+      * of the query, and at most 'split_points_per_probe' of them, see 'split_vertex()'.
       *
-      * @param str                 - given string
-      * @param i                   - index
-      * @param changesLeft         - changes left to make
-      * @param points_checked      - current points checked
-      * @param MAX_PNTS_TO_SEARCH  - threshold
-      * @param squared_radius      - check if any original point lies in r Euclidean distance from the original query
-      * @param answer_point_idx    - index of point that has distance less or equal than r with the query
+      * @param vertex     - the probed vertex
+      * @param sub_query  - vertex of the query on the sub-cubes, or NO_SUB_VERTEX to check split vertices whole
+      * @param budget     - most points to hand out, more than 0
+      * @param check      - called with (points, size, most points to check), returns true to stop
+      * @return           - number of points handed out
     */
-    template <typename iterator>
-    bool find_strings_with_fixed_Hamming_dist_for_radius_query(std::string& str, const int i, const int changesLeft, 
-      int& points_checked, const int MAX_PNTS_TO_SEARCH, const int squared_radius, iterator& pointset, 
-      iterator& query_point, int& answer_point_idx)
+    template <typename Check>
+    int check_vertex(const vertex_t vertex, const vertex_t sub_query, const int budget, const Check& check) const
     {
-      bool stop = false;
-      if (changesLeft == 0) {
-        //print_string_cast_int(str); std::cout << std::endl;
-        const auto& key_value_it = hashtable_cube.find(str);
-        //std::cout << "start checking\n";
-        if(key_value_it != hashtable_cube.end())
+      const vertex_t g = gray_rank(vertex);
+      const int* points_idxs = cube_points.data() + cube_offsets[g];
+      const int size = cube_offsets[g + 1] - cube_offsets[g];
+      int checked = 0;
+      if(size > split_threshold && sub_query != NO_SUB_VERTEX && !split_positions.empty())
+      {
+        const auto split = std::lower_bound(split_positions.begin(), split_positions.end(), g);
+        if(split != split_positions.end() && *split == g)
         {
-          //std::cout << " " << key_value_it->second.size() << std::endl;
-          answer_point_idx = Euclidean_distance_within_radius<iterator>(pointset, key_value_it->second, dimension, query_point, squared_radius, MAX_PNTS_TO_SEARCH);
-          //if(answer_point_idx!=-1) std::cout << squared_Eucl_distance(query_point, query_point + dimension, pointset + answer_point_idx * dimension) << std::endl;
-          points_checked += key_value_it->second.size();
-          //std::cout << "check: " << points_checked << " " << MAX_PNTS_TO_SEARCH << std::endl;
-          stop = (answer_point_idx != -1 || points_checked > MAX_PNTS_TO_SEARCH);
-          //std::cout << "stop = " << stop << std::endl;
+          const int* offsets = &split_offsets[(split - split_positions.begin()) * (split_masks.size() + 1)];
+          const int limit = split_points_per_probe ? std::min(budget, split_points_per_probe) : budget;
+          for(size_t i = 0; i < split_masks.size() && checked < limit; ++i)
+          {
+            const vertex_t sub_vertex = sub_query ^ split_masks[i];
+            const int sub_size = offsets[sub_vertex + 1] - offsets[sub_vertex];
+            if(!sub_size)
+              continue;
+            const bool stop = check(points_idxs + offsets[sub_vertex], sub_size, limit - checked);
+            checked += std::min(sub_size, limit - checked);
+            if(stop)
+              return checked;
+          }
+          points_idxs = NULL;
         }
-        return stop;
       }
-      if (i < 0)
-        return 0;
-      // flip current bit
-      if(!stop)
+      if(points_idxs && size)
       {
-        str[i] ^= 1;
-        stop = find_strings_with_fixed_Hamming_dist_for_radius_query(str, i-1, changesLeft-1, points_checked, MAX_PNTS_TO_SEARCH, squared_radius, pointset, query_point, answer_point_idx);
+        const bool stop = check(points_idxs, size, budget);
+        checked = std::min(size, budget);
+        if(stop)
+          return checked;
       }
-      // or don't flip it (flip it again to undo)
-      if(!stop)
+      int inserted_size;
+      const int* inserted_idxs = inserted_vertex_points(vertex, inserted_size);
+      if(inserted_size && checked < budget)
       {
-        str[i] ^= 1;
-        stop = find_strings_with_fixed_Hamming_dist_for_radius_query(str, i-1, changesLeft, points_checked, MAX_PNTS_TO_SEARCH, squared_radius, pointset, query_point, answer_point_idx);
+        check(inserted_idxs, inserted_size, budget - checked);
+        checked += std::min(inserted_size, budget - checked);
       }
-      return stop;
+      return checked;
     }
 
-    /** \brief Nearest Neighbor query the Hamming cube.
+    /** \brief Radius query the Hamming cube. Vertices are probed in the order of the prober,
+      * until a point within the radius is found, all vertices are probed, or
+      * MAX_PNTS_TO_SEARCH points are checked.
       *
-      * @param mapped_query        - mapped query
-      * @param K                   - dimension of the mapped query
+      * @param mapped_query        - vertex of the mapped query
+      * @param sub_query           - vertex of the query on the sub-cubes of split vertices, or NO_SUB_VERTEX
+      * @param prober              - hands out the masks of the vertices to probe (see probing.h)
       * @param MAX_PNTS_TO_SEARCH  - threshold
-      * @param pointset            - original points
-      * @param query_point         - original query
-      * @return                    - index and distance from query of (approximate) Nearest Neighbor
+      * @param checker             - checks the candidate points against the query and the radius
+      *                              (see ExactCandidateChecker in Euclidean_dist.h)
+      * @param recorder            - records the walk (see QueryRecorder in query_stats.h)
+      * @return                    - index of a point, where Eucl(point[i], query_point) <= r
     */
-    template <typename iterator>
-    std::pair<int, float> nearest_neighbor_query(std::string mapped_query, const int K, const int MAX_PNTS_TO_SEARCH, iterator pointset, iterator query_point)
+    template <typename Prober, typename Checker, typename Recorder>
+    int radius_query(const vertex_t mapped_query, const vertex_t sub_query, Prober& prober, const int MAX_PNTS_TO_SEARCH, Checker& checker, Recorder& recorder) const
     {
       int points_checked = 0;
-      std::pair<int, float> answer_point_idx_dist(-1, 1000000.0);
-      const auto& q_key_it = hashtable_cube.find(mapped_query);
-      // search query's cube vertex, if pointsets' points exist there
-      if(q_key_it != hashtable_cube.end())
-      {
-        find_Nearest_Neighbor_index<iterator>(pointset, q_key_it->second, dimension, query_point, answer_point_idx_dist, MAX_PNTS_TO_SEARCH);
-        points_checked += q_key_it->second.size();
-      }
-      // check neighboring vertices from query's cube vertex
-      int Hamming_dist = 1;
-      while (points_checked < MAX_PNTS_TO_SEARCH)
+      int answer_point_idx = -1;
+      vertex_t mask;
+      while(points_checked < MAX_PNTS_TO_SEARCH && answer_point_idx == -1 && prober.next(mask))
       {
-        find_strings_with_fixed_Hamming_dist_for_nearest_neighbor_query<iterator>(mapped_query, K - 1, Hamming_dist++, points_checked, MAX_PNTS_TO_SEARCH, pointset, query_point, answer_point_idx_dist);
+        recorder.probe(mask);
+        const int checked = check_vertex(mapped_query ^ mask, sub_query, MAX_PNTS_TO_SEARCH - points_checked, [&](const int* points_idxs, const int size, const int budget)
+        {
+          recorder.start_check();
+          answer_point_idx = checker.within_radius(points_idxs, size, budget);
+          recorder.end_check();
+          return answer_point_idx != -1;
+        });
+        if(!checked)
+          recorder.empty_vertex();
+        points_checked += checked;
       }
-      return answer_point_idx_dist;
+      recorder.finish(points_checked, answer_point_idx != -1 ? STOPPED_BY_ANSWER : points_checked >= MAX_PNTS_TO_SEARCH ? STOPPED_BY_BUDGET : STOPPED_BY_EXHAUSTION);
+      return answer_point_idx;
+    }
+
+    template <typename Prober, typename Checker>
+    int radius_query(const vertex_t mapped_query, Prober& prober, const int MAX_PNTS_TO_SEARCH, Checker& checker) const
+    {
+      QueryRecorder none(NULL);
+      return radius_query(mapped_query, NO_SUB_VERTEX, prober, MAX_PNTS_TO_SEARCH, checker, none);
     }
 
-    /** \brief Find strings within a given Hamming distance. Used by 'nearest_neighbor_query()'.
+    /** \brief Nearest Neighbor query the Hamming cube. Vertices are probed in the order of
+      * the prober, until all vertices are probed, or MAX_PNTS_TO_SEARCH points are checked.
       *
-      * @param str                     - given string
-      * @param i                       - index
-      * @param changesLeft             - changes left to make
-      * @param points_checked          - current points checked
-      * @param MAX_PNTS_TO_SEARCH      - threshold
-      * @param answer_point_idx_dist   - index and distance of current best Nearest Neighbor
+      * @param mapped_query        - vertex of the mapped query
+      * @param prober              - hands out the masks of the vertices to probe (see probing.h)
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param checker             - checks the candidate points against the query and keeps the best
+      *                              (see ExactCandidateChecker in Euclidean_dist.h)
+      * @return                    - index and distance from query of (approximate) Nearest Neighbor
     */
-    template <typename iterator>
-    bool find_strings_with_fixed_Hamming_dist_for_nearest_neighbor_query(std::string& str, const int i, const int changesLeft, 
-      int& points_checked, const int MAX_PNTS_TO_SEARCH, iterator& pointset, 
-      iterator& query_point, std::pair<int, float>& answer_point_idx_dist)
+    template <typename Prober, typename Checker>
+    std::pair<int, float> nearest_neighbor_query(const vertex_t mapped_query, Prober& prober, const int MAX_PNTS_TO_SEARCH, Checker& checker) const
     {
-      bool stop = false;
-      if (changesLeft == 0) {
-        const auto& key_value_it = hashtable_cube.find(str);
-        if(key_value_it != hashtable_cube.end())
-        {
-          find_Nearest_Neighbor_index<iterator>(pointset, key_value_it->second, dimension, query_point, answer_point_idx_dist, MAX_PNTS_TO_SEARCH);
-          points_checked += key_value_it->second.size();
-          stop = (points_checked > MAX_PNTS_TO_SEARCH);
-        }
-        return stop;
-      }
-      if (i < 0)
-        return 0;
-      // flip current bit
-      if(!stop)
-      {
-        str[i] ^= 1;
-        stop = find_strings_with_fixed_Hamming_dist_for_nearest_neighbor_query(str, i-1, changesLeft-1, points_checked, MAX_PNTS_TO_SEARCH, pointset, query_point, answer_point_idx_dist);
-      }
-      // or don't flip it (flip it again to undo)
-      if(!stop)
+      nearest_neighbors_query(mapped_query, prober, MAX_PNTS_TO_SEARCH, checker);
+      return checker.nearest_neighbor_result();
+    }
+
+    /** \brief Hand the candidates of a (k) Nearest Neighbor query to the checker, which keeps the best.
+      * Vertices are probed in the order of the prober, until all vertices are probed, or
+      * MAX_PNTS_TO_SEARCH points are checked.
+      *
+      * @param mapped_query        - vertex of the mapped query
+      * @param sub_query           - vertex of the query on the sub-cubes of split vertices, or NO_SUB_VERTEX
+      * @param prober              - hands out the masks of the vertices to probe (see probing.h)
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param checker             - checks the candidate points against the query and keeps the best
+      *                              (see KNearestCandidateChecker in Euclidean_dist.h)
+      * @param recorder            - records the walk (see QueryRecorder in query_stats.h)
+    */
+    template <typename Prober, typename Checker, typename Recorder>
+    void nearest_neighbors_query(const vertex_t mapped_query, const vertex_t sub_query, Prober& prober, const int MAX_PNTS_TO_SEARCH, Checker& checker, Recorder& recorder) const
+    {
+      int points_checked = 0;
+      vertex_t mask;
+      while(points_checked < MAX_PNTS_TO_SEARCH && prober.next(mask))
       {
-        str[i] ^= 1;
-        stop = find_strings_with_fixed_Hamming_dist_for_nearest_neighbor_query(str, i-1, changesLeft, points_checked, MAX_PNTS_TO_SEARCH, pointset, query_point, answer_point_idx_dist);
+        recorder.probe(mask);
+        const int checked = check_vertex(mapped_query ^ mask, sub_query, MAX_PNTS_TO_SEARCH - points_checked, [&](const int* points_idxs, const int size, const int budget)
+        {
+          recorder.start_check();
+          checker.nearest_neighbor(points_idxs, size, budget);
+          recorder.end_check();
+          return false;
+        });
+        if(!checked)
+          recorder.empty_vertex();
+        points_checked += checked;
       }
-      return stop;
+      recorder.finish(points_checked, points_checked >= MAX_PNTS_TO_SEARCH ? STOPPED_BY_BUDGET : STOPPED_BY_EXHAUSTION);
+    }
+
+    template <typename Prober, typename Checker>
+    void nearest_neighbors_query(const vertex_t mapped_query, Prober& prober, const int MAX_PNTS_TO_SEARCH, Checker& checker) const
+    {
+      QueryRecorder none(NULL);
+      nearest_neighbors_query(mapped_query, NO_SUB_VERTEX, prober, MAX_PNTS_TO_SEARCH, checker, none);
     }
 
     /** \brief Check if vector is full of 'value'.
@@ -368,67 +720,49 @@ class StableHashFunction
       return value;
     }
 
-  	/** \brief Print 'hashtable'.
- 	 *
-	 */
-  	void print()
-  	{
-  		std::cout << "Hashtable for h, is:\n";
-  		for (auto& x: hashtable)
-  		{
-    		std::cout << x.first << ": ";
-    		for(auto& y: x.second)
-    		{
-      			std::cout << y << ", ";
-    		}
-    		std::cout << "\n";
-  		}
-  	}
-
-  	/** \brief Print number of keys and number of values per key.
- 	 *
-	 */
-  	void print_stats()
-  	{
-  		std::cout << "Hashtable is of size (|keys|) = " << hashtable.size() << "\n";
-  		for(auto& key_value: hashtable)
-  			std::cout << key_value.first << " has " << key_value.second.size() << " values/points\n";
-  		std::cout << "\n";
-  	}
+    /** \brief Print number of keys seen during construction, and how many of them have bit 1.
+     *
+    */
+    void print_stats() const
+    {
+      std::cout << "Keys with a stored bit = " << bit_keys.size() << ", of which with bit 1 = " << std::count(key_bits.begin(), key_bits.end(), 1) << "\n";
+    }
 
     /** \brief Print hashtable of Hamming cube. 
-    * @param print_indices - Print all the values of the unordered_map. Default false.
+    * @param print_indices - Print all the values of the hashtable. Default false.
     *
    */
-    void print_hashtable_cube(const bool print_indices = false)
+    void print_hashtable_cube(const bool print_indices = false) const
     {
-      if(!hashtable_cube.size())
+      if(cube_offsets.empty())
       {
         std::cout << "Are you sure is this the last hash? The Hamming cube's hashtable is created ";
         std::cout << "only after the last, (K-1)-th, bit of the mapped point is set. Hashtable won't print\n";
         return;
       }
-      std::cout << "Hashtable is of size (|keys|) = " << hashtable_cube.size() << "\n";
-      for(auto& key_value: hashtable_cube)
+      const vertex_t vertices_no = cube_offsets.size() - 1;
+      int K = 0;
+      while(((vertex_t)1 << K) < vertices_no)
+        ++K;
+      int non_empty = 0;
+      for(vertex_t g = 0; g < vertices_no; ++g)
+        non_empty += (cube_offsets[g + 1] != cube_offsets[g]);
+      std::cout << "Hashtable is of size (|keys|) = " << non_empty << "\n";
+      for(vertex_t g = 0; g < vertices_no; ++g)
       {
-        print_string_cast_int(key_value.first); std::cout << " has " << key_value.second.size() << " values/points\n";
+        if(cube_offsets[g + 1] == cube_offsets[g])
+          continue;
+        // vertex at position 'g' of the Gray code order
+        const vertex_t v = g ^ (g >> 1);
+        for(int k = 0; k < K; ++k)
+          std::cout << ((v >> k) & 1);
+        std::cout << " has " << (cube_offsets[g + 1] - cube_offsets[g]) << " values/points\n";
         if(print_indices)
-          for(auto& point_idx: key_value.second)
-            std::cout << point_idx << " ";
+          for(int i = cube_offsets[g]; i < cube_offsets[g + 1]; ++i)
+            std::cout << cube_points[i] << " ";
       }
       std::cout << "\n";
     }
-
-  	/** \brief Print vector 'a'.
- 	 *
-	 */
-  	void print_a()
-  	{
-  		std::cout << "'a' vector of the stable distribution for h, is:\n";
-  		for(unsigned int i = 0; i < a.size(); ++i)
-  			std::cout << a[i] << " ";
-  		std::cout << "\n";
-  	}
 };
 
 #endif /*HASH_H*/
@@ -3,25 +3,115 @@
 
 #include <vector>
 #include "hash.h"
+#include "projection.h"
+#include "quantization.h"
+#include "thread_pool.h"
+#include "serialization.h"
+#include "pointset_view.h"
+#include "query_stats.h"
 
 #include <thread>
 #include <iterator>
 #include <utility>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include <numeric>
+#include <string>
 
 namespace Dolphinn
 {
-  template <typename T, typename bitT>
+  /**
+   * Parameters of a Hypercube and of its queries, e.g. those chosen by 'tune()' of tuner.h.
+   */
+  struct HypercubeConfig
+  {
+    // dimension of the Hypercube
+    int K;
+    // hashing window
+    float r;
+    // MAX_PNTS_TO_SEARCH of the queries
+    int budget;
+    // recall@k and milliseconds per query, as measured by the tuner; 0 if not measured
+    double recall;
+    double mean_ms;
+    double p99_ms;
+    // the configuration meets the target of the tuner
+    bool meets_target;
+
+    explicit HypercubeConfig(const int K = 0, const float r = 4, const int budget = 0)
+      : K(K), r(r), budget(budget), recall(0), mean_ms(0), p99_ms(0), meets_target(false)
+    {}
+  };
+
+  /**
+   * Approximate search on the Hamming cube. 'Metric' is the distance of the queries and the family of
+   * the hash functions, see metric.h; the squared Euclidean distance by default. Distances reported by
+   * the queries are those of the metric, e.g. squared for L2Metric. Radii are plain radii, e.g. not squared
+   * for L2Metric: the queries compare distances with 'Metric::radius_threshold()' of them. See FixedHypercube
+   * for points of a dimension known at compile time.
+   */
+  template <typename T, typename bitT, typename Metric = L2Metric>
   class Hypercube
   {
     // The 'K' hash-functions that we are going to use. Only the last one will be used to query,
     // but we need all of them to map the query on arrival, first.
     std::vector<StableHashFunction<T>> H;
+    // The projections of the 'K' hash-functions, packed in one matrix.
+    ProjectionMatrix projection;
     // original dimension of points
-    const int D;
+    int D;
     // mapped dimension of points (dimension of the Hypercube)
-    const int K;
-    // Reference of an 1D vector of points, emulating a 2D, with N rows and D columns per row.
-    const std::vector<T>& pointset;
+    int K;
+    // The N points, D coordinates each, which live elsewhere, e.g. in a vector or in a mapped file.
+    PointsetView<T> pointset;
+    // Optional copy of the pointset, made by 'relayout()' in the order of the vertices of the Hamming cube,
+    // or by the first 'insert()'.
+    std::vector<T> ordered_pointset;
+    // Original index (id) of every row of 'ordered_pointset'. Empty if there is no such copy.
+    Buffer<int> permutation;
+    // number of ids handed out: the points of the construction, then the inserted ones
+    int ids_no;
+    // Row of 'ordered_pointset' of every id, -1 if the point was erased and compacted.
+    // Built by the first 'erase()' after the copy was made or changed.
+    std::vector<int> row_of_id;
+    // Per row of 'points()', non zero if the point is erased. Empty if no point was erased.
+    std::vector<char> erased;
+    // number of points that are not erased
+    int live_no;
+    // number of rows erased since the last 'compact()', which queries skip
+    int erased_no;
+    // fraction of erased rows at which 'erase()' calls 'compact()', see 'set_compaction_threshold()'
+    float compaction_threshold;
+    // keep the rows of 'ordered_pointset' in vertex order, see 'relayout()'
+    bool laid_out;
+    // Optional compressed copy of the pointset, see 'quantize()'.
+    std::shared_ptr<QuantizedPointset<T>> quantized;
+    // number of candidates of a Nearest Neighbor query re-checked on 'pointset', when 'quantized' is set
+    int rerank;
+    // order in which queries probe the vertices, see 'set_probing()'
+    Probing probing;
+    // persistent threads of construction and queries, see 'executor()'
+    mutable std::shared_ptr<ThreadPool> pool;
+    mutable std::mutex pool_mutex;
+    // the file of a loaded Hypercube, whose arrays are used in place
+    std::shared_ptr<const MappedFile> mapping;
+    // extra hash functions of the sub-cubes of the vertices split by 'split()', applied only to their points
+    ProjectionMatrix split_projection;
+    std::vector<StableHashFunction<T>> split_H;
+    // vertices with more points get a sub-cube, 0 if none do
+    int split_threshold;
+    // most points of a split vertex that a probe checks, 0 for all
+    int split_points_per_probe;
+    // add the statistics of every query to 'histograms', see 'collect_statistics()'
+    bool collecting;
+    mutable QueryHistograms histograms;
+    mutable std::mutex statistics_mutex;
+    // identifies a saved Hypercube, "DOLPHINN" in little endian
+    static const uint64_t MAGIC = 0x4E4E49484C504F44ULL;
+    // version of the format of a saved Hypercube, see 'save()'
+    static const uint32_t VERSION = 4;
     public:
     /** \brief Constructor that creates in parallel a 
       * vector from a stable distribution.
@@ -33,163 +123,1048 @@ namespace Dolphinn
       * @param N           - number of points
       * @param D           - dimension of points
       * @param K           - dimension of Hypercube (and of the mapped points)
-      * @param threads_no  - number of threads to be created. Default value is 'std::thread::hardware_concurrency()'.
+      * @param threads_no  - number of threads that build the Hypercube. They are kept for the queries, see 'executor()'.
+      *                      Default value is 'std::thread::hardware_concurrency()'.
       * @param r           - parameter of Stable Distribution. Default value is 4. Should be modified for Nearest 
       *                      Neighbor Search, to adapt to the average distance of the NN, 'r' is the hashing window.
+      *                      Not used by the metrics of sign projections, whose keys are their own bits.
+      * @param hashed_bits - derive the bit of every key from (hash function, key, seed), instead of drawing and storing
+      *                      it. Saves the K key-to-bit hashtables and makes queries deterministic, and the points are
+      *                      hashed once instead of twice. Either way the construction hashes the points in chunks and
+      *                      never holds the N x K keys, so it needs about 8 bytes per point besides the Hypercube.
+      *                      Default value is false.
+      * @param seed        - seed of the bits, when 'hashed_bits' is set. Default value is 0.
    */
-    Hypercube(const std::vector<T>& pointset, const int N, const int D, const int K, const int threads_no = std::thread::hardware_concurrency(), const float r = 4/*3 or 8*/)
-      : D(D), K(K), pointset(pointset)
+    Hypercube(const std::vector<T>& pointset, const int N, const int D, const int K, const int threads_no = std::thread::hardware_concurrency(), const float r = 4/*3 or 8*/,
+      const bool hashed_bits = false, const uint64_t seed = 0)
+      : Hypercube(PointsetView<T>(pointset.data(), N, D), K, threads_no, r, hashed_bits, seed)
+    {}
+
+    /** \brief Constructor over points that live elsewhere, e.g. in a file mapped by 'map_fvecs()'.
+      * The points are not copied, so they must outlive the Hypercube.
+      *
+      * @param pointset    - the N points, D coordinates each
+      * @param K           - dimension of Hypercube (and of the mapped points)
+      * @param threads_no  - number of threads that build the Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+      * @param r           - parameter of Stable Distribution. Default value is 4.
+      * @param hashed_bits - derive the bit of every key from (hash function, key, seed). Default value is false.
+      * @param seed        - seed of the bits, when 'hashed_bits' is set. Default value is 0.
+      * @param threads     - optional threads of the construction and the queries, e.g. those of another Hypercube, see
+      *                      'set_thread_pool()'. Default value is none, i.e. 'threads_no' new threads.
+   */
+    Hypercube(const PointsetView<T>& pointset, const int K, const int threads_no = std::thread::hardware_concurrency(), const float r = 4,
+      const bool hashed_bits = false, const uint64_t seed = 0, const std::shared_ptr<ThreadPool>& threads = nullptr)
+      : projection(K, pointset.dimension(), r, 0.0, 1.0, Metric::FAMILY), D(pointset.dimension()), K(K), pointset(pointset), ids_no(pointset.size()), live_no(pointset.size()), erased_no(0),
+      compaction_threshold(0.2), laid_out(false), rerank(0), probing(HAMMING_PROBING), split_threshold(0), split_points_per_probe(0), collecting(false)
     {
-      if(threads_no >= K || ((K - 1) % threads_no) != 0)
+      if(K >= (int)(8 * sizeof(vertex_t)))
       {
-        std::cout << "Threads number is greater or equal to K (dimension of Hypercube). Or  (threads_no MOD (K - 1)) != 0. Construction aborted..." << std::endl;
+        std::cout << "K (dimension of Hypercube) does not fit in a vertex id. Construction aborted..." << std::endl;
         return;
       }
-      std::vector<bitT> mapped_pointset(N * K);
+      if(Metric::DIMENSION && D != Metric::DIMENSION)
+      {
+        std::cout << "The points are not of the dimension of the metric. Construction aborted..." << std::endl;
+        return;
+      }
+      const int N = pointset.size();
+      if(threads)
+        set_thread_pool(threads);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      const bool sign_bits = Metric::FAMILY == SIGN_PROJECTION;
+      for(int k = 0; k < K; ++k)
+      {
+        H.emplace_back(D, k);
+        if(sign_bits)
+          H[k].use_sign_bits();
+        else if(hashed_bits)
+          H[k].use_hashed_bits(k, seed);
+      }
+
+      // every distinct key gets its bit before any point is mapped, so drawn bits take a first pass
+      // over the points, and the vertex of every point a second one
+      if(!hashed_bits && !sign_bits)
+        assign_random_bits(pointset, *workers, threads_no);
+      std::vector<vertex_t> vertices(N);
+      map_pointset(pointset, vertices, *workers, threads_no);
+      H[K - 1].fill_hashtable_cube(vertices, K, *workers, threads_no);
+      //H[K - 1].print_hashtable_cube();
+    } 
+
+    /** \brief Constructor with the K and r of a configuration, e.g. one chosen by 'tune()' of tuner.h.
+      * Queries should use its 'budget' as MAX_PNTS_TO_SEARCH.
+      *
+      * @param pointset    - the N points, D coordinates each, which must outlive the Hypercube
+      * @param config      - the configuration
+      * @param threads_no  - number of threads that build the Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+   */
+    Hypercube(const PointsetView<T>& pointset, const HypercubeConfig& config, const int threads_no = std::thread::hardware_concurrency())
+      : Hypercube(pointset, config.K, threads_no, config.r)
+    {}
+
+    /** \brief Constructor with the K and r of a configuration, see above.
+      *
+      * @param pointset    - 1D vector of points, emulating a 2D, with N rows and D columns per row.
+      * @param N           - number of points
+      * @param D           - dimension of points
+      * @param config      - the configuration
+      * @param threads_no  - number of threads that build the Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+   */
+    Hypercube(const std::vector<T>& pointset, const int N, const int D, const HypercubeConfig& config, const int threads_no = std::thread::hardware_concurrency())
+      : Hypercube(PointsetView<T>(pointset.data(), N, D), config.K, threads_no, config.r)
+    {}
+
+    /** \brief Constructor that loads a Hypercube written by 'save()'. The file is mapped in memory and
+      * its arrays are used in place, so loading takes time only to check it. If the Hypercube was relaid
+      * out, the copy of the pointset is made again. Quantization is not saved; call 'quantize()' again.
+      *
+      * @param pointset    - the same pointset that the saved Hypercube was built on
+      * @param path        - path of the file
+      * @param threads_no  - number of threads of the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+   */
+    Hypercube(const std::vector<T>& pointset, const std::string& path, const int threads_no = std::thread::hardware_concurrency())
+      : Hypercube(PointsetView<T>(pointset.data(), pointset.size(), 1), path, threads_no)
+    {}
 
-      if(threads_no == 1)
+    /** \brief Constructor that loads a Hypercube written by 'save()', over points that live elsewhere.
+      * A view of consecutive rows may have any dimension, e.g. 1, if it holds the N x D coordinates.
+      *
+      * @param pointset    - the same pointset that the saved Hypercube was built on, followed by the inserted points
+      * @param path        - path of the file
+      * @param threads_no  - number of threads of the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+   */
+    Hypercube(const PointsetView<T>& pointset, const std::string& path, const int threads_no = std::thread::hardware_concurrency())
+      : D(0), K(0), pointset(pointset), ids_no(0), live_no(0), erased_no(0), compaction_threshold(0.2), laid_out(false), rerank(0),
+      probing(HAMMING_PROBING), split_threshold(0), split_points_per_probe(0), collecting(false)
+    {
+      mapping = std::make_shared<const MappedFile>(path);
+      if(!mapping->is_open())
       {
-        for(int k = 0; k < K - 1; ++k)
-        {
-          H.emplace_back(D, r);
-          //H[k].print_a();
-          H[k].hash(pointset, N, D);
-          //H[k].print_stats();
+        std::cout << "Could not map " << path << ". Loading aborted..." << std::endl;
+        return;
+      }
+      Serialization::Reader in(mapping->data(), mapping->size());
+      uint64_t magic;
+      uint32_t version, value_size, metric;
+      int N;
+      bool valid = in.value(magic) && in.value(version) && in.value(value_size) && in.value(metric) && in.value(N) &&
+        magic == MAGIC && version == VERSION && value_size == sizeof(T) && metric == Metric::ID && projection.load(in) &&
+        projection.get_family() == Metric::FAMILY;
+      D = projection.get_D();
+      K = projection.get_K();
+      valid = valid && K > 0 && K < (int)(8 * sizeof(vertex_t)) && N >= 0 && (!Metric::DIMENSION || D == Metric::DIMENSION);
+      if(valid && pointset.dimension() != D)
+      {
+        // reshape consecutive rows of another dimension into N x D
+        valid = pointset.contiguous() && (size_t)pointset.size() * pointset.dimension() == (size_t)N * D;
+        this->pointset = PointsetView<T>(pointset.data(), N, D);
+      }
+      valid = valid && this->pointset.size() == N;
+      // the id of every row of the copy of the pointset, if there was one; else the rows are the ids
+      const int* rows = NULL;
+      uint64_t rows_size = 0;
+      valid = valid && in.array(rows, rows_size) && rows_size <= (uint64_t)N;
+      for(uint64_t i = 0; valid && i < rows_size; ++i)
+        valid = rows[i] >= 0 && rows[i] < N;
+      for(int k = 0; valid && k < K; ++k)
+      {
+        H.emplace_back(D, k);
+        valid = H[k].load(in, K, rows_size ? rows_size : N) && (k < K - 1 || H[k].get_probe_masks().size());
+      }
+      valid = valid && (rows_size == 0 || (uint64_t)H[K - 1].cube_size() == rows_size);
+      // the hash functions of the sub-cubes, whose vertices are sorted in the cube already
+      valid = valid && in.value(split_threshold) && in.value(split_points_per_probe) && split_threshold >= 0;
+      if(valid && split_threshold)
+        valid = split_projection.load(in) && split_projection.get_D() == D && split_projection.get_K() > 0 &&
+          split_projection.get_K() <= 16 && split_projection.get_family() == Metric::FAMILY;
+      for(int j = 0; valid && split_threshold && j < split_projection.get_K(); ++j)
+      {
+        split_H.emplace_back(D, K + j);
+        valid = split_H[j].load(in, 0, 0);
+      }
+      valid = valid && H[K - 1].get_split_bits() == (int)split_H.size();
+      if(!valid)
+      {
+        H.clear();
+        split_H.clear();
+        split_threshold = 0;
+        std::cout << path << " is not a Hypercube of this pointset and metric, or is from another version. Loading aborted..." << std::endl;
+        return;
+      }
+      ids_no = N;
+      live_no = H[K - 1].cube_size();
+      if(rows_size)
+      {
+        permutation.view(rows, rows_size);
+        copy_in_vertex_order();
+        laid_out = true;
+      }
+      executor(threads_no);
+    }
+
+    /** \brief Copy constructor. The copy shares the threads and, if any, the points that live elsewhere,
+      * and copies the rest, so that either one can be updated without affecting the other.
+      * The histograms of 'statistics()' are not copied.
+      *
+      * @param other  - the Hypercube to copy
+    */
+    Hypercube(const Hypercube& other)
+      : H(other.H), projection(other.projection), D(other.D), K(other.K), pointset(other.pointset), ordered_pointset(other.ordered_pointset),
+      permutation(other.permutation), ids_no(other.ids_no), row_of_id(other.row_of_id), erased(other.erased), live_no(other.live_no),
+      erased_no(other.erased_no), compaction_threshold(other.compaction_threshold), laid_out(other.laid_out),
+      quantized(other.quantized ? std::make_shared<QuantizedPointset<T>>(*other.quantized) : nullptr), rerank(other.rerank),
+      probing(other.probing), mapping(other.mapping),
+      split_projection(other.split_projection), split_H(other.split_H), split_threshold(other.split_threshold),
+      split_points_per_probe(other.split_points_per_probe), collecting(other.collecting)
+    {
+      std::lock_guard<std::mutex> lock(other.pool_mutex);
+      pool = other.pool;
+    }
 
-          H[k].assign_random_bit(mapped_pointset, k, K);
+    Hypercube& operator=(const Hypercube&) = delete;
+
+    /** \brief Write the Hypercube to a file, to be loaded by the loading constructor. The file
+      * holds the projections, the bits of the keys and the Hamming cube, in the byte order of
+      * this machine, and the sub-cubes of 'split()'; the pointset and the compressed copy of 'quantize()' are not saved.
+      * After 'insert()', the Hypercube has to be loaded on the pointset followed by the inserted points.
+      *
+      * @param path  - path of the file
+      * @return      - false if the file could not be written, or if there are insertions or
+      *                erasures to compact, see 'compact()'
+    */
+    bool save(const std::string& path) const
+    {
+      if(H.empty() || erased_no || H[K - 1].has_inserted_points())
+        return false;
+      Serialization::Writer out(path);
+      out.value(MAGIC);
+      out.value(VERSION);
+      out.value((uint32_t)sizeof(T));
+      out.value((uint32_t)Metric::ID);
+      out.value(ids_no);
+      projection.save(out);
+      out.array(permutation.data(), permutation.size());
+      for(auto& h: H)
+        h.save(out);
+      out.value(split_threshold);
+      out.value(split_points_per_probe);
+      if(split_threshold)
+      {
+        split_projection.save(out);
+        for(auto& h: split_H)
+          h.save(out);
+      }
+      return out.good();
+    }
+
+    /** \brief Assign a random bit to every distinct key of every hash function.
+      * Threads first hash ranges of points, a chunk at a time, and collect their distinct
+      * keys, and then every hash function draws the bits of its keys, in parallel.
+      *
+      * @param points      - the points of the construction
+      * @param workers     - threads of the construction
+      * @param threads_no  - most threads of 'workers' that run, see 'ThreadPool::size()'
+    */
+    void assign_random_bits(const PointsetView<T>& points, ThreadPool& workers, const int threads_no)
+    {
+      const int N = points.size();
+      const int threads = workers.size(threads_no);
+      const int range = std::max(1, (N + threads - 1) / threads);
+      const int ranges_no = (N + range - 1) / range;
+      // distinct keys of every range of points, for every hash function
+      std::vector<std::vector<std::vector<int>>> range_keys(ranges_no, std::vector<std::vector<int>>(K));
+      workers.parallel_for(0, N, range, [&](const int start, const int end)
+      {
+        std::vector<std::unordered_set<int>> seen(K);
+        const int chunk = 4096;
+        std::vector<int> keys((size_t)std::min(chunk, end - start) * K);
+        for(int c_start = start; c_start < end; c_start += chunk)
+        {
+          const int c_end = std::min(end, c_start + chunk);
+          projection.template hash<Metric::DIMENSION>(points.row(c_start), c_end - c_start, keys.data(), NULL, points.stride());
+          for(int i = 0; i < c_end - c_start; ++i)
+            for(int k = 0; k < K; ++k)
+              seen[k].insert(keys[(size_t)i * K + k]);
+        }
+        std::vector<std::vector<int>>& distinct = range_keys[start / range];
+        for(int k = 0; k < K; ++k)
+          distinct[k].assign(seen[k].begin(), seen[k].end());
+      }, threads);
+      workers.parallel_for(0, K, 1, [&](const int k_start, const int k_end)
+      {
+        for(int k = k_start; k < k_end; ++k)
+        {
+          std::vector<int> distinct;
+          for(auto& range_distinct: range_keys)
+            distinct.insert(distinct.end(), range_distinct[k].begin(), range_distinct[k].end());
+          std::sort(distinct.begin(), distinct.end());
+          distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+          H[k].assign_random_bits(distinct);
         }
-        H.emplace_back(D, r);
-        H[K - 1].hash(pointset, N, D);
-        H[K - 1].assign_random_bit_and_fill_hashtable_cube(mapped_pointset, K);
+      }, threads);
+    }
+
+    /** \brief The vertex of every point, once every key has its bit: every chunk of points is
+      * hashed and mapped at once, so only the keys of a chunk per thread are held.
+      *
+      * @param points    - the n points
+      * @param vertices  - n vertices (to be populated)
+      * @param pool        - threads that map ranges of points
+      * @param threads_no  - most threads of 'pool' that run, see 'ThreadPool::size()'. Default value is 0, i.e. all.
+    */
+    void map_pointset(const PointsetView<T>& points, std::vector<vertex_t>& vertices, ThreadPool& pool, const int threads_no = 0) const
+    {
+      const int n = points.size();
+      const int chunk = std::max(1, std::min(4096, n / (4 * pool.size(threads_no))));
+      pool.parallel_for(0, n, chunk, [&](const int start, const int end)
+      {
+        std::vector<int> keys((size_t)(end - start) * K);
+        projection.template hash<Metric::DIMENSION>(points.row(start), end - start, keys.data(), NULL, points.stride());
+        for(int i = start; i < end; ++i)
+          vertices[i] = map_query(&keys[(size_t)(i - start) * K]);
+      }, threads_no);
+    }
+
+    /** \brief Compute the keys of a pointset for all the hash functions.
+      *
+      * @param points      - n points, D coordinates each
+      * @param keys        - n x K keys (to be populated)
+      * @param pool        - threads that hash ranges of points
+      * @param fractions   - optional n x K positions of the projections inside their buckets (to be populated)
+      * @param threads_no  - most threads of 'pool' that run, see 'ThreadPool::size()'. Default value is 0, i.e. all.
+    */
+    void hash_pointset(const PointsetView<T>& points, std::vector<int>& keys, ThreadPool& pool, float* fractions = NULL, const int threads_no = 0) const
+    {
+      const int n = points.size();
+      // a few chunks per thread, so that a slow thread can be helped
+      const int chunk = std::max(1, n / (4 * pool.size(threads_no)));
+      pool.parallel_for(0, n, chunk, [&](const int start, const int end)
+      {
+        hash_pointset(PointsetView<T>(points.row(start), end - start, points.dimension(), points.stride()), keys.data() + (size_t)start * K, fractions ? fractions + (size_t)start * K : NULL);
+      }, threads_no);
+    }
 
-        //H[K - 1].print_hashtable_cube();
+    /** \brief Compute the keys of a pointset for all the hash functions, on the calling thread.
+      *
+      * @param points      - n points, D coordinates each
+      * @param keys        - n x K keys (to be populated)
+      * @param fractions   - optional n x K positions of the projections inside their buckets (to be populated)
+    */
+    void hash_pointset(const PointsetView<T>& points, int* keys, float* fractions = NULL) const
+    {
+      projection.template hash<Metric::DIMENSION>(points.row(0), points.size(), keys, fractions, points.stride());
+    }
+
+    /** \brief The persistent threads of the construction and the queries, created once, on first use,
+      * unless they were set by 'set_thread_pool()'. A call that asks for 'threads_no' threads runs on
+      * at most that many of them, see 'ThreadPool::size()', and never creates threads again.
+      *
+      * @param threads_no  - number of threads, when there are none yet
+      * @return            - the threads
+    */
+    std::shared_ptr<ThreadPool> executor(const int threads_no) const
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      if(!pool)
+        pool = std::make_shared<ThreadPool>(threads_no);
+      return pool;
+    }
+
+    /** \brief Run the queries on the given threads, e.g. to share them between Hypercubes.
+      * Queries still run on at most their 'threads_no' of them.
+      *
+      * @param threads  - the threads
+    */
+    void set_thread_pool(const std::shared_ptr<ThreadPool>& threads)
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      pool = threads;
+    }
+
+    /** \brief Number of queries handed to a thread at a time: small, so that queries
+      * that probe many vertices are balanced, but not so small that threads contend.
+      *
+      * @param Q           - number of queries
+      * @param threads_no  - number of threads
+      * @return            - the chunk size
+    */
+    static int query_chunk(const int Q, const int threads_no)
+    {
+      return std::max(1, std::min(16, Q / (8 * threads_no)));
+    }
+
+    /** \brief Keep a compressed copy of the pointset. Queries score their candidates on it,
+      * and re-check only the best ones on the original points.
+      *
+      * @param mode        - INT8_QUANTIZATION, FP16_QUANTIZATION, or NO_QUANTIZATION to drop the copy
+      * @param rerank      - number of candidates of a Nearest Neighbor query re-checked on the original points. Default value is 10.
+    */
+    void quantize(const Quantization mode, const int rerank = 10)
+    {
+      if(mode != NO_QUANTIZATION && Metric::ID != L2Metric::ID)
+      {
+        std::cout << "Quantization supports only the Euclidean distance. Quantization aborted..." << std::endl;
+        return;
       }
-      else
+      quantized.reset();
+      if(mode != NO_QUANTIZATION)
+        quantized = std::make_shared<QuantizedPointset<T>>(points().data(), points().size(), D, mode, points().stride());
+      this->rerank = rerank;
+    }
+
+    /** \brief Give every vertex of the Hamming cube with more than 'threshold' points a sub-cube: 'bits' extra
+      * hash functions, applied only to the points of such vertices. A query that probes such a vertex checks its
+      * points sub-vertex by sub-vertex, by Hamming distance from its own sub-vertex, so the points closest to it
+      * come first, and at most 'points_per_probe' of them, before it moves on to the next vertex. So a query that
+      * lands on a crowded vertex does not spend its MAX_PNTS_TO_SEARCH there on the wrong points. 'compact()' splits
+      * the vertices again; inserted points are not split until then. Queries of MultiHypercube and SnapshotHypercube
+      * check split vertices whole, in the order of their sub-cubes.
+      *
+      * @param threshold         - vertices with more points are split; 0 to drop the sub-cubes
+      * @param bits              - dimension of the sub-cubes, at most 16. Default value is 6.
+      * @param points_per_probe  - most points of a split vertex checked when it is probed, e.g. 'threshold'. Bounds the
+      *                            work per vertex, but skips the rest of it, where the nearest points may still be.
+      *                            Default value is 0, i.e. all of them.
+      * @param r           - hashing window of the extra hash functions. Default value is 0, i.e. the spread of the
+      *                      projections of the points of the split vertices, which are close to each other.
+      * @param threads_no  - number of threads that hash the points, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+      * @return            - number of vertices split
+    */
+    int split(const int threshold, const int bits = 6, const int points_per_probe = 0, const float r = 0, const int threads_no = std::thread::hardware_concurrency())
+    {
+      split_threshold = 0;
+      split_points_per_probe = points_per_probe;
+      split_H.clear();
+      if(H.empty() || threshold <= 0 || bits <= 0)
       {
-        std::vector<std::thread> threads;
+        if(!H.empty())
+          H[K - 1].reset_splits(0, 0, 0);
+        return 0;
+      }
+      const int sub_K = std::min(bits, 16);
+      split_threshold = threshold;
+      const bool sign_bits = Metric::FAMILY == SIGN_PROJECTION;
+      split_projection = ProjectionMatrix(sub_K, D, (r > 0 || sign_bits) ? r : crowded_spread(crowded_vertices(), sub_K), 0.0, 1.0, Metric::FAMILY);
+      // no bits are stored: every key gets a bit derived from it, as unseen keys of queries do, or is its own bit
+      for(int j = 0; j < sub_K; ++j)
+      {
+        split_H.emplace_back(D, K + j);
+        if(sign_bits)
+          split_H[j].use_sign_bits();
+      }
+      return split_cube(threads_no);
+    }
 
-        std::vector<std::vector<StableHashFunction<T>>> subvectors(threads_no);
-        const int subvector_size = (K - 1)/threads_no;
-        //std::cout << "subvector_size = " << subvector_size << std::endl;
-        for (int i = 0; i < threads_no; ++i)
-          threads.push_back(std::thread(populate_vector_of_hash_functions, std::ref(subvectors[i]), subvector_size, D, r, std::ref(pointset), N, std::ref(mapped_pointset), i * subvector_size, K));
+    /** \brief Sort the points of every vertex with more than 'split_threshold' points by their sub-vertex, see 'split()'.
+      *
+      * @param threads_no  - number of threads that hash the points
+      * @return            - number of vertices split
+    */
+    int split_cube(const int threads_no = std::thread::hardware_concurrency())
+    {
+      H[K - 1].reset_splits(split_H.size(), split_threshold, split_points_per_probe);
+      if(!split_threshold)
+        return 0;
+      const std::vector<vertex_t> crowded = crowded_vertices();
+      // sub-vertices of the points of every crowded vertex, hashed in parallel
+      std::vector<std::vector<vertex_t>> sub_vertices(crowded.size());
+      const PointsetView<T> rows = points();
+      executor(threads_no)->parallel_for(0, crowded.size(), 1, [&](const int start, const int end)
+      {
+        std::vector<T> gathered;
+        for(int c = start; c < end; ++c)
+        {
+          int size;
+          const int* points_idxs = H[K - 1].vertex_points(crowded[c], size);
+          gathered.resize((size_t)size * D);
+          for(int i = 0; i < size; ++i)
+            std::copy(rows.row(points_idxs[i]), rows.row(points_idxs[i]) + D, gathered.begin() + (size_t)i * D);
+          sub_vertices[c] = map_sub_queries(gathered.data(), size);
+        }
+      }, threads_no);
+      for(size_t c = 0; c < crowded.size(); ++c)
+        H[K - 1].split_vertex(crowded[c], sub_vertices[c]);
+      return crowded.size();
+    }
 
-        for (auto& th : threads)
-          th.join();
+    /** \brief Vertices with more than 'split_threshold' points.
+      *
+      * @return  - the vertices
+    */
+    std::vector<vertex_t> crowded_vertices() const
+    {
+      std::vector<vertex_t> crowded;
+      for(vertex_t vertex = 0; vertex < ((vertex_t)1 << K); ++vertex)
+      {
+        int size;
+        H[K - 1].vertex_points(vertex, size);
+        if(size > split_threshold)
+          crowded.push_back(vertex);
+      }
+      return crowded;
+    }
 
-        for(auto& subv: subvectors)
+    /** \brief A hashing window that splits the points of crowded vertices: the mean standard deviation
+      * of random projections of up to 4096 of their points.
+      *
+      * @param crowded       - the crowded vertices
+      * @param functions_no  - number of projections
+      * @return              - the window, that of the Hypercube if there are no such points
+    */
+    float crowded_spread(const std::vector<vertex_t>& crowded, const int functions_no) const
+    {
+      const int SAMPLE = 4096;
+      size_t total = 0;
+      for(const vertex_t vertex: crowded)
+      {
+        int size;
+        H[K - 1].vertex_points(vertex, size);
+        total += size;
+      }
+      const size_t step = std::max((size_t)1, total / SAMPLE);
+      const PointsetView<T> rows = points();
+      std::vector<T> sample;
+      size_t seen = 0;
+      for(const vertex_t vertex: crowded)
+      {
+        int size;
+        const int* points_idxs = H[K - 1].vertex_points(vertex, size);
+        for(int i = 0; i < size; ++i, ++seen)
+          if(seen % step == 0)
+            sample.insert(sample.end(), rows.row(points_idxs[i]), rows.row(points_idxs[i]) + D);
+      }
+      const int n = sample.size() / std::max(1, D);
+      if(n < 2)
+        return projection.get_r();
+      // projections with a window of 1 are the key plus the fraction
+      const ProjectionMatrix unit(functions_no, D, 1);
+      std::vector<int> keys((size_t)n * functions_no);
+      std::vector<float> fractions((size_t)n * functions_no);
+      unit.hash(sample.data(), n, keys.data(), fractions.data());
+      double spread = 0;
+      for(int j = 0; j < functions_no; ++j)
+      {
+        double sum = 0, squares = 0;
+        for(int i = 0; i < n; ++i)
         {
-          //for(auto& s: subv)
-          //{
-            H.insert(
-              H.end(),
-              std::make_move_iterator(subv.begin()),
-              std::make_move_iterator(subv.end())
-            );
-          //}
+          const double value = keys[(size_t)i * functions_no + j] + fractions[(size_t)i * functions_no + j];
+          sum += value;
+          squares += value * value;
         }
-        H.emplace_back(D, r);
-        H[K - 1].hash(pointset, N, D);
-        H[K - 1].assign_random_bit_and_fill_hashtable_cube(mapped_pointset, K);
+        const double mean = sum / n;
+        spread += std::sqrt(std::max(0.0, squares / n - mean * mean));
+      }
+      return spread > 0 ? spread / functions_no : projection.get_r();
+    }
+
+    /** \brief Vertices of points on the sub-cubes of 'split()'.
+      *
+      * @param points  - n points, D coordinates each, contiguous
+      * @param n       - number of points
+      * @return        - the n sub-vertices, or none if no vertex is split
+    */
+    std::vector<vertex_t> map_sub_queries(const T* points, const int n) const
+    {
+      if(!split_threshold || n <= 0)
+        return std::vector<vertex_t>();
+      const int sub_K = split_H.size();
+      std::vector<int> keys((size_t)n * sub_K);
+      split_projection.template hash<Metric::DIMENSION>(points, n, keys.data());
+      std::vector<vertex_t> sub_vertices(n, 0);
+      for(int i = 0; i < n; ++i)
+        for(int j = 0; j < sub_K; ++j)
+          sub_vertices[i] |= (vertex_t)(split_H[j].query_bit(keys[(size_t)i * sub_K + j]) != 0) << j;
+      return sub_vertices;
+    }
 
-        //H[K - 1].print_hashtable_cube();
+    /** \brief Copy the pointset in the order of the vertices of the Hamming cube, which are
+      * in Gray code order. The points of a vertex, and of neighboring vertices, become contiguous
+      * rows, which queries scan sequentially. Results are still the indices of the original pointset.
+      * Doubles the memory of the points; the original pointset is not used by queries afterwards.
+      * 'compact()' keeps the order afterwards.
+    */
+    void relayout()
+    {
+      const bool pending = erased_no || H[K - 1].has_inserted_points();
+      if(laid_out && !pending)
+        return;
+      laid_out = true;
+      if(pending)
+      {
+        compact();
+        return;
       }
-    } 
+      lay_out_rows();
+      if(quantized)
+        quantize(quantized->get_mode(), rerank);
+    }
 
-    /** \brief Populate the vector of hash functions.
-      * Helper function for the Constructor in a parallel environment.
+    /** \brief Copy the rows of 'points()' in the order of the vertices of the Hamming cube.
+      * There must be no insertions or erasures to compact.
+    */
+    void lay_out_rows()
+    {
+      // the row at every position
+      const std::vector<int> order = H[K - 1].relayout();
+      const PointsetView<T> rows = points();
+      std::vector<T> copy(order.size() * D);
+      std::vector<int> ids(order.size());
+      for(size_t i = 0; i < order.size(); ++i)
+      {
+        std::copy(rows.row(order[i]), rows.row(order[i]) + D, copy.begin() + i * D);
+        ids[i] = original_index(order[i]);
+      }
+      ordered_pointset.swap(copy);
+      permutation.assign(std::move(ids));
+      row_of_id.clear();
+      erased.clear();
+    }
+
+    /** \brief Insert points. They get the ids that follow the last one, and are assigned to their vertices
+      * by the hash functions of the construction; keys unseen during construction get a bit derived from
+      * the key, as those of queries do. Takes time proportional to the number of new points, except for
+      * the first insertion, which copies the pointset: the Hypercube owns its points afterwards.
+      * Must not run concurrently with queries.
       *
-      * @param H                 - vector of Hash Functions
-      * @param n_vec             - nubmer of hash function to be inserted
-      * @param D                 - dimension of the original points
-      * @param r                 - Stable Distirbution parameter
-      * @param pointset          - original points
-      * @param N                 - number of origial points
-      * @param mapped_pointset   - vector of mapped points (to be poppulated)
-      * @param k_start           - starting index of mapped_pointset to be poppulated in parallel
-      * @param K                 - dimension of Hypercube
+      * @param points      - the new points, D coordinates each
+      * @param threads_no  - number of threads that hash the points, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+      * @return            - id of the first new point; the rest follow it
     */
-    static void populate_vector_of_hash_functions(std::vector<StableHashFunction<T>>& H, const int n_vec, const int D, const int r, const std::vector<T>& pointset, const int N, std::vector<bitT>& mapped_pointset, const int k_start, const int K)
+    int insert(const PointsetView<T>& points, const int threads_no = std::thread::hardware_concurrency())
     {
-      for (int i = 0; i < n_vec; ++i)
+      if(permutation.empty())
       {
-        H.emplace_back(D, r, k_start + i);
-        H[i].hash(pointset, N, D);
-        //std::cout << k_start << " " << i << std::endl;
-        H[i].assign_random_bit(mapped_pointset, k_start + i, K);
+        std::vector<int> ids(ids_no);
+        std::iota(ids.begin(), ids.end(), 0);
+        permutation.assign(std::move(ids));
+        copy_in_vertex_order();
       }
+      const int n = points.size();
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<int> keys((size_t)n * K);
+      hash_pointset(points, keys, *workers, NULL, threads_no);
+      const int first_id = ids_no;
+      std::vector<int>& ids = permutation.vector();
+      for(int i = 0; i < n; ++i)
+      {
+        const int row = ids.size();
+        ordered_pointset.insert(ordered_pointset.end(), points.row(i), points.row(i) + D);
+        ids.push_back(ids_no);
+        if(!row_of_id.empty())
+          row_of_id.push_back(row);
+        if(!erased.empty())
+          erased.push_back(0);
+        H[K - 1].insert_point(map_query(&keys[(size_t)i * K]), row);
+        ++ids_no;
+      }
+      live_no += n;
+      if(quantized)
+        quantized->append(points.data(), n, points.stride());
+      return first_id;
     }
 
-    /** \brief Radius query the Hamming cube.
+    /** \brief Insert points, see above.
       *
-      * @param query               - vector of queries
-      * @param Q                   - number of queries
-      * @param radius              - find a point within r with query
-      * @param MAX_PNTS_TO_SEARCH  - threshold
-      * @param results_idxs        - indices of Q points, where Eucl(point[i], query[i]) <= r
-      * @param threads_no          - number of threads to be created. Default value is 'std::thread::hardware_concurrency()'.
+      * @param points      - 1D vector of points, emulating a 2D, with n rows and D columns per row
+      * @param n           - number of points
+      * @param threads_no  - number of threads that hash the points. Default value is 'std::thread::hardware_concurrency()'.
+      * @return            - id of the first new point; the rest follow it
+    */
+    int insert(const std::vector<T>& points, const int n, const int threads_no = std::thread::hardware_concurrency())
+    {
+      return insert(PointsetView<T>(points.data(), n, D), threads_no);
+    }
+
+    /** \brief Erase points. Queries skip them from now on, and 'compact()' frees them; it is called
+      * when the points erased since the last compaction exceed the threshold of 'set_compaction_threshold()'.
+      * Ids out of range, or of points already erased, are ignored. Must not run concurrently with queries.
+      *
+      * @param ids  - ids of the points
+      * @return     - number of points erased
     */
-    void radius_query(const std::vector<T>& query, const int Q, const int radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs, const int threads_no = std::thread::hardware_concurrency())
+    int erase(const std::vector<int>& ids)
     {
-      std::vector<bitT> mapped_query(Q * K);
-      if(threads_no == 1)
+      const int rows = points().size();
+      if(erased.empty())
+        erased.assign(rows, 0);
+      if(!permutation.empty() && row_of_id.empty())
       {
-        for(int q = 0; q < Q; ++q)
+        row_of_id.assign(ids_no, -1);
+        for(int row = 0; row < rows; ++row)
+          row_of_id[permutation[row]] = row;
+      }
+      int erased_now = 0;
+      for(const int id: ids)
+      {
+        if(id < 0 || id >= ids_no)
+          continue;
+        const int row = permutation.empty() ? id : row_of_id[id];
+        if(row == -1 || erased[row])
+          continue;
+        erased[row] = 1;
+        ++erased_now;
+      }
+      erased_no += erased_now;
+      live_no -= erased_now;
+      if(erased_no > compaction_threshold * rows)
+        compact();
+      return erased_now;
+    }
+
+    /** \brief Set when 'erase()' calls 'compact()'.
+      *
+      * @param fraction  - fraction of the rows that may be erased before compaction. Default value is 0.2.
+      *                    1 (or more) compacts only when asked to.
+    */
+    void set_compaction_threshold(const float fraction)
+    {
+      compaction_threshold = fraction;
+    }
+
+    /** \brief Drop the erased points from the Hamming cube and merge the inserted ones into it. If the
+      * Hypercube owns its points (see 'insert()' and 'relayout()'), the rows of the erased ones are freed,
+      * and, after 'relayout()', the rows are put back in vertex order. Ids do not change.
+      * Takes time linear in the number of points.
+    */
+    void compact()
+    {
+      if(H.empty() || (!erased_no && !H[K - 1].has_inserted_points()))
+        return;
+      const int rows = points().size();
+      std::vector<int> new_row(rows);
+      if(permutation.empty())
+      {
+        // the rows are the points of the pointset, which stay where they are. Their marks are
+        // kept, so that erasing them again is ignored.
+        for(int row = 0; row < rows; ++row)
+          new_row[row] = (!erased.empty() && erased[row]) ? -1 : row;
+        H[K - 1].compact(new_row);
+        split_cube();
+      }
+      else
+      {
+        std::vector<int>& ids = permutation.vector();
+        int kept = 0;
+        for(int row = 0; row < rows; ++row)
         {
-          for(int k = 0; k < K; ++k)
+          if(!erased.empty() && erased[row])
           {
-            H[k].assign_random_bit_query((std::begin(query) + q * D), (std::begin(mapped_query) + q * K), k);
+            new_row[row] = -1;
+            continue;
           }
-          results_idxs[q] = H[K - 1].radius_query(std::string(mapped_query.begin() + q * K, mapped_query.begin() + (q + 1) * K), radius, K, MAX_PNTS_TO_SEARCH, pointset.begin(), query.begin() + q * D);
+          new_row[row] = kept;
+          if(kept != row)
+          {
+            std::copy(ordered_pointset.begin() + (size_t)row * D, ordered_pointset.begin() + (size_t)(row + 1) * D, ordered_pointset.begin() + (size_t)kept * D);
+            ids[kept] = ids[row];
+          }
+          ++kept;
         }
+        ids.resize(kept);
+        ids.shrink_to_fit();
+        ordered_pointset.resize((size_t)kept * D);
+        ordered_pointset.shrink_to_fit();
+        H[K - 1].compact(new_row);
+        row_of_id.clear();
+        erased.clear();
+        split_cube();
+        if(laid_out)
+          lay_out_rows();
       }
-      else
-      {
-        std::vector<std::thread> threads;
+      erased_no = 0;
+      if(quantized)
+        quantize(quantized->get_mode(), rerank);
+    }
+
+    /** \brief Number of points that queries can report: those of the construction and the inserted ones, but not the erased ones.
+      *
+      * @return - the number of points
+    */
+    int size() const
+    {
+      return live_no;
+    }
+
+    /** \brief Number of ids handed out: the points of the construction and the inserted ones, erased or not.
+      *
+      * @return - the id that the next inserted point gets
+    */
+    int get_ids_no() const
+    {
+      return ids_no;
+    }
+
+    int get_D() const { return D; }
+    int get_K() const { return K; }
+
+    /** \brief Copy the pointset in the order of 'permutation'.
+    */
+    void copy_in_vertex_order()
+    {
+      ordered_pointset.resize(permutation.size() * D);
+      for(size_t i = 0; i < permutation.size(); ++i)
+        std::copy(pointset.row(permutation[i]), pointset.row(permutation[i]) + D, ordered_pointset.begin() + i * D);
+    }
+
+    /** \brief The points that queries check: the copy in vertex order, if any, or the original pointset.
+      *
+      * @return - the points
+    */
+    PointsetView<T> points() const
+    {
+      return permutation.empty() ? pointset : PointsetView<T>(ordered_pointset.data(), permutation.size(), D);
+    }
+
+    /** \brief True if a row of 'points()' was erased, e.g. one that 'compact()' kept in place, but not in the Hamming cube.
+      *
+      * @param row  - index of a row of 'points()'
+      * @return     - true if the point of the row is erased
+    */
+    bool is_erased(const int row) const
+    {
+      return !erased.empty() && erased[row];
+    }
+
+    /** \brief Index in the original pointset of a point that queries report.
+      *
+      * @param point_idx  - index of a row of 'points()', or -1
+      * @return           - index of the point in the original pointset, or -1
+    */
+    int original_index(const int point_idx) const
+    {
+      return (point_idx == -1 || permutation.empty()) ? point_idx : permutation[point_idx];
+    }
+
+    /** \brief Set the order in which queries probe the vertices of the Hamming cube.
+      * With MARGIN_PROBING, a query first flips the bits whose projections fell closest to
+      * a boundary of their bucket, so the same recall needs fewer MAX_PNTS_TO_SEARCH.
+      *
+      * @param mode  - HAMMING_PROBING (default) or MARGIN_PROBING
+    */
+    void set_probing(const Probing mode)
+    {
+      probing = mode;
+    }
+
+    /** \brief Add the statistics of every query from now on to histograms, see 'statistics()'.
+      * Costs a few reads of the clock per query. Off by default.
+      *
+      * @param on  - collect or stop collecting
+    */
+    void collect_statistics(const bool on)
+    {
+      collecting = on;
+    }
 
-        const int batch = Q/threads_no;
-        //std::cout << "subvector_size = " << subvector_size << std::endl;
-        for (int i = 0; i < threads_no - 1; ++i)
-          threads.push_back(std::thread(execute_radius_queries, std::ref(H), std::ref(query), std::ref(mapped_query), i * batch, (i + 1) * batch, K, D, std::ref(pointset), radius, MAX_PNTS_TO_SEARCH, std::ref(results_idxs)));
-        threads.push_back(std::thread(execute_radius_queries, std::ref(H), std::ref(query), std::ref(mapped_query), (threads_no - 1) * batch, Q, K, D, std::ref(pointset), radius, MAX_PNTS_TO_SEARCH, std::ref(results_idxs)));
-    
-        for (auto& th : threads)
-          th.join();
+    /** \brief Histograms of the statistics of the queries since 'collect_statistics()' was turned on,
+      * or since 'reset_statistics()'.
+      *
+      * @return  - a copy of the histograms
+    */
+    QueryHistograms statistics() const
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex);
+      return histograms;
+    }
+
+    /** \brief Empty the histograms of 'statistics()'.
+    */
+    void reset_statistics()
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex);
+      histograms = QueryHistograms();
+    }
+
+    /** \brief Vertex of a query on the Hamming cube.
+      *
+      * @param keys  - K keys of the query, see 'hash_pointset()'
+      * @return      - the vertex
+    */
+    vertex_t map_query(const int* keys) const
+    {
+      vertex_t vertex = 0;
+      for(int k = 0; k < K; ++k)
+        vertex |= (vertex_t)(H[k].query_bit(keys[k]) != 0) << k;
+      return vertex;
+    }
+
+    /** \brief Points assigned to a vertex of the Hamming cube, not counting those inserted
+      * or erased since the last 'compact()'.
+      *
+      * @param vertex  - vertex id
+      * @param size    - number of points of the vertex
+      * @return        - pointer to their indices, rows of 'points()'
+    */
+    const int* vertex_points(const vertex_t vertex, int& size) const
+    {
+      return H[K - 1].vertex_points(vertex, size);
+    }
+
+    /** \brief Masks of the vertices by increasing Hamming distance, for HammingProber.
+      *
+      * @return - the masks
+    */
+    const std::vector<vertex_t>& probe_masks() const
+    {
+      return H[K - 1].get_probe_masks();
+    }
+
+    /** \brief Score of flipping every bit of a mapped query: the squared distance, in units of 'r', of
+      * the projection from the nearest boundary of its bucket behind which the key has the other bit.
+      * If both neighboring keys have the same bit, at least one more boundary is crossed. For sign
+      * projections, the squared distance of the projection from the hyperplane.
+      *
+      * @param keys       - K keys of the query
+      * @param fractions  - K positions of the projections inside their buckets
+      * @param scores     - K scores (to be populated)
+    */
+    void margin_scores(const int* keys, const float* fractions, float* scores) const
+    {
+      if(Metric::FAMILY == SIGN_PROJECTION)
+      {
+        for(int k = 0; k < K; ++k)
+          scores[k] = fractions[k] * fractions[k];
+        return;
+      }
+      for(int k = 0; k < K; ++k)
+      {
+        const char bit = H[k].query_bit(keys[k]);
+        const float left = fractions[k], right = 1 - fractions[k];
+        float margin;
+        if(H[k].query_bit(keys[k] - 1) != bit)
+          margin = (H[k].query_bit(keys[k] + 1) != bit) ? std::min(left, right) : left;
+        else
+          margin = (H[k].query_bit(keys[k] + 1) != bit) ? right : 1 + std::min(left, right);
+        scores[k] = margin * margin;
       }
-      // per query, find candidates
-      /*for(int q = 0; q < Q; ++q)
+    }
+
+    /** \brief Where the queries record their statistics: the caller's vector, or a temporary one when
+      * only the histograms are collected, or nowhere.
+      *
+      * @param Q          - number of queries
+      * @param stats      - statistics of the caller, or NULL
+      * @param collected  - the temporary vector
+      * @return           - Q cleared statistics, or NULL if there is nothing to record
+    */
+    std::vector<QueryStats>* statistics_of(const int Q, std::vector<QueryStats>* stats, std::vector<QueryStats>& collected) const
+    {
+      if(!stats && !collecting)
+        return NULL;
+      if(!stats)
+        stats = &collected;
+      stats->assign(Q, QueryStats());
+      return stats;
+    }
+
+    /** \brief Hash the queries for all hash functions, see 'hash_pointset()'. The queries are hashed
+      * together, so each of their statistics gets an equal share of the time.
+      *
+      * @param query            - vector of queries
+      * @param Q                - number of queries
+      * @param query_keys       - Q x K keys (to be populated)
+      * @param query_fractions  - Q x K positions of the projections in their buckets, if not empty (to be populated)
+      * @param workers          - the threads
+      * @param threads_no       - most threads of 'workers' that run, see 'ThreadPool::size()'
+      * @param stats            - statistics of the queries, or NULL
+    */
+    void hash_queries(const std::vector<T>& query, const int Q, std::vector<int>& query_keys, std::vector<float>& query_fractions, ThreadPool& workers,
+      const int threads_no, std::vector<QueryStats>* stats) const
+    {
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      hash_pointset(PointsetView<T>(query.data(), Q, D), query_keys, workers, query_fractions.empty() ? NULL : query_fractions.data(), threads_no);
+      if(!stats)
+        return;
+      const double share = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / std::max(1, Q);
+      for(size_t q = 0; q < stats->size(); ++q)
+        (*stats)[q].mapping_seconds = share;
+    }
+
+    /** \brief Add the statistics of some queries to the histograms, if 'collect_statistics()' is on.
+      *
+      * @param stats    - statistics of all queries, or NULL
+      * @param q_start  - first query
+      * @param q_end    - one past the last query
+    */
+    void collect(const std::vector<QueryStats>* stats, const int q_start, const int q_end) const
+    {
+      if(!stats || !collecting)
+        return;
+      QueryHistograms chunk;
+      for(int q = q_start; q < q_end; ++q)
+        chunk.add((*stats)[q]);
+      std::lock_guard<std::mutex> lock(statistics_mutex);
+      histograms.merge(chunk);
+    }
+
+    /** \brief Radius query the Hamming cube.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param radius              - find a point within r with query, see 'Metric::radius_threshold()'
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param results_idxs        - indices of Q points, where Eucl(point[i], query[i]) <= r
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+      * @param stats               - optional statistics of the Q queries (to be populated)
+    */
+    void radius_query(const std::vector<T>& query, const int Q, const float radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs, const int threads_no = std::thread::hardware_concurrency(),
+      std::vector<QueryStats>* stats = NULL) const
+    {
+      results_idxs.resize(Q);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<int> query_keys((size_t)Q * K);
+      std::vector<float> query_fractions(probing == MARGIN_PROBING ? (size_t)Q * K : 0);
+      std::vector<QueryStats> collected;
+      std::vector<QueryStats>* query_stats = statistics_of(Q, stats, collected);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads_no, query_stats);
+      const int threads = workers->size(threads_no);
+      workers->parallel_for(0, Q, query_chunk(Q, threads), [&](const int q_start, const int q_end)
       {
-        //std::cout << "Query no. " << q << std::endl;
-        results_idxs[q] = H[K - 1].radius_query(std::string(mapped_query.begin() + q * K, mapped_query.begin() + (q + 1) * K), radius, K, MAX_PNTS_TO_SEARCH, pointset.begin(), query.begin() + q * D);
-        //std::cout << "Query no. " << q << " completed" << std::endl;
-      }*/
+        execute_radius_queries(query, query_keys, query_fractions, q_start, q_end, radius, MAX_PNTS_TO_SEARCH, results_idxs, query_stats);
+      }, threads);
     }
 
     /** \brief Execute specified portion of Radius Queries.
-      * Helper function for the Constructor in a parallel environment.
+      * Helper function for 'radius_query()' in a parallel environment.
       *
-      * @param H                    - vector of Hash Functions
       * @param query                - vector of all queries
-      * @param mapped query         - vector of all (to be) mapped queries
+      * @param query_keys           - Q x K keys of all queries
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, with MARGIN_PROBING
       * @param q_start              - starting index of query to execute
       * @param q_end                - ending index of query to execute
-      * @param K                    - dimension of Hypercube
-      * @param D                    - dimension of original points and queries
-      * @param pointset             - original points
       * @param radius               - radius to query with
       * @param MAX_PNTS_TO_SEARCH   - threshold when searching
       * @param results_idxs         - The index of the point-answer in i-th posistion, for i-th query, -1 if not found.
+      * @param stats                - statistics of all queries, or NULL
     */
-    static void execute_radius_queries(std::vector<StableHashFunction<T>>& H, const std::vector<T>& query, std::vector<bitT>& mapped_query, const int q_start, const int q_end, const int K, const int D, const std::vector<T>& pointset, const int radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs)
+    void execute_radius_queries(const std::vector<T>& query, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int q_start, const int q_end, const float radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs,
+      std::vector<QueryStats>* stats) const
     {
+      typedef const T* iterator;
+      const PointsetView<T> candidates = points();
+      const std::vector<vertex_t> sub_queries = map_sub_queries(query.data() + (size_t)q_start * D, q_end - q_start);
       for(int q = q_start; q < q_end; ++q)
       {
-        for(int k = 0; k < K; ++k)
+        QueryStats* query_stats = stats ? &(*stats)[q] : NULL;
+        QueryTimer timer(query_stats);
+        QueryRecorder recorder(query_stats);
+        const vertex_t vertex = map_query(&query_keys[(size_t)q * K]);
+        const vertex_t sub_query = sub_queries.empty() ? NO_SUB_VERTEX : sub_queries[q - q_start];
+        timer.mapped();
+        if(quantized)
         {
-          H[k].assign_random_bit_query((std::begin(query) + q * D), (std::begin(mapped_query) + q * K), k);
+          QuantizedCandidateChecker<T, iterator> checker(*quantized, candidates.data(), query.data() + (size_t)q * D, D, rerank, Metric::radius_threshold(radius), candidates.stride());
+          results_idxs[q] = probe_radius(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
         }
-        results_idxs[q] = H[K - 1].radius_query(std::string(mapped_query.begin() + q * K, mapped_query.begin() + (q + 1) * K), radius, K, MAX_PNTS_TO_SEARCH, pointset.begin(), query.begin() + q * D);
+        else
+        {
+          ExactCandidateChecker<iterator, Metric> checker(candidates.data(), query.data() + (size_t)q * D, D, Metric::radius_threshold(radius), candidates.stride());
+          results_idxs[q] = probe_radius(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+        }
+        timer.probed();
+        results_idxs[q] = original_index(results_idxs[q]);
       }
+      collect(stats, q_start, q_end);
     }
 
     /** \brief Nearest Neighbor query in the Hamming cube.
@@ -198,73 +1173,253 @@ namespace Dolphinn
       * @param Q                   - number of queries
       * @param MAX_PNTS_TO_SEARCH  - threshold
       * @param results_idxs_dists  - indices and distances of Q points, where the (Approximate) Nearest Neighbors are stored.
-      * @param threads_no          - number of threads to be created. Default value is 'std::thread::hardware_concurrency()'.
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+      * @param stats               - optional statistics of the Q queries (to be populated)
+    */
+    void nearest_neighbor_query(const std::vector<T>& query, const int Q, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = std::thread::hardware_concurrency(),
+      std::vector<QueryStats>* stats = NULL) const
+    {
+      results_idxs_dists.resize(Q);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<int> query_keys((size_t)Q * K);
+      std::vector<float> query_fractions(probing == MARGIN_PROBING ? (size_t)Q * K : 0);
+      std::vector<QueryStats> collected;
+      std::vector<QueryStats>* query_stats = statistics_of(Q, stats, collected);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads_no, query_stats);
+      const int threads = workers->size(threads_no);
+      workers->parallel_for(0, Q, query_chunk(Q, threads), [&](const int q_start, const int q_end)
+      {
+        execute_nearest_neighbor_queries(query, query_keys, query_fractions, q_start, q_end, MAX_PNTS_TO_SEARCH, results_idxs_dists, query_stats);
+      }, threads);
+    }
+
+    /** \brief Execute specified portion of Nearest Neighbor Queries.
+      * Helper function for 'nearest_neighbor_query()' in a parallel environment.
+      *
+      * @param query                - vector of all queries
+      * @param query_keys           - Q x K keys of all queries
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, with MARGIN_PROBING
+      * @param q_start              - starting index of query to execute
+      * @param q_end                - ending index of query to execute
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param results_idxs_dists  - indices and distances of Q points, where the (Approximate) Nearest Neighbors are stored.
+      * @param stats               - statistics of all queries, or NULL
     */
-    void nearest_neighbor_query(const std::vector<T>& query, const int Q, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = std::thread::hardware_concurrency())
+    void execute_nearest_neighbor_queries(const std::vector<T>& query, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int q_start, const int q_end, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists,
+      std::vector<QueryStats>* stats) const
     {
-      std::vector<bitT> mapped_query(Q * K);
-      if(threads_no == 1)
+      typedef const T* iterator;
+      const PointsetView<T> candidates = points();
+      const std::vector<vertex_t> sub_queries = map_sub_queries(query.data() + (size_t)q_start * D, q_end - q_start);
+      for(int q = q_start; q < q_end; ++q)
       {
-        for(int q = 0; q < Q; ++q)
+        QueryStats* query_stats = stats ? &(*stats)[q] : NULL;
+        QueryTimer timer(query_stats);
+        QueryRecorder recorder(query_stats);
+        const vertex_t vertex = map_query(&query_keys[(size_t)q * K]);
+        const vertex_t sub_query = sub_queries.empty() ? NO_SUB_VERTEX : sub_queries[q - q_start];
+        timer.mapped();
+        if(quantized)
         {
-          for(int k = 0; k < K; ++k)
-          {
-            H[k].assign_random_bit_query((std::begin(query) + q * D), (std::begin(mapped_query) + q * K), k);
-          }
-          results_idxs_dists[q] = H[K - 1].nearest_neighbor_query(std::string(mapped_query.begin() + q * K, mapped_query.begin() + (q + 1) * K), K, MAX_PNTS_TO_SEARCH, pointset.begin(), query.begin() + q * D);
+          QuantizedCandidateChecker<T, iterator> checker(*quantized, candidates.data(), query.data() + (size_t)q * D, D, rerank, 0, candidates.stride());
+          probe_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+          results_idxs_dists[q] = checker.nearest_neighbor_result();
         }
+        else
+        {
+          ExactCandidateChecker<iterator, Metric> checker(candidates.data(), query.data() + (size_t)q * D, D, 0, candidates.stride());
+          probe_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+          results_idxs_dists[q] = checker.nearest_neighbor_result();
+        }
+        timer.probed();
+        results_idxs_dists[q].first = original_index(results_idxs_dists[q].first);
       }
-      else
-      {
-        std::vector<std::thread> threads;
+      collect(stats, q_start, q_end);
+    }
 
-        const int batch = Q/threads_no;
-        //std::cout << "subvector_size = " << subvector_size << std::endl;
-        for (int i = 0; i < threads_no - 1; ++i)
-          threads.push_back(std::thread(execute_nearest_neighbor_queries, std::ref(H), std::ref(query), std::ref(mapped_query), i * batch, (i + 1) * batch, K, D, std::ref(pointset), MAX_PNTS_TO_SEARCH, std::ref(results_idxs_dists)));
-        threads.push_back(std::thread(execute_nearest_neighbor_queries, std::ref(H), std::ref(query), std::ref(mapped_query), (threads_no - 1) * batch, Q, K, D, std::ref(pointset), MAX_PNTS_TO_SEARCH, std::ref(results_idxs_dists)));
-    
-        for (auto& th : threads)
-          th.join();
-      }
+    /** \brief k Nearest Neighbors query in the Hamming cube.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param k                   - number of neighbors per query
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param results_idxs_dists  - Q x k indices and squared distances, the neighbors of the i-th query, closest first,
+      *                              are at [i * k, (i + 1) * k). (-1, 1000000.0) where fewer than k points were checked.
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+      * @param stats               - optional statistics of the Q queries (to be populated)
+    */
+    void knn_query(const std::vector<T>& query, const int Q, const int k, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = std::thread::hardware_concurrency(),
+      std::vector<QueryStats>* stats = NULL) const
+    {
+      results_idxs_dists.resize((size_t)Q * k);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<int> query_keys((size_t)Q * K);
+      std::vector<float> query_fractions(probing == MARGIN_PROBING ? (size_t)Q * K : 0);
+      std::vector<QueryStats> collected;
+      std::vector<QueryStats>* query_stats = statistics_of(Q, stats, collected);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads_no, query_stats);
+      const int threads = workers->size(threads_no);
+      workers->parallel_for(0, Q, query_chunk(Q, threads), [&](const int q_start, const int q_end)
+      {
+        execute_knn_queries(query, query_keys, query_fractions, q_start, q_end, k, MAX_PNTS_TO_SEARCH, results_idxs_dists, query_stats);
+      }, threads);
     }
 
-    /** \brief Execute specified portion of Nearest Neighbor Queries.
-      * Helper function for the Constructor in a parallel environment.
+    /** \brief Execute specified portion of k Nearest Neighbors Queries.
+      * Helper function for 'knn_query()' in a parallel environment.
       *
-      * @param H                    - vector of Hash Functions
       * @param query                - vector of all queries
-      * @param mapped query         - vector of all (to be) mapped queries
+      * @param query_keys           - Q x K keys of all queries
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, with MARGIN_PROBING
       * @param q_start              - starting index of query to execute
       * @param q_end                - ending index of query to execute
-      * @param K                    - dimension of Hypercube
-      * @param D                    - dimension of original points and queries
-      * @param pointset             - original points
+      * @param k                    - number of neighbors per query
       * @param MAX_PNTS_TO_SEARCH   - threshold when searching
-      * @param results_idxs_dists  - indices and distances of Q points, where the (Approximate) Nearest Neighbors are stored.
+      * @param results_idxs_dists   - Q x k indices and squared distances of the neighbors
+      * @param stats                - statistics of all queries, or NULL
     */
-    static void execute_nearest_neighbor_queries(std::vector<StableHashFunction<T>>& H, const std::vector<T>& query, std::vector<bitT>& mapped_query, const int q_start, const int q_end, const int K, const int D, const std::vector<T>& pointset, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists)
+    void execute_knn_queries(const std::vector<T>& query, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int q_start, const int q_end, const int k, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists,
+      std::vector<QueryStats>* stats) const
     {
+      typedef const T* iterator;
+      const PointsetView<T> candidates = points();
+      const std::vector<vertex_t> sub_queries = map_sub_queries(query.data() + (size_t)q_start * D, q_end - q_start);
       for(int q = q_start; q < q_end; ++q)
       {
-        for(int k = 0; k < K; ++k)
+        QueryStats* query_stats = stats ? &(*stats)[q] : NULL;
+        QueryTimer timer(query_stats);
+        QueryRecorder recorder(query_stats);
+        const vertex_t vertex = map_query(&query_keys[(size_t)q * K]);
+        const vertex_t sub_query = sub_queries.empty() ? NO_SUB_VERTEX : sub_queries[q - q_start];
+        timer.mapped();
+        std::pair<int, float>* neighbors = &results_idxs_dists[(size_t)q * k];
+        if(quantized)
+        {
+          QuantizedCandidateChecker<T, iterator> checker(*quantized, candidates.data(), query.data() + (size_t)q * D, D, std::max(rerank, k), 0, candidates.stride());
+          probe_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+          checker.nearest_neighbors_result(k, neighbors);
+        }
+        else
         {
-          H[k].assign_random_bit_query((std::begin(query) + q * D), (std::begin(mapped_query) + q * K), k);
+          KNearestCandidateChecker<iterator, Metric> checker(candidates.data(), query.data() + (size_t)q * D, D, k, candidates.stride());
+          probe_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+          checker.nearest_neighbors_result(k, neighbors);
         }
-        results_idxs_dists[q] = H[K - 1].nearest_neighbor_query(std::string(mapped_query.begin() + q * K, mapped_query.begin() + (q + 1) * K), K, MAX_PNTS_TO_SEARCH, pointset.begin(), query.begin() + q * D);
+        timer.probed();
+        for(int i = 0; i < k; ++i)
+          neighbors[i].first = original_index(neighbors[i].first);
       }
+      collect(stats, q_start, q_end);
+    }
+
+    /** \brief Radius query the Hamming cube for one query, probing in the order set by 'set_probing()'.
+      * Erased points are skipped.
+      *
+      * @param vertex               - vertex of the mapped query
+      * @param sub_query            - vertex of the query on the sub-cubes of 'split()', or NO_SUB_VERTEX
+      * @param q                    - index of the query
+      * @param query_keys           - Q x K keys of all queries
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, with MARGIN_PROBING
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param checker              - checks the candidate points
+      * @param recorder             - records the walk, see QueryRecorder
+      * @return                     - index of a row of 'points()' within the radius, or -1
+    */
+    template <typename Checker, typename Recorder>
+    int probe_radius(const vertex_t vertex, const vertex_t sub_query, const int q, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int MAX_PNTS_TO_SEARCH, Checker& checker,
+      Recorder& recorder) const
+    {
+      if(erased_no)
+      {
+        ErasedPointsFilter<Checker> live(checker, erased.data());
+        return walk_radius(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, live, recorder);
+      }
+      return walk_radius(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+    }
+
+    /** \brief Radius query the Hamming cube for one query, see 'probe_radius()', without skipping erased points.
+    */
+    template <typename Checker, typename Recorder>
+    int walk_radius(const vertex_t vertex, const vertex_t sub_query, const int q, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int MAX_PNTS_TO_SEARCH, Checker& checker,
+      Recorder& recorder) const
+    {
+      if(probing == MARGIN_PROBING)
+      {
+        std::vector<float> scores(K);
+        margin_scores(&query_keys[(size_t)q * K], &query_fractions[(size_t)q * K], scores.data());
+        MarginProber prober(scores.data(), K);
+        return H[K - 1].radius_query(vertex, sub_query, prober, MAX_PNTS_TO_SEARCH, checker, recorder);
+      }
+      HammingProber prober(H[K - 1].get_probe_masks());
+      return H[K - 1].radius_query(vertex, sub_query, prober, MAX_PNTS_TO_SEARCH, checker, recorder);
+    }
+
+    /** \brief Hand the candidates of a (k) Nearest Neighbor query to the checker, probing in the order set by 'set_probing()'.
+      * Erased points are skipped.
+      *
+      * @param vertex               - vertex of the mapped query
+      * @param sub_query            - vertex of the query on the sub-cubes of 'split()', or NO_SUB_VERTEX
+      * @param q                    - index of the query
+      * @param query_keys           - Q x K keys of all queries
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, with MARGIN_PROBING
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param checker              - checks the candidate points and keeps the best
+      * @param recorder             - records the walk, see QueryRecorder
+    */
+    template <typename Checker, typename Recorder>
+    void probe_nearest_neighbors(const vertex_t vertex, const vertex_t sub_query, const int q, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int MAX_PNTS_TO_SEARCH, Checker& checker,
+      Recorder& recorder) const
+    {
+      if(erased_no)
+      {
+        ErasedPointsFilter<Checker> live(checker, erased.data());
+        walk_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, live, recorder);
+        return;
+      }
+      walk_nearest_neighbors(vertex, sub_query, q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, checker, recorder);
+    }
+
+    /** \brief Hand the candidates of a (k) Nearest Neighbor query to the checker, see 'probe_nearest_neighbors()',
+      * without skipping erased points.
+    */
+    template <typename Checker, typename Recorder>
+    void walk_nearest_neighbors(const vertex_t vertex, const vertex_t sub_query, const int q, const std::vector<int>& query_keys, const std::vector<float>& query_fractions, const int MAX_PNTS_TO_SEARCH, Checker& checker,
+      Recorder& recorder) const
+    {
+      if(probing == MARGIN_PROBING)
+      {
+        std::vector<float> scores(K);
+        margin_scores(&query_keys[(size_t)q * K], &query_fractions[(size_t)q * K], scores.data());
+        MarginProber prober(scores.data(), K);
+        H[K - 1].nearest_neighbors_query(vertex, sub_query, prober, MAX_PNTS_TO_SEARCH, checker, recorder);
+        return;
+      }
+      HammingProber prober(H[K - 1].get_probe_masks());
+      H[K - 1].nearest_neighbors_query(vertex, sub_query, prober, MAX_PNTS_TO_SEARCH, checker, recorder);
     }
 
     /** \brief Print how many points are assigned to every vertex.
       * Empty vertices (if any) are not printed (because we do not store them).
       *
     */
-    void print_no_of_assigned_points_per_vertex()
+    void print_no_of_assigned_points_per_vertex() const
     {
       H[K - 1].print_hashtable_cube();
     }
 
   };
+
+  /**
+   * A Hypercube on points of a dimension 'D' known at compile time, e.g. FixedHypercube<float, char, 128>:
+   * distances and projections use loops of constant bounds, see FixedDimension of metric.h.
+   */
+  template <typename T, typename bitT, int D, typename Metric = L2Metric>
+  using FixedHypercube = Hypercube<T, bitT, FixedDimension<Metric, D>>;
+
+  template <typename T, typename bitT, typename Metric>
+  const uint64_t Hypercube<T, bitT, Metric>::MAGIC;
+  template <typename T, typename bitT, typename Metric>
+  const uint32_t Hypercube<T, bitT, Metric>::VERSION;
 }
 
 #endif /* HYPERCUBE_H */
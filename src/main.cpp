@@ -3,6 +3,7 @@
 
 #include "IO.h"
 #include "hypercube.h"
+#include "exact_search.h"
 
 #include <ctime>
 #include <ratio>
@@ -32,7 +33,12 @@ int main()
 
   	std::cout << "N = " << N << ", D = " << D << ", K = " << K << ", MAX_PNTS_TO_SEARCH = " << MAX_PNTS_TO_SEARCH << std::endl;
 
-  	read_points_IDX_format<T>(pointset, N, D, "/Users/gsamaras/Code/C++/create_pointset/MNIST/train-images-idx3-ubyte");
+  	std::string error;
+  	if(!read_points_IDX_format<T>(pointset, N, D, "/Users/gsamaras/Code/C++/create_pointset/MNIST/train-images-idx3-ubyte", &error))
+  	{
+    	std::cerr << error << std::endl;
+    	return -1;
+  	}
 
 	//print_2D_vector<T>(pointset, N, D);
 
@@ -55,7 +61,11 @@ int main()
 	
   	// QUERY
   	std::vector<T> query(Q * D);
-  	read_points_IDX_format<T>(query, Q, D, "/Users/gsamaras/Code/C++/create_pointset/MNIST/t10k-images-idx3-ubyte");
+  	if(!read_points_IDX_format<T>(query, Q, D, "/Users/gsamaras/Code/C++/create_pointset/MNIST/t10k-images-idx3-ubyte", &error))
+  	{
+    	std::cerr << error << std::endl;
+    	return -1;
+  	}
 
  
   	std::vector<int> results_idxs(Q);
@@ -71,23 +81,8 @@ int main()
 
   	t1 = high_resolution_clock::now();
 
-  	int squared_radius = RADIUS * RADIUS;
   	std::vector<int> brute_results_idxs(Q);
-  	for(int q = 0; q < Q; ++q)
-  	{
-    	    for(int n = 0; n < N; ++n)
-    	    {
-      		if(squared_Eucl_distance(query.begin() + q * D, (query.begin() + q * D) + D, pointset.begin() + n * D) <= squared_radius)
-      		{
-        		brute_results_idxs[q] = q;
-        		break;
-      		}
-      		else
-      		{
-        		brute_results_idxs[q] = -1;
-    		}
-    	    }
-  	}
+  	exact_radius(PointsetView<T>(pointset, D), PointsetView<T>(query, D), RADIUS, brute_results_idxs, THREADS_NO);
 
   	t2 = high_resolution_clock::now();
   	time_span = duration_cast<duration<double>>(t2 - t1);
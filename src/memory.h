@@ -2,6 +2,19 @@
 #define MEMORY_H
 
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <string>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /** \brief Resize 2D vector.
  *
@@ -18,4 +31,192 @@ void resize_2D_vector(std::vector<T>& v, int N, int D)
   v.resize(N * D);
 }
 
-#endif /*MEMORY_H*/
\ No newline at end of file
+/** \brief Allocator that aligns every allocation to 'Alignment' bytes,
+ * so that rows of a matrix can be loaded with aligned vector instructions.
+ * 'Alignment' must be a power of 2.
+ */
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator
+{
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind
+  {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() {}
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(std::size_t n)
+  {
+    // over-allocate and remember the original pointer right before the aligned block
+    void* raw = ::operator new(n * sizeof(T) + Alignment + sizeof(void*));
+    std::uintptr_t aligned = ((std::uintptr_t)raw + sizeof(void*) + Alignment - 1) & ~(std::uintptr_t)(Alignment - 1);
+    ((void**)aligned)[-1] = raw;
+    return (T*)aligned;
+  }
+
+  void deallocate(T* p, std::size_t)
+  {
+    ::operator delete(((void**)p)[-1]);
+  }
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+/**
+ * An array that either owns its elements, or views elements that live elsewhere,
+ * e.g. in a MappedFile. Writing through 'vector()' makes a viewed array owned.
+ */
+template <typename V, typename Allocator = std::allocator<V>>
+class Buffer
+{
+    std::vector<V, Allocator> owned;
+    // the viewed elements, NULL if the array is owned
+    const V* viewed;
+    size_t viewed_size;
+  public:
+    Buffer()
+      : viewed(NULL), viewed_size(0)
+    {}
+
+    Buffer(const size_t n, const V& value)
+      : owned(n, value), viewed(NULL), viewed_size(0)
+    {}
+
+    /** \brief The elements, to be modified. Copies them, if they are viewed.
+     *
+     * @return - the vector that owns the elements
+     */
+    std::vector<V, Allocator>& vector()
+    {
+      if(viewed)
+      {
+        owned.assign(viewed, viewed + viewed_size);
+        viewed = NULL;
+        viewed_size = 0;
+      }
+      return owned;
+    }
+
+    /** \brief View elements that live elsewhere, and free the owned ones.
+     *
+     * @param data  - the elements, which must outlive the array (or the next call to 'vector()')
+     * @param n     - number of elements
+     */
+    void view(const V* data, const size_t n)
+    {
+      std::vector<V, Allocator>().swap(owned);
+      viewed = data;
+      viewed_size = n;
+    }
+
+    /** \brief Own the given elements, and stop viewing any.
+     *
+     * @param elements  - the elements, moved into the array
+     */
+    void assign(std::vector<V, Allocator>&& elements)
+    {
+      owned = std::move(elements);
+      viewed = NULL;
+      viewed_size = 0;
+    }
+
+    const V* data() const { return viewed ? viewed : owned.data(); }
+    size_t size() const { return viewed ? viewed_size : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const V& operator[](const size_t i) const { return data()[i]; }
+    const V* begin() const { return data(); }
+    const V* end() const { return data() + size(); }
+};
+
+/**
+ * A file mapped read-only in memory. Unmapped on destruction.
+ */
+class MappedFile
+{
+    const char* mapped;
+    size_t mapped_size;
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+  public:
+    /** \brief Constructor that maps the file. Check 'is_open()' afterwards.
+     *
+     * @param path  - path of the file
+     */
+    explicit MappedFile(const std::string& path)
+      : mapped(NULL), mapped_size(0)
+    {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if(fd < 0)
+        return;
+      struct stat status;
+      if(::fstat(fd, &status) == 0 && status.st_size > 0)
+      {
+        void* address = ::mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(address != MAP_FAILED)
+        {
+          mapped = (const char*)address;
+          mapped_size = status.st_size;
+        }
+      }
+      ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+      if(mapped)
+        ::munmap((void*)mapped, mapped_size);
+    }
+
+    bool is_open() const { return mapped != NULL; }
+    const char* data() const { return mapped; }
+    size_t size() const { return mapped_size; }
+};
+
+/** \brief A memory field of /proc/self/status, on Linux: e.g. "VmRSS", the resident memory,
+ * or "VmHWM", its peak since the process started or since 'reset_peak_memory()'.
+ *
+ * @param field  - name of the field
+ * @return       - its value in kB, 0 if it could not be read
+ */
+inline size_t process_memory_kb(const char* field)
+{
+  FILE* status = std::fopen("/proc/self/status", "r");
+  if(!status)
+    return 0;
+  char line[256];
+  unsigned long long kb = 0;
+  const size_t length = std::strlen(field);
+  while(std::fgets(line, sizeof(line), status))
+    if(std::strncmp(line, field, length) == 0 && line[length] == ':')
+    {
+      std::sscanf(line + length + 1, "%llu", &kb);
+      break;
+    }
+  std::fclose(status);
+  return kb;
+}
+
+/** \brief Reset the peak resident memory of the process (VmHWM) to the current resident memory, on Linux.
+ *
+ * @return - false if it could not be reset, and VmHWM is still the peak since the process started
+ */
+inline bool reset_peak_memory()
+{
+  FILE* refs = std::fopen("/proc/self/clear_refs", "w");
+  if(!refs)
+    return false;
+  const bool reset = std::fputs("5", refs) >= 0;
+  return std::fclose(refs) == 0 && reset;
+}
+
+#endif /*MEMORY_H*/
@@ -0,0 +1,247 @@
+#ifndef METRIC_H
+#define METRIC_H
+
+#include <vector>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+#include <cmath>
+
+#include "Euclidean_dist_simd.h"
+
+/**
+ * Metrics of the Hypercube, see 'Hypercube<T, bitT, Metric>'. A metric gives the distance the
+ * candidates of a query are checked with, smaller is closer, and the family of the hash functions
+ * that map the points to the Hamming cube:
+ *  - L2Metric: squared Euclidean distance; Gaussian (2-stable) projections cut in windows of 'r',
+ *    and a random bit per key.
+ *  - L1Metric: Manhattan distance; Cauchy (1-stable) projections, likewise.
+ *  - InnerProductMetric: minus the inner product, and CosineMetric: 1 - cosine similarity; random
+ *    hyperplanes (SimHash), where the bit of a point is the sign of its projection, so no window
+ *    and no table of bits are needed.
+ * Distances of float rows use the vectorized kernels of Euclidean_dist_simd.h. FixedDimension
+ * turns a metric into one of points of a dimension known at compile time.
+ */
+
+enum ProjectionFamily
+{
+  // floor((a * v + b) / r), 'a' drawn from the normal distribution
+  GAUSSIAN_PROJECTION,
+  // floor((a * v + b) / r), 'a' drawn from the Cauchy distribution
+  CAUCHY_PROJECTION,
+  // 1 if a * v >= 0, else 0
+  SIGN_PROJECTION
+};
+
+/** \brief True if 'iterator' walks a contiguous array of float, int or uint8_t,
+ * for which Euclidean_dist_simd.h has a vectorized kernel.
+ */
+template <typename iterator>
+struct has_simd_distance
+{
+  typedef typename std::remove_cv<typename std::iterator_traits<iterator>::value_type>::type value_type;
+  static const bool value =
+    (std::is_same<value_type, float>::value || std::is_same<value_type, int>::value || std::is_same<value_type, uint8_t>::value) &&
+    (std::is_pointer<iterator>::value || std::is_same<iterator, typename std::vector<value_type>::iterator>::value ||
+      std::is_same<iterator, typename std::vector<value_type>::const_iterator>::value);
+};
+
+/** \brief Euclidean distance squared, computed one coordinate at a time.
+ * Works for any iterator and element type.
+ *
+ * @param it1       - first point
+ * @param it1_end   - end of first point
+ * @param it2       - second point
+ * @return          - the Euclidean distance of p1-p2
+ */
+template<typename iterator>
+float squared_Eucl_distance_scalar(iterator it1, iterator it1_end, iterator it2)
+{
+  float squared_distance = 0.;
+  float diff;
+  for (; it1 < it1_end; ++it1, ++it2)
+  {
+    diff = *it1 - *it2;
+    squared_distance += diff * diff;
+  }
+  return squared_distance;
+}
+
+template<typename Metric, typename iterator>
+float metric_distance(iterator it1, iterator it1_end, iterator it2, std::true_type)
+{
+  const int D = it1_end - it1;
+  return D ? Metric::kernel(&*it1, &*it2, D) : Metric::scalar(it1, it1_end, it2);
+}
+
+template<typename Metric, typename iterator>
+float metric_distance(iterator it1, iterator it1_end, iterator it2, std::false_type)
+{
+  return Metric::scalar(it1, it1_end, it2);
+}
+
+/** \brief Distance of two points under a metric. Uses the metric's kernel on
+ * contiguous rows, and its scalar loop for any other iterator.
+ *
+ * @param it1       - first point
+ * @param it1_end   - end of first point
+ * @param it2       - second point
+ * @return          - the distance
+ */
+template<typename Metric, typename iterator>
+float metric_distance(iterator it1, iterator it1_end, iterator it2)
+{
+  return metric_distance<Metric>(it1, it1_end, it2, std::integral_constant<bool, has_simd_distance<iterator>::value>());
+}
+
+/**
+ * Squared Euclidean distance. Radii are compared with their square.
+ */
+struct L2Metric
+{
+  static const ProjectionFamily FAMILY = GAUSSIAN_PROJECTION;
+  // stored in saved Hypercubes
+  static const uint32_t ID = 0;
+  // dimension of the points, 0 if it is known only at run time, see FixedDimension
+  static const int DIMENSION = 0;
+
+  template <typename V>
+  static float kernel(const V* a, const V* b, const int D) { return squared_distance_simd(a, b, D); }
+
+  template <typename iterator>
+  static float scalar(iterator it1, iterator it1_end, iterator it2) { return squared_Eucl_distance_scalar(it1, it1_end, it2); }
+
+  template <int D, typename V>
+  static float fixed_kernel(const V* a, const V* b) { return squared_distance_fixed<D>(a, b); }
+
+  template <typename iterator>
+  static float distance(iterator it1, iterator it1_end, iterator it2) { return metric_distance<L2Metric>(it1, it1_end, it2); }
+
+  /** \brief Largest distance of a point within a radius. */
+  static float radius_threshold(const float radius) { return radius * radius; }
+};
+
+/**
+ * Manhattan distance.
+ */
+struct L1Metric
+{
+  static const ProjectionFamily FAMILY = CAUCHY_PROJECTION;
+  static const uint32_t ID = 1;
+  static const int DIMENSION = 0;
+
+  template <typename V>
+  static float kernel(const V* a, const V* b, const int D) { return l1_distance_simd(a, b, D); }
+
+  template <typename iterator>
+  static float scalar(iterator it1, iterator it1_end, iterator it2)
+  {
+    float distance = 0.;
+    for(; it1 < it1_end; ++it1, ++it2)
+      distance += std::fabs((float)*it1 - (float)*it2);
+    return distance;
+  }
+
+  template <int D, typename V>
+  static float fixed_kernel(const V* a, const V* b) { return l1_distance_fixed<D>(a, b); }
+
+  template <typename iterator>
+  static float distance(iterator it1, iterator it1_end, iterator it2) { return metric_distance<L1Metric>(it1, it1_end, it2); }
+
+  static float radius_threshold(const float radius) { return radius; }
+};
+
+/**
+ * Maximum inner product search: the distance is minus the inner product, and a point is within
+ * 'radius' if its inner product with the query is at least 'radius'. The sign hash approximates
+ * the angle, so points of larger norm are found as well as their angle allows.
+ */
+struct InnerProductMetric
+{
+  static const ProjectionFamily FAMILY = SIGN_PROJECTION;
+  static const uint32_t ID = 2;
+  static const int DIMENSION = 0;
+
+  template <typename V>
+  static float kernel(const V* a, const V* b, const int D) { return -inner_product_simd(a, b, D); }
+
+  template <typename iterator>
+  static float scalar(iterator it1, iterator it1_end, iterator it2)
+  {
+    float product = 0.;
+    for(; it1 < it1_end; ++it1, ++it2)
+      product += (float)*it1 * *it2;
+    return -product;
+  }
+
+  template <int D, typename V>
+  static float fixed_kernel(const V* a, const V* b) { return -inner_product_fixed<D>(a, b); }
+
+  template <typename iterator>
+  static float distance(iterator it1, iterator it1_end, iterator it2) { return metric_distance<InnerProductMetric>(it1, it1_end, it2); }
+
+  static float radius_threshold(const float radius) { return -radius; }
+};
+
+/**
+ * Cosine distance, 1 - cosine similarity, in [0, 2]. The norms are computed with the inner
+ * product, in one pass, so points need not be normalized.
+ */
+struct CosineMetric
+{
+  static const ProjectionFamily FAMILY = SIGN_PROJECTION;
+  static const uint32_t ID = 3;
+  static const int DIMENSION = 0;
+
+  template <typename V>
+  static float kernel(const V* a, const V* b, const int D) { return cosine_distance_simd(a, b, D); }
+
+  template <typename iterator>
+  static float scalar(iterator it1, iterator it1_end, iterator it2)
+  {
+    float product = 0., norm_a = 0., norm_b = 0.;
+    for(; it1 < it1_end; ++it1, ++it2)
+    {
+      const float x = *it1, y = *it2;
+      product += x * y;
+      norm_a += x * x;
+      norm_b += y * y;
+    }
+    return cosine_distance_of(product, norm_a, norm_b);
+  }
+
+  template <int D, typename V>
+  static float fixed_kernel(const V* a, const V* b) { return cosine_distance_fixed<D>(a, b); }
+
+  template <typename iterator>
+  static float distance(iterator it1, iterator it1_end, iterator it2) { return metric_distance<CosineMetric>(it1, it1_end, it2); }
+
+  static float radius_threshold(const float radius) { return radius; }
+};
+
+/**
+ * A metric on points of a dimension 'D' known at compile time, e.g. FixedDimension<L2Metric, 128>.
+ * Its distances use kernels unrolled for that dimension, and the Hypercube projects the points with
+ * loops of constant bounds, see FixedHypercube of hypercube.h. Hypercubes refuse points of another
+ * dimension, and save and load like those of 'Metric'.
+ */
+template <typename Metric, int D>
+struct FixedDimension
+{
+  static const ProjectionFamily FAMILY = Metric::FAMILY;
+  static const uint32_t ID = Metric::ID;
+  static const int DIMENSION = D;
+
+  template <typename V>
+  static float kernel(const V* a, const V* b, const int) { return Metric::template fixed_kernel<D>(a, b); }
+
+  template <typename iterator>
+  static float scalar(iterator it1, iterator, iterator it2) { return Metric::scalar(it1, it1 + D, it2); }
+
+  template <typename iterator>
+  static float distance(iterator it1, iterator it1_end, iterator it2) { return metric_distance<FixedDimension>(it1, it1_end, it2); }
+
+  static float radius_threshold(const float radius) { return Metric::radius_threshold(radius); }
+};
+
+#endif /*METRIC_H*/
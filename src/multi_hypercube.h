@@ -0,0 +1,426 @@
+#ifndef MULTI_HYPERCUBE_H
+#define MULTI_HYPERCUBE_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#include "hypercube.h"
+
+namespace Dolphinn
+{
+  /**
+   * Points already checked by the current query. Every point is stamped with the
+   * query that checked it last, so moving to the next query does not clear the array.
+   * A thread keeps one set for all its queries, see 'of_thread()'.
+   */
+  class VisitedSet
+  {
+      std::vector<uint32_t> stamps;
+      uint32_t epoch;
+    public:
+    /** \brief Constructor.
+      *
+      * @param N  - number of points
+    */
+    explicit VisitedSet(const int N)
+      : stamps(N, 0), epoch(0)
+    {}
+
+    /** \brief The set of the calling thread, able to hold 'N' points. It outlives the
+      * queries, so that a thread pays for the array once.
+      *
+      * @param N  - number of points
+      * @return   - the set
+    */
+    static VisitedSet& of_thread(const int N)
+    {
+      static thread_local VisitedSet visited(0);
+      if((int)visited.stamps.size() < N)
+        visited.stamps.resize(N, 0);
+      return visited;
+    }
+
+    /** \brief Forget all points, before a new query.
+    */
+    void next_query()
+    {
+      if(++epoch == 0)
+      {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        epoch = 1;
+      }
+    }
+
+    /** \brief Mark a point as visited.
+      *
+      * @param point_idx  - index of the point
+      * @return           - false if the point was already visited by this query
+    */
+    bool insert(const int point_idx)
+    {
+      if(stamps[point_idx] == epoch)
+        return false;
+      stamps[point_idx] = epoch;
+      return true;
+    }
+  };
+
+  /**
+   * 'L' independent Hypercubes over the same pointset. A query probes the cubes in
+   * round-robin order, one vertex of every cube per round, under one budget of
+   * MAX_PNTS_TO_SEARCH points. A point found in more than one cube is checked once.
+   */
+  template <typename T, typename bitT>
+  class MultiHypercube
+  {
+    std::vector<std::unique_ptr<Hypercube<T, bitT>>> cubes;
+    // number of points
+    const int N;
+    // original dimension of points
+    const int D;
+    // dimension of every Hypercube
+    const int K;
+    // The N points, D coordinates each, which live elsewhere, e.g. in a vector or in a mapped file.
+    PointsetView<T> pointset;
+    // order in which queries probe the vertices of every cube, see 'set_probing()'
+    Probing probing;
+    // persistent threads of the queries, shared by the cubes
+    std::shared_ptr<ThreadPool> pool;
+    public:
+    /** \brief Constructor that builds 'L' independent Hypercubes, one after the other.
+      *
+      * @param pointset    - 1D vector of points, emulating a 2D, with N rows and D columns per row.
+      * @param N           - number of points
+      * @param D           - dimension of points
+      * @param K           - dimension of every Hypercube
+      * @param L           - number of Hypercubes
+      * @param threads_no  - number of threads used to build every Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+      * @param r           - parameter of Stable Distribution. Default value is 4.
+      * @param hashed_bits - derive the bit of every key from the key, see Hypercube. Default value is false.
+      * @param seed        - seed of the bits of the first Hypercube, when 'hashed_bits' is set. The l-th uses 'seed + l'. Default value is 0.
+    */
+    MultiHypercube(const std::vector<T>& pointset, const int N, const int D, const int K, const int L, const int threads_no = std::thread::hardware_concurrency(), const float r = 4,
+      const bool hashed_bits = false, const uint64_t seed = 0)
+      : MultiHypercube(PointsetView<T>(pointset.data(), N, D), K, L, threads_no, r, hashed_bits, seed)
+    {}
+
+    /** \brief Constructor over points that live elsewhere, e.g. in a file mapped by 'map_fvecs()'.
+      * The points are not copied, so they must outlive the Hypercubes.
+      *
+      * @param pointset    - the N points, D coordinates each
+      * @param K           - dimension of every Hypercube
+      * @param L           - number of Hypercubes
+      * @param threads_no  - number of threads used to build every Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+      * @param r           - parameter of Stable Distribution. Default value is 4.
+      * @param hashed_bits - derive the bit of every key from the key, see Hypercube. Default value is false.
+      * @param seed        - seed of the bits of the first Hypercube, when 'hashed_bits' is set. The l-th uses 'seed + l'. Default value is 0.
+    */
+    MultiHypercube(const PointsetView<T>& pointset, const int K, const int L, const int threads_no = std::thread::hardware_concurrency(), const float r = 4,
+      const bool hashed_bits = false, const uint64_t seed = 0)
+      : N(pointset.size()), D(pointset.dimension()), K(K), pointset(pointset), probing(HAMMING_PROBING)
+    {
+      // all the cubes are built on, and share, the threads of the first one
+      for(int l = 0; l < L; ++l)
+        cubes.push_back(std::unique_ptr<Hypercube<T, bitT>>(new Hypercube<T, bitT>(pointset, K, threads_no, r, hashed_bits, seed + l,
+          l ? cubes[0]->executor(threads_no) : nullptr)));
+      if(L)
+        set_thread_pool(cubes[0]->executor(threads_no));
+    }
+
+    /** \brief Set the order in which queries probe the vertices of every cube, see 'Hypercube::set_probing()'.
+      *
+      * @param mode  - HAMMING_PROBING (default) or MARGIN_PROBING
+    */
+    void set_probing(const Probing mode)
+    {
+      probing = mode;
+    }
+
+    /** \brief Run the queries, and the hashing of the queries on every cube, on the given threads.
+      * The 'threads_no' of the queries is ignored afterwards.
+      *
+      * @param threads  - the threads
+    */
+    void set_thread_pool(const std::shared_ptr<ThreadPool>& threads)
+    {
+      pool = threads;
+      for(auto& cube: cubes)
+        cube->set_thread_pool(threads);
+    }
+
+    /** \brief Radius query the Hypercubes.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param radius              - find a point within r with query
+      * @param MAX_PNTS_TO_SEARCH  - threshold, shared by all cubes
+      * @param results_idxs        - indices of Q points, where Eucl(point[i], query[i]) <= r
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+    */
+    void radius_query(const std::vector<T>& query, const int Q, const float radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs, const int threads_no = std::thread::hardware_concurrency()) const
+    {
+      results_idxs.resize(Q);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<std::vector<int>> query_keys;
+      std::vector<std::vector<float>> query_fractions;
+      const int threads = workers->size(threads_no);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads);
+      workers->parallel_for(0, Q, Hypercube<T, bitT>::query_chunk(Q, threads), [&](const int q_start, const int q_end)
+      {
+        execute_radius_queries(query, query_keys, query_fractions, q_start, q_end, radius, MAX_PNTS_TO_SEARCH, results_idxs);
+      }, threads);
+    }
+
+    /** \brief Execute specified portion of Radius Queries.
+      * Helper function for 'radius_query()' in a parallel environment.
+      *
+      * @param query                - vector of all queries
+      * @param query_keys           - Q x K keys of all queries, for every cube
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, for every cube, with MARGIN_PROBING
+      * @param q_start              - starting index of query to execute
+      * @param q_end                - ending index of query to execute
+      * @param radius               - radius to query with
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param results_idxs         - The index of the point-answer in i-th posistion, for i-th query, -1 if not found.
+    */
+    void execute_radius_queries(const std::vector<T>& query, const std::vector<std::vector<int>>& query_keys, const std::vector<std::vector<float>>& query_fractions, const int q_start, const int q_end, const float radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs) const
+    {
+      typedef const T* iterator;
+      VisitedSet& visited = VisitedSet::of_thread(N);
+      std::vector<int> candidates;
+      for(int q = q_start; q < q_end; ++q)
+      {
+        ExactCandidateChecker<iterator> checker(pointset.data(), query.data() + (size_t)q * D, D, L2Metric::radius_threshold(radius), pointset.stride());
+        results_idxs[q] = probe<true>(q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, visited, candidates, checker);
+      }
+    }
+
+    /** \brief Nearest Neighbor query in the Hypercubes.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param MAX_PNTS_TO_SEARCH  - threshold, shared by all cubes
+      * @param results_idxs_dists  - indices and distances of Q points, where the (Approximate) Nearest Neighbors are stored.
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+    */
+    void nearest_neighbor_query(const std::vector<T>& query, const int Q, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = std::thread::hardware_concurrency()) const
+    {
+      results_idxs_dists.resize(Q);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<std::vector<int>> query_keys;
+      std::vector<std::vector<float>> query_fractions;
+      const int threads = workers->size(threads_no);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads);
+      workers->parallel_for(0, Q, Hypercube<T, bitT>::query_chunk(Q, threads), [&](const int q_start, const int q_end)
+      {
+        execute_nearest_neighbor_queries(query, query_keys, query_fractions, q_start, q_end, MAX_PNTS_TO_SEARCH, results_idxs_dists);
+      }, threads);
+    }
+
+    /** \brief Execute specified portion of Nearest Neighbor Queries.
+      * Helper function for 'nearest_neighbor_query()' in a parallel environment.
+      *
+      * @param query                - vector of all queries
+      * @param query_keys           - Q x K keys of all queries, for every cube
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, for every cube, with MARGIN_PROBING
+      * @param q_start              - starting index of query to execute
+      * @param q_end                - ending index of query to execute
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param results_idxs_dists   - indices and distances of Q points, where the (Approximate) Nearest Neighbors are stored.
+    */
+    void execute_nearest_neighbor_queries(const std::vector<T>& query, const std::vector<std::vector<int>>& query_keys, const std::vector<std::vector<float>>& query_fractions, const int q_start, const int q_end, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists) const
+    {
+      typedef const T* iterator;
+      VisitedSet& visited = VisitedSet::of_thread(N);
+      std::vector<int> candidates;
+      for(int q = q_start; q < q_end; ++q)
+      {
+        ExactCandidateChecker<iterator> checker(pointset.data(), query.data() + (size_t)q * D, D, 0, pointset.stride());
+        probe<false>(q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, visited, candidates, checker);
+        results_idxs_dists[q] = checker.nearest_neighbor_result();
+      }
+    }
+
+    /** \brief k Nearest Neighbors query in the Hypercubes.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param k                   - number of neighbors per query
+      * @param MAX_PNTS_TO_SEARCH  - threshold, shared by all cubes
+      * @param results_idxs_dists  - Q x k indices and squared distances, see 'Hypercube::knn_query()'
+      * @param threads_no          - number of threads that run the queries, see 'executor()'. Default value is 'std::thread::hardware_concurrency()'.
+    */
+    void knn_query(const std::vector<T>& query, const int Q, const int k, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = std::thread::hardware_concurrency()) const
+    {
+      results_idxs_dists.resize((size_t)Q * k);
+      std::shared_ptr<ThreadPool> workers = executor(threads_no);
+      std::vector<std::vector<int>> query_keys;
+      std::vector<std::vector<float>> query_fractions;
+      const int threads = workers->size(threads_no);
+      hash_queries(query, Q, query_keys, query_fractions, *workers, threads);
+      workers->parallel_for(0, Q, Hypercube<T, bitT>::query_chunk(Q, threads), [&](const int q_start, const int q_end)
+      {
+        execute_knn_queries(query, query_keys, query_fractions, q_start, q_end, k, MAX_PNTS_TO_SEARCH, results_idxs_dists);
+      }, threads);
+    }
+
+    /** \brief Execute specified portion of k Nearest Neighbors Queries.
+      * Helper function for 'knn_query()' in a parallel environment.
+      *
+      * @param query                - vector of all queries
+      * @param query_keys           - Q x K keys of all queries, for every cube
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, for every cube, with MARGIN_PROBING
+      * @param q_start              - starting index of query to execute
+      * @param q_end                - ending index of query to execute
+      * @param k                    - number of neighbors per query
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param results_idxs_dists   - Q x k indices and squared distances of the neighbors
+    */
+    void execute_knn_queries(const std::vector<T>& query, const std::vector<std::vector<int>>& query_keys, const std::vector<std::vector<float>>& query_fractions, const int q_start, const int q_end, const int k, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists) const
+    {
+      typedef const T* iterator;
+      VisitedSet& visited = VisitedSet::of_thread(N);
+      std::vector<int> candidates;
+      for(int q = q_start; q < q_end; ++q)
+      {
+        KNearestCandidateChecker<iterator> checker(pointset.data(), query.data() + (size_t)q * D, D, k, pointset.stride());
+        probe<false>(q, query_keys, query_fractions, MAX_PNTS_TO_SEARCH, visited, candidates, checker);
+        checker.nearest_neighbors_result(k, &results_idxs_dists[(size_t)q * k]);
+      }
+    }
+
+    /** \brief The threads that run the queries: those of 'set_thread_pool()', if set, or new ones.
+      *
+      * @param threads_no  - number of threads, when there are none set
+      * @return            - the threads
+    */
+    std::shared_ptr<ThreadPool> executor(const int threads_no) const
+    {
+      return pool ? pool : std::make_shared<ThreadPool>(threads_no);
+    }
+
+    /** \brief Compute the keys of the queries for every cube.
+      *
+      * @param query            - vector of queries
+      * @param Q                - number of queries
+      * @param query_keys       - Q x K keys of all queries, for every cube (to be populated)
+      * @param query_fractions  - Q x K positions of the projections in their buckets, for every cube, with MARGIN_PROBING (to be populated)
+      * @param workers          - threads that hash the queries
+      * @param threads_no       - most threads of 'workers' that run, see 'ThreadPool::size()'
+    */
+    void hash_queries(const std::vector<T>& query, const int Q, std::vector<std::vector<int>>& query_keys, std::vector<std::vector<float>>& query_fractions, ThreadPool& workers,
+      const int threads_no) const
+    {
+      query_keys.assign(cubes.size(), std::vector<int>((size_t)Q * K));
+      query_fractions.assign(cubes.size(), std::vector<float>(probing == MARGIN_PROBING ? (size_t)Q * K : 0));
+      for(size_t l = 0; l < cubes.size(); ++l)
+        cubes[l]->hash_pointset(PointsetView<T>(query.data(), Q, D), query_keys[l], workers, query_fractions[l].empty() ? NULL : query_fractions[l].data(), threads_no);
+    }
+
+    /** \brief Hand the candidates of one query to the checker, probing in the order set by 'set_probing()'.
+      * Radius queries ('RADIUS_QUERY') stop at the first point within the radius, the others keep the best.
+      *
+      * @param q                    - index of the query
+      * @param query_keys           - Q x K keys of all queries, for every cube
+      * @param query_fractions      - Q x K positions of the projections of all queries in their buckets, for every cube, with MARGIN_PROBING
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param visited              - points visited by this thread
+      * @param candidates           - buffer of this thread
+      * @param checker              - checks the candidate points
+      * @return                     - for radius queries, index of a point within the radius, or -1
+    */
+    template <bool RADIUS_QUERY, typename Checker>
+    int probe(const int q, const std::vector<std::vector<int>>& query_keys, const std::vector<std::vector<float>>& query_fractions, const int MAX_PNTS_TO_SEARCH,
+      VisitedSet& visited, std::vector<int>& candidates, Checker& checker) const
+    {
+      const size_t L = cubes.size();
+      std::vector<vertex_t> vertices(L);
+      for(size_t l = 0; l < L; ++l)
+        vertices[l] = cubes[l]->map_query(&query_keys[l][(size_t)q * K]);
+      visited.next_query();
+      if(probing == MARGIN_PROBING)
+      {
+        std::vector<MarginProber> probers;
+        std::vector<float> scores(K);
+        for(size_t l = 0; l < L; ++l)
+        {
+          cubes[l]->margin_scores(&query_keys[l][(size_t)q * K], &query_fractions[l][(size_t)q * K], scores.data());
+          probers.push_back(MarginProber(scores.data(), K));
+        }
+        return round_robin<RADIUS_QUERY>(vertices, probers, MAX_PNTS_TO_SEARCH, visited, candidates, checker);
+      }
+      std::vector<HammingProber> probers;
+      for(size_t l = 0; l < L; ++l)
+        probers.push_back(HammingProber(cubes[l]->probe_masks()));
+      return round_robin<RADIUS_QUERY>(vertices, probers, MAX_PNTS_TO_SEARCH, visited, candidates, checker);
+    }
+
+    /** \brief Probe one vertex of every cube per round, until all vertices are probed,
+      * MAX_PNTS_TO_SEARCH distinct points are checked, or a radius query ('RADIUS_QUERY') finds a point.
+      *
+      * @param vertices             - vertex of the query on every cube
+      * @param probers              - order of the vertices of every cube
+      * @param MAX_PNTS_TO_SEARCH   - threshold when searching
+      * @param visited              - points visited by this thread
+      * @param candidates           - buffer of this thread
+      * @param checker              - checks the candidate points
+      * @return                     - for radius queries, index of a point within the radius, or -1
+    */
+    template <bool RADIUS_QUERY, typename Prober, typename Checker>
+    int round_robin(const std::vector<vertex_t>& vertices, std::vector<Prober>& probers, const int MAX_PNTS_TO_SEARCH,
+      VisitedSet& visited, std::vector<int>& candidates, Checker& checker) const
+    {
+      const size_t L = cubes.size();
+      std::vector<char> exhausted(L, 0);
+      size_t exhausted_no = 0;
+      int points_checked = 0;
+      int answer_point_idx = -1;
+      while(exhausted_no < L && points_checked < MAX_PNTS_TO_SEARCH && answer_point_idx == -1)
+      {
+        for(size_t l = 0; l < L && points_checked < MAX_PNTS_TO_SEARCH && answer_point_idx == -1; ++l)
+        {
+          vertex_t mask;
+          if(exhausted[l])
+            continue;
+          if(!probers[l].next(mask))
+          {
+            exhausted[l] = 1;
+            ++exhausted_no;
+            continue;
+          }
+          int size;
+          const int* points_idxs = cubes[l]->vertex_points(vertices[l] ^ mask, size);
+          candidates.clear();
+          for(int i = 0; i < size; ++i)
+            if(visited.insert(points_idxs[i]))
+              candidates.push_back(points_idxs[i]);
+          if(candidates.empty())
+            continue;
+          const int remaining = MAX_PNTS_TO_SEARCH - points_checked;
+          answer_point_idx = check(checker, candidates.data(), candidates.size(), remaining, std::integral_constant<bool, RADIUS_QUERY>());
+          points_checked += std::min((int)candidates.size(), remaining);
+        }
+      }
+      return answer_point_idx;
+    }
+
+    template <typename Checker>
+    static int check(Checker& checker, const int* points_idxs, const int size, const int threshold, std::true_type)
+    {
+      return checker.within_radius(points_idxs, size, threshold);
+    }
+
+    template <typename Checker>
+    static int check(Checker& checker, const int* points_idxs, const int size, const int threshold, std::false_type)
+    {
+      checker.nearest_neighbor(points_idxs, size, threshold);
+      return -1;
+    }
+  };
+}
+
+#endif /* MULTI_HYPERCUBE_H */
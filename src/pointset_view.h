@@ -0,0 +1,62 @@
+#ifndef POINTSET_VIEW_H
+#define POINTSET_VIEW_H
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * A pointset that lives elsewhere, e.g. in a std::vector or in a mapped file: N rows
+ * of D coordinates, with the first coordinates of consecutive rows 'stride' elements apart.
+ * A stride larger than D skips whatever lies between the rows, like the dimension
+ * that starts every row of an fvecs file. The view does not own the points.
+ */
+template <typename T>
+class PointsetView
+{
+    const T* rows;
+    // number of points
+    int N;
+    // dimension of points
+    int D;
+    // elements from the start of a row to the start of the next one
+    size_t row_stride;
+  public:
+    PointsetView()
+      : rows(NULL), N(0), D(0), row_stride(0)
+    {}
+
+    /** \brief Constructor.
+     *
+     * @param rows    - the first coordinate of the first point
+     * @param N       - number of points
+     * @param D       - dimension of points
+     * @param stride  - elements from the start of a row to the start of the next one. Default value is 0, i.e. D.
+     */
+    PointsetView(const T* rows, const int N, const int D, const size_t stride = 0)
+      : rows(rows), N(N), D(D), row_stride(stride ? stride : D)
+    {}
+
+    /** \brief Constructor that views a 1D vector of points, emulating a 2D, with D columns per row.
+     *
+     * @param pointset  - the vector
+     * @param D         - dimension of points
+     */
+    PointsetView(const std::vector<T>& pointset, const int D)
+      : rows(pointset.data()), N(D ? pointset.size() / D : 0), D(D), row_stride(D)
+    {}
+
+    /** \brief The coordinates of a point.
+     *
+     * @param i  - index of the point
+     * @return   - its first coordinate
+     */
+    const T* row(const size_t i) const { return rows + i * row_stride; }
+    const T* data() const { return rows; }
+    int size() const { return N; }
+    int dimension() const { return D; }
+    size_t stride() const { return row_stride; }
+    // the rows are consecutive, with nothing in between
+    bool contiguous() const { return row_stride == (size_t)D; }
+};
+
+#endif /*POINTSET_VIEW_H*/
@@ -0,0 +1,167 @@
+#ifndef PROBING_H
+#define PROBING_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+/**
+ * The order in which a query visits the vertices of the Hamming cube.
+ * A prober hands out masks; the vertex probed is the query's vertex XOR the mask.
+ */
+
+// A vertex of the Hamming cube, packed as an integer: bit k is the k-th bit of the mapped point.
+typedef uint32_t vertex_t;
+
+enum Probing
+{
+  // vertices by increasing Hamming distance from the query's vertex
+  HAMMING_PROBING,
+  // vertices by how likely they are to hold the query's neighbors, judging from how close
+  // the query's projections fell to the boundaries of their buckets (query-directed multi-probe)
+  MARGIN_PROBING
+};
+
+/** \brief All the masks of K bits, sorted by the number of set bits
+ * (and numerically within the same number of bits).
+ *
+ * @param K - dimension of the Hypercube
+ * @return  - the 2^K masks
+ */
+inline std::vector<vertex_t> probe_masks_by_popcount(const int K)
+{
+  std::vector<vertex_t> masks;
+  masks.reserve((size_t)1 << K);
+  const uint64_t end = (uint64_t)1 << K;
+  masks.push_back(0);
+  for(int bits = 1; bits <= K; ++bits)
+  {
+    // next mask with the same number of bits (Gosper's hack)
+    for(uint64_t mask = ((uint64_t)1 << bits) - 1; mask < end; )
+    {
+      masks.push_back((vertex_t)mask);
+      const uint64_t lowest = mask & (~mask + 1);
+      const uint64_t ripple = mask + lowest;
+      mask = ripple | (((mask ^ ripple) >> 2) / lowest);
+    }
+  }
+  return masks;
+}
+
+/**
+ * Hands out the masks of a table, for HAMMING_PROBING.
+ */
+class HammingProber
+{
+    const std::vector<vertex_t>& masks;
+    size_t next_mask;
+  public:
+    /** \brief Constructor.
+     *
+     * @param masks - masks by increasing number of set bits, see 'probe_masks_by_popcount()'
+     */
+    explicit HammingProber(const std::vector<vertex_t>& masks)
+      : masks(masks), next_mask(0)
+    {}
+
+    /** \brief Next mask to probe.
+     *
+     * @param mask  - the mask (to be populated)
+     * @return      - false if all the masks were handed out
+     */
+    bool next(vertex_t& mask)
+    {
+      if(next_mask == masks.size())
+        return false;
+      mask = masks[next_mask++];
+      return true;
+    }
+};
+
+/**
+ * Hands out masks by increasing score, for MARGIN_PROBING. Flipping bit 'k' has a score,
+ * the squared distance of the query's projection from the nearest boundary of its bucket
+ * behind which the bit differs; the score of a mask is the sum of the scores of its bits.
+ * Masks are generated lazily with a heap, as in multi-probe LSH (Lv et al., VLDB 2007):
+ * with the bits sorted by score, the successors of a set of bits are its 'shift' (replace
+ * the last bit with the next one) and its 'expand' (add the next bit).
+ */
+class MarginProber
+{
+    struct Bit_set
+    {
+      float score;
+      // set of positions of 'order'
+      vertex_t positions;
+      // last (highest) position in the set
+      int last;
+      bool operator>(const Bit_set& other) const { return score > other.score; }
+    };
+    // bits by increasing score
+    std::vector<int> order;
+    std::vector<float> sorted_scores;
+    // min-heap of the candidate sets
+    std::vector<Bit_set> heap;
+    bool started;
+
+    void push(const float score, const vertex_t positions, const int last)
+    {
+      Bit_set set = {score, positions, last};
+      heap.push_back(set);
+      std::push_heap(heap.begin(), heap.end(), std::greater<Bit_set>());
+    }
+  public:
+    /** \brief Constructor.
+     *
+     * @param scores  - score of flipping every bit of the query's vertex
+     * @param K       - dimension of the Hypercube
+     */
+    MarginProber(const float* scores, const int K)
+      : order(K), sorted_scores(K), started(false)
+    {
+      for(int k = 0; k < K; ++k)
+        order[k] = k;
+      std::sort(order.begin(), order.end(), [scores](const int a, const int b) { return scores[a] < scores[b]; });
+      for(int k = 0; k < K; ++k)
+        sorted_scores[k] = scores[order[k]];
+    }
+
+    /** \brief Next mask to probe.
+     *
+     * @param mask  - the mask (to be populated)
+     * @return      - false if all the masks were handed out
+     */
+    bool next(vertex_t& mask)
+    {
+      const int K = order.size();
+      if(!started)
+      {
+        started = true;
+        mask = 0;
+        if(K)
+          push(sorted_scores[0], 1, 0);
+        return true;
+      }
+      if(heap.empty())
+        return false;
+      std::pop_heap(heap.begin(), heap.end(), std::greater<Bit_set>());
+      const Bit_set set = heap.back();
+      heap.pop_back();
+      if(set.last + 1 < K)
+      {
+        const vertex_t next_position = (vertex_t)1 << (set.last + 1);
+        // shift
+        push(set.score - sorted_scores[set.last] + sorted_scores[set.last + 1], (set.positions ^ ((vertex_t)1 << set.last)) | next_position, set.last + 1);
+        // expand
+        push(set.score + sorted_scores[set.last + 1], set.positions | next_position, set.last + 1);
+      }
+      mask = 0;
+      for(int p = 0; p <= set.last; ++p)
+        if((set.positions >> p) & 1)
+          mask |= (vertex_t)1 << order[p];
+      return true;
+    }
+};
+
+#endif /*PROBING_H*/
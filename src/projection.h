@@ -0,0 +1,235 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "memory.h"
+#include "serialization.h"
+#include "metric.h"
+
+/**
+ * The projections of all the 'K' hash functions of a Hypercube, packed into
+ * one K x D matrix. Row 'k' is the vector 'a' of the k-th hash function, drawn
+ * from a stable distribution, and the key of a point 'v' is floor((a * v + b) / r),
+ * or, for SIGN_PROJECTION, 1 if a * v >= 0 and 0 otherwise.
+ */
+class ProjectionMatrix
+{
+    // number of hash functions (rows)
+    int K;
+    // dimension of points
+    int D;
+    // 'D' rounded up to a multiple of 'LANES'. The padding is zero.
+    int D_padded;
+    // hashing window
+    float r;
+    // how rows are drawn and keys computed
+    ProjectionFamily family;
+    // K x D_padded, row-major and aligned
+    Buffer<float, AlignedAllocator<float>> a;
+    // the offset 'b' of every hash function
+    Buffer<float> b;
+  public:
+    // width of the partial sums of a dot product, so that the compiler can vectorize them
+    static const int LANES = 8;
+
+    /** \brief Constructor that creates 'K' vectors from a stable distribution.
+     *
+     * Every row is drawn by its own generator, seeded with the time and
+     * the index of the row, so that rows are not the same.
+     *
+     * @param K          - number of hash functions
+     * @param D          - dimension of points
+     * @param r          - parameter of Stable Distribution. Not used by SIGN_PROJECTION.
+     * @param mean       - optional parameter of Normal Distribution. Default is 0.0.
+     * @param deviation  - optional parameter of Normal Distribution. Default is 1.0.
+     * @param family     - optional distribution of the rows and kind of keys. Default is GAUSSIAN_PROJECTION.
+     *                     CAUCHY_PROJECTION uses 'mean' and 'deviation' as location and scale; SIGN_PROJECTION
+     *                     draws normal rows without offsets.
+    */
+    ProjectionMatrix(const int K, const int D, const float r, const float mean = 0.0, const float deviation = 1.0,
+      const ProjectionFamily family = GAUSSIAN_PROJECTION)
+      : K(K), D(D), D_padded((D + LANES - 1) / LANES * LANES), r(r), family(family), a((size_t)K * D_padded, 0.0f), b(K, 0.0f)
+    {
+      std::vector<float, AlignedAllocator<float>>& rows = a.vector();
+      std::vector<float>& offsets = b.vector();
+      for(int k = 0; k < K; ++k)
+      {
+        std::default_random_engine generator(k + std::chrono::system_clock::now().time_since_epoch().count());
+        std::normal_distribution<float> distribution(mean, deviation);
+        std::cauchy_distribution<float> cauchy(mean, deviation);
+        for(int d = 0; d < D; ++d)
+          rows[(size_t)k * D_padded + d] = (family == CAUCHY_PROJECTION) ? cauchy(generator) : distribution(generator);
+        offsets[k] = (family == SIGN_PROJECTION) ? 0.0f : distribution(generator);
+      }
+    }
+
+    /** \brief Constructor of an empty matrix, to be loaded.
+    */
+    ProjectionMatrix()
+      : K(0), D(0), D_padded(0), r(0), family(GAUSSIAN_PROJECTION)
+    {}
+
+    /** \brief Number of hash functions (rows).
+    */
+    int get_K() const
+    {
+      return K;
+    }
+
+    /** \brief Dimension of points.
+    */
+    int get_D() const
+    {
+      return D;
+    }
+
+    /** \brief Hashing window.
+    */
+    float get_r() const
+    {
+      return r;
+    }
+
+    /** \brief Distribution of the rows and kind of keys.
+    */
+    ProjectionFamily get_family() const
+    {
+      return family;
+    }
+
+    /** \brief Write the matrix.
+     *
+     * @param out  - the file
+    */
+    void save(Serialization::Writer& out) const
+    {
+      out.value(K);
+      out.value(D);
+      out.value(r);
+      out.value((int)family);
+      out.array(a.data(), a.size());
+      out.array(b.data(), b.size());
+    }
+
+    /** \brief Read a matrix written by 'save()'. Its arrays are used in place.
+     *
+     * @param in  - the file, which must outlive the matrix
+     * @return    - false if the file is not valid
+    */
+    bool load(Serialization::Reader& in)
+    {
+      const float* rows;
+      const float* offsets;
+      uint64_t rows_size, offsets_size;
+      int family_id;
+      if(!in.value(K) || !in.value(D) || !in.value(r) || !in.value(family_id) || !in.array(rows, rows_size) || !in.array(offsets, offsets_size))
+        return false;
+      D_padded = (D + LANES - 1) / LANES * LANES;
+      family = (ProjectionFamily)family_id;
+      if(K < 0 || D < 0 || rows_size != (uint64_t)K * D_padded || offsets_size != (uint64_t)K ||
+        family_id < GAUSSIAN_PROJECTION || family_id > SIGN_PROJECTION)
+      {
+        in.fail();
+        return false;
+      }
+      a.view(rows, rows_size);
+      b.view(offsets, offsets_size);
+      return true;
+    }
+
+    /** \brief Hash a range of points with all the hash functions.
+     *
+     * Points are converted to float in blocks that fit in the L1 cache, and every
+     * block is projected on all the 'K' rows, so the points are read only once.
+     *
+     * @param points     - iterator at the start of the first point
+     * @param n          - number of points
+     * @param keys       - n x K keys, the key of the i-th point for the k-th function is keys[i * K + k]
+     * @param fractions  - optional n x K, where the projection fell inside its bucket, in [0, 1): 0 is
+     *                     the boundary with the previous key, 1 the boundary with the next key. For
+     *                     SIGN_PROJECTION, |a * v| instead: how far the point is from the hyperplane.
+     * @param stride     - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     *
+     * The template parameter FIXED_D, if not 0, is D known at compile time, which bounds the loops.
+    */
+    template <int FIXED_D = 0, typename iterator>
+    void hash(iterator points, const int n, int* keys, float* fractions = NULL, size_t stride = 0) const
+    {
+      static const int FIXED_PADDED = (FIXED_D + LANES - 1) / LANES * LANES;
+      const int dimension = FIXED_D ? FIXED_D : D;
+      const int padded = FIXED_D ? FIXED_PADDED : D_padded;
+      if(!stride)
+        stride = dimension;
+      const int block = std::max(1, 8192 / padded);
+      std::vector<float, AlignedAllocator<float>> buffer((size_t)block * padded, 0.0f);
+      for(int i_start = 0; i_start < n; i_start += block)
+      {
+        const int block_size = std::min(block, n - i_start);
+        for(int i = 0; i < block_size; ++i)
+          for(int d = 0; d < dimension; ++d)
+            buffer[(size_t)i * padded + d] = *(points + ((size_t)(i_start + i) * stride + d));
+        for(int k = 0; k < K; ++k)
+        {
+          const float* row = &a[(size_t)k * padded];
+          for(int i = 0; i < block_size; ++i)
+          {
+            const float product = dot<FIXED_PADDED>(row, &buffer[(size_t)i * padded]);
+            if(family == SIGN_PROJECTION)
+            {
+              keys[(size_t)(i_start + i) * K + k] = product >= 0;
+              if(fractions)
+                fractions[(size_t)(i_start + i) * K + k] = std::fabs(product);
+              continue;
+            }
+            const float projection = (product + b[k]) / r;
+            const float key = floor(projection);
+            keys[(size_t)(i_start + i) * K + k] = key;
+            if(fractions)
+              fractions[(size_t)(i_start + i) * K + k] = projection - key;
+          }
+        }
+      }
+    }
+
+    /** \brief Dot product of two padded rows.
+     *
+     * @param x - first row
+     * @param y - second row
+     * @return  - x * y
+     *
+     * The template parameter PADDED, if not 0, is the padded length known at compile time.
+    */
+    template <int PADDED = 0>
+    float dot(const float* x, const float* y) const
+    {
+      const int length = PADDED ? PADDED : D_padded;
+      float sums[LANES] = {0};
+      for(int d = 0; d < length; d += LANES)
+        for(int l = 0; l < LANES; ++l)
+          sums[l] += x[d + l] * y[d + l];
+      float sum = 0;
+      for(int l = 0; l < LANES; ++l)
+        sum += sums[l];
+      return sum;
+    }
+
+    /** \brief Print vector 'a' of a hash function.
+     *
+     * @param k - index of the hash function
+    */
+    void print_a(const int k) const
+    {
+      std::cout << "'a' vector of the stable distribution for h" << k << ", is:\n";
+      for(int d = 0; d < D; ++d)
+        std::cout << a[(size_t)k * D_padded + d] << " ";
+      std::cout << "\n";
+    }
+};
+
+#endif /*PROJECTION_H*/
@@ -0,0 +1,476 @@
+#ifndef QUANTIZATION_H
+#define QUANTIZATION_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#include "Euclidean_dist.h"
+
+/**
+ * Compressed copy of a pointset, used to score the candidates of a query
+ * with fewer bytes per coordinate. Only the best candidates are then
+ * checked against the original points.
+ */
+
+enum Quantization
+{
+  // no compressed copy, candidates are checked on the original points
+  NO_QUANTIZATION,
+  // 1 byte per coordinate, with a per-dimension offset and scale
+  INT8_QUANTIZATION,
+  // 2 bytes per coordinate, IEEE half precision
+  FP16_QUANTIZATION
+};
+
+/** \brief Convert a float to half precision, rounding to nearest even.
+ *
+ * @param value - float
+ * @return      - bits of the half
+ */
+inline uint16_t float_to_half(const float value)
+{
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+  const uint16_t sign = (f >> 16) & 0x8000;
+  f &= 0x7fffffff;
+  // too large for a half, infinity or NaN
+  if(f >= 0x477ff000)
+    return sign | (f > 0x7f800000 ? 0x7e00 : 0x7c00);
+  // subnormal half (or zero): the unit is 2^-24
+  if(f < 0x38800000)
+  {
+    float magnitude;
+    std::memcpy(&magnitude, &f, sizeof(f));
+    return sign | (uint16_t)std::nearbyint(magnitude * 16777216.0f);
+  }
+  // normal half: rebias the exponent from 127 to 15 and round the mantissa to 10 bits
+  const uint32_t rounded = f + 0xfff + ((f >> 13) & 1);
+  return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+/** \brief Convert a half precision number to float.
+ *
+ * @param h - bits of the half
+ * @return  - float
+ */
+inline float half_to_float(const uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if(exponent == 0)
+  {
+    const float magnitude = std::ldexp((float)mantissa, -24);
+    return sign ? -magnitude : magnitude;
+  }
+  const uint32_t f = sign | ((exponent == 31) ? (0x7f800000 | (mantissa << 13)) : (((exponent + 112) << 23) | (mantissa << 13)));
+  float value;
+  std::memcpy(&value, &f, sizeof(f));
+  return value;
+}
+
+/** \brief Squared distance of a prepared query and a row of 1-byte codes.
+ * The query is already in code units, so that coordinate 'd' contributes
+ * weight[d] * (query[d] - code[d])^2.
+ *
+ * @param query   - prepared query
+ * @param weight  - squared scale of every dimension
+ * @param code    - codes of the point
+ * @param D       - dimension of points
+ * @return        - approximate squared Euclidean distance
+ */
+inline float squared_distance_int8(const float* query, const float* weight, const uint8_t* code, const int D)
+{
+  // independent partial sums, so that the compiler can vectorize the loop
+  const int LANES = 8;
+  float sums[LANES] = {0};
+  int d = 0;
+  for(; d + LANES <= D; d += LANES)
+    for(int l = 0; l < LANES; ++l)
+    {
+      const float diff = query[d + l] - code[d + l];
+      sums[l] += weight[d + l] * diff * diff;
+    }
+  float sum = 0;
+  for(int l = 0; l < LANES; ++l)
+    sum += sums[l];
+  for(; d < D; ++d)
+  {
+    const float diff = query[d] - code[d];
+    sum += weight[d] * diff * diff;
+  }
+  return sum;
+}
+
+/** \brief Squared distance of a query and a row of halves, one coordinate at a time.
+ *
+ * @param query   - query
+ * @param code    - halves of the point
+ * @param start   - first coordinate to add
+ * @param D       - dimension of points
+ * @return        - approximate squared Euclidean distance
+ */
+inline float squared_distance_fp16_scalar(const float* query, const uint16_t* code, int start, const int D)
+{
+  float sum = 0;
+  for(; start < D; ++start)
+  {
+    const float diff = query[start] - half_to_float(code[start]);
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+#ifdef DOLPHINN_X86_SIMD
+__attribute__((target("avx2,fma")))
+inline float squared_distance_int8_avx2(const float* query, const float* weight, const uint8_t* code, const int D)
+{
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 16 <= D; d += 16)
+  {
+    const __m128i codes = _mm_loadu_si128((const __m128i*)(code + d));
+    const __m256 point0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(codes));
+    const __m256 point1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(codes, 8)));
+    const __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(query + d), point0);
+    const __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(query + d + 8), point1);
+    sum0 = _mm256_fmadd_ps(_mm256_mul_ps(diff0, diff0), _mm256_loadu_ps(weight + d), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_mul_ps(diff1, diff1), _mm256_loadu_ps(weight + d + 8), sum1);
+  }
+  sum0 = _mm256_add_ps(sum0, sum1);
+  return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1))) + squared_distance_int8(query + d, weight + d, code + d, D - d);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline float squared_distance_fp16_f16c(const float* query, const uint16_t* code, const int D)
+{
+  __m256 sum = _mm256_setzero_ps();
+  int d = 0;
+  for(; d + 8 <= D; d += 8)
+  {
+    const __m256 point = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(code + d)));
+    const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(query + d), point);
+    sum = _mm256_fmadd_ps(diff, diff, sum);
+  }
+  return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1))) + squared_distance_fp16_scalar(query, code, d, D);
+}
+#endif
+
+/** \brief Squared distance of a query and a row of halves. Uses F16C on
+ * CPUs with AVX2 (every AVX2 CPU also has F16C).
+ *
+ * @param query   - query
+ * @param code    - halves of the point
+ * @param D       - dimension of points
+ * @return        - approximate squared Euclidean distance
+ */
+inline float squared_distance_fp16(const float* query, const uint16_t* code, const int D)
+{
+#ifdef DOLPHINN_X86_SIMD
+  if(simd_level() >= SIMD_AVX2)
+    return squared_distance_fp16_f16c(query, code, D);
+#endif
+  return squared_distance_fp16_scalar(query, code, 0, D);
+}
+
+template <typename T>
+class QuantizedPointset
+{
+    Quantization mode;
+    // number of points
+    int N;
+    // dimension of points
+    int D;
+    // N x D codes, for INT8_QUANTIZATION
+    std::vector<uint8_t> codes_int8;
+    // N x D halves, for FP16_QUANTIZATION
+    std::vector<uint16_t> codes_fp16;
+    // per dimension: the coordinate is minimum + code * scale. Weight is scale^2.
+    std::vector<float> minimum;
+    std::vector<float> scale;
+    std::vector<float> weight;
+    // max Euclidean distance of a point from its compressed copy
+    float max_error;
+  public:
+    /** \brief Constructor that compresses a pointset.
+     *
+     * @param pointset  - 1D vector of points, emulating a 2D, with N rows and D columns per row
+     * @param N         - number of points
+     * @param D         - dimension of points
+     * @param mode      - INT8_QUANTIZATION or FP16_QUANTIZATION
+     * @param stride    - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     */
+    template <typename iterator>
+    QuantizedPointset(iterator pointset, const int N, const int D, const Quantization mode, size_t stride = 0)
+      : mode(mode), N(N), D(D), max_error(0)
+    {
+      if(!stride)
+        stride = D;
+      if(mode == INT8_QUANTIZATION)
+      {
+        minimum.assign(D, 0);
+        scale.assign(D, 1);
+        weight.assign(D, 1);
+        std::vector<float> maximum(D, 0);
+        for(int d = 0; N && d < D; ++d)
+          minimum[d] = maximum[d] = *(pointset + d);
+        for(int i = 0; i < N; ++i)
+          for(int d = 0; d < D; ++d)
+          {
+            const float x = *(pointset + ((size_t)i * stride + d));
+            minimum[d] = std::min(minimum[d], x);
+            maximum[d] = std::max(maximum[d], x);
+          }
+        for(int d = 0; d < D; ++d)
+        {
+          if(maximum[d] > minimum[d])
+            scale[d] = (maximum[d] - minimum[d]) / 255;
+          weight[d] = scale[d] * scale[d];
+        }
+        codes_int8.resize((size_t)N * D);
+      }
+      else
+      {
+        codes_fp16.resize((size_t)N * D);
+      }
+      encode(pointset, 0, N, stride);
+    }
+
+    /** \brief Compress points inserted after construction, with the ranges of the
+     * constructor. Coordinates out of those ranges are clamped, which raises the max error.
+     *
+     * @param points  - the new points
+     * @param n       - number of new points
+     * @param stride  - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     */
+    template <typename iterator>
+    void append(iterator points, const int n, size_t stride = 0)
+    {
+      if(!stride)
+        stride = D;
+      if(mode == INT8_QUANTIZATION)
+        codes_int8.resize((size_t)(N + n) * D);
+      else
+        codes_fp16.resize((size_t)(N + n) * D);
+      encode(points, N, n, stride);
+      N += n;
+    }
+
+  private:
+    /** \brief Compress points into the codes.
+     *
+     * @param points  - the points
+     * @param first   - index of the first point in the codes
+     * @param n       - number of points
+     * @param stride  - elements from the start of a point to the start of the next one
+     */
+    template <typename iterator>
+    void encode(iterator points, const int first, const int n, const size_t stride)
+    {
+      for(int i = 0; i < n; ++i)
+      {
+        float error = 0;
+        for(int d = 0; d < D; ++d)
+        {
+          const size_t idx = (size_t)(first + i) * D + d;
+          const float x = *(points + ((size_t)i * stride + d));
+          float decoded;
+          if(mode == INT8_QUANTIZATION)
+          {
+            const float code = std::min(255.0f, std::max(0.0f, std::floor((x - minimum[d]) / scale[d] + 0.5f)));
+            codes_int8[idx] = (uint8_t)code;
+            decoded = minimum[d] + code * scale[d];
+          }
+          else
+          {
+            codes_fp16[idx] = float_to_half(x);
+            decoded = half_to_float(codes_fp16[idx]);
+          }
+          error += (x - decoded) * (x - decoded);
+        }
+        max_error = std::max(max_error, std::sqrt(error));
+      }
+    }
+  public:
+    /** \brief Bring a query in the units of the codes.
+     *
+     * @param query_point  - vector containing only the coordinates of the query point
+     * @param prepared     - prepared query (to be populated)
+     */
+    template <typename iterator>
+    void prepare_query(iterator query_point, std::vector<float>& prepared) const
+    {
+      prepared.resize(D);
+      for(int d = 0; d < D; ++d)
+        prepared[d] = (mode == INT8_QUANTIZATION) ? (*(query_point + d) - minimum[d]) / scale[d] : *(query_point + d);
+    }
+
+    /** \brief Approximate squared Euclidean distance of a prepared query and a point.
+     *
+     * @param prepared   - query, prepared by 'prepare_query()'
+     * @param point_idx  - index of the point
+     * @return           - approximate squared distance
+     */
+    float squared_distance(const float* prepared, const int point_idx) const
+    {
+      if(mode == INT8_QUANTIZATION)
+      {
+#ifdef DOLPHINN_X86_SIMD
+        if(simd_level() >= SIMD_AVX2)
+          return squared_distance_int8_avx2(prepared, weight.data(), &codes_int8[(size_t)point_idx * D], D);
+#endif
+        return squared_distance_int8(prepared, weight.data(), &codes_int8[(size_t)point_idx * D], D);
+      }
+      return squared_distance_fp16(prepared, &codes_fp16[(size_t)point_idx * D], D);
+    }
+
+    /** \brief Quantization of the copy.
+     *
+     * @return - INT8_QUANTIZATION or FP16_QUANTIZATION
+     */
+    Quantization get_mode() const
+    {
+      return mode;
+    }
+
+    /** \brief Max Euclidean distance of a point from its compressed copy.
+     * The approximate distance of a query from a point is within this much of the exact one.
+     *
+     * @return - the max error
+     */
+    float get_max_error() const
+    {
+      return max_error;
+    }
+};
+
+/**
+ * Checks the candidate points of one query on a QuantizedPointset,
+ * and verifies only the most promising ones on the original points.
+ */
+template <typename T, typename iterator>
+class QuantizedCandidateChecker
+{
+    const QuantizedPointset<T>& quantized;
+    // 1D vector of all points
+    iterator pointset;
+    // vector containing only the coordinates of the query point
+    iterator query_point;
+    // dimension of points
+    const int D;
+    // square value of the radius, for radius queries
+    const float squared_radius;
+    // elements from the start of a point to the start of the next one
+    const size_t stride;
+    // a point within the radius is never further than this from the query on the compressed copy
+    float approximate_squared_radius;
+    std::vector<float> prepared_query;
+    // number of candidates of a Nearest Neighbor query that are re-checked on the original points
+    const int rerank;
+    // the 'rerank' best (approximate squared distance, index) pairs, as a max-heap
+    std::vector<std::pair<float, int>> best;
+  public:
+    /** \brief Constructor.
+     *
+     * @param quantized       - compressed copy of the pointset
+     * @param pointset        - 1D vector of all points
+     * @param query_point     - vector containing only the coordinates of the query point
+     * @param D               - dimension of points
+     * @param rerank          - number of candidates re-checked on the original points by Nearest Neighbor queries
+     * @param squared_radius  - square value of given radius. Not used by Nearest Neighbor queries.
+     * @param stride          - elements from the start of a point to the start of the next one. Default value is 0, i.e. D.
+     */
+    QuantizedCandidateChecker(const QuantizedPointset<T>& quantized, iterator pointset, iterator query_point, const int D, const int rerank, const float squared_radius = 0, const size_t stride = 0)
+      : quantized(quantized), pointset(pointset), query_point(query_point), D(D), squared_radius(squared_radius), stride(stride ? stride : D), rerank(std::max(1, rerank))
+    {
+      const float radius_bound = std::sqrt(squared_radius) + quantized.get_max_error();
+      approximate_squared_radius = radius_bound * radius_bound;
+      quantized.prepare_query(query_point, prepared_query);
+      best.reserve(this->rerank);
+    }
+
+    /** \brief Report a point's index (if any) that lies within the radius.
+     * Only points that may be within the radius on the compressed copy are checked exactly.
+     *
+     * @param points_idxs     - indices of candidate points
+     * @param size            - number of candidate points
+     * @param threshold       - max number of points to check
+     * @return                - the index of the point. -1 if not found.
+     */
+    int within_radius(const int* points_idxs, const int size, const int threshold)
+    {
+      for(int i = 0; i < threshold && i < size; ++i)
+      {
+        if(quantized.squared_distance(prepared_query.data(), points_idxs[i]) <= approximate_squared_radius &&
+          squared_Eucl_distance(query_point, query_point + D, pointset + (size_t)points_idxs[i] * stride) <= squared_radius)
+          return points_idxs[i];
+      }
+      return -1;
+    }
+
+    /** \brief Keep the best candidates, by their approximate distance.
+     *
+     * @param points_idxs     - indices of candidate points
+     * @param size            - number of candidate points
+     * @param threshold       - max number of points to check
+     */
+    void nearest_neighbor(const int* points_idxs, const int size, const int threshold)
+    {
+      for(int i = 0; i < threshold && i < size; ++i)
+      {
+        const float dist = quantized.squared_distance(prepared_query.data(), points_idxs[i]);
+        if((int)best.size() < rerank)
+        {
+          best.push_back(std::make_pair(dist, points_idxs[i]));
+          std::push_heap(best.begin(), best.end());
+        }
+        else if(dist < best.front().first)
+        {
+          std::pop_heap(best.begin(), best.end());
+          best.back() = std::make_pair(dist, points_idxs[i]);
+          std::push_heap(best.begin(), best.end());
+        }
+      }
+    }
+
+    /** \brief Re-check the best candidates on the original points.
+     *
+     * @return - index and squared distance from the query of the Nearest Neighbor. (-1, 1000000.0) if no point was checked.
+     */
+    std::pair<int, float> nearest_neighbor_result() const
+    {
+      std::pair<int, float> answer_point_idx_dist(-1, 1000000.0);
+      for(auto& candidate: best)
+      {
+        const float dist = squared_Eucl_distance(query_point, query_point + D, pointset + (size_t)candidate.second * stride);
+        if(dist < answer_point_idx_dist.second)
+          answer_point_idx_dist = std::make_pair(candidate.second, dist);
+      }
+      return answer_point_idx_dist;
+    }
+
+    /** \brief Re-check the best candidates on the original points and write the 'k' closest,
+     * closest first. Should keep at least 'k' candidates, i.e. 'rerank' >= 'k'. Can be called once.
+     *
+     * @param k    - number of neighbors to write
+     * @param out  - k (index, squared distance) pairs, (-1, 1000000.0) where fewer points were checked
+     */
+    void nearest_neighbors_result(const int k, std::pair<int, float>* out)
+    {
+      for(auto& candidate: best)
+        candidate.first = squared_Eucl_distance(query_point, query_point + D, pointset + (size_t)candidate.second * stride);
+      std::make_heap(best.begin(), best.end());
+      while((int)best.size() > k)
+      {
+        std::pop_heap(best.begin(), best.end());
+        best.pop_back();
+      }
+      write_k_Nearest_Neighbors(best, k, out);
+    }
+};
+
+#endif /*QUANTIZATION_H*/
@@ -0,0 +1,296 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <cstdint>
+#include <chrono>
+#include <bitset>
+#include <algorithm>
+
+#include "probing.h"
+
+/**
+ * What happened during a query: how far it walked on the Hamming cube, how many points it
+ * checked, why it stopped, and where its time went. See the 'stats' of the queries of
+ * Hypercube, and 'Hypercube::collect_statistics()' for the histograms of many queries.
+ */
+
+enum QueryStop
+{
+  // a radius query found a point within the radius
+  STOPPED_BY_ANSWER,
+  // MAX_PNTS_TO_SEARCH points were checked
+  STOPPED_BY_BUDGET,
+  // every vertex was probed
+  STOPPED_BY_EXHAUSTION
+};
+
+struct QueryStats
+{
+  // largest Hamming distance of a probed vertex from the query's vertex
+  int hamming_radius;
+  int vertices_probed;
+  // probed vertices without points
+  int empty_vertices;
+  // points handed to the distance checks, including erased ones
+  int candidates_checked;
+  QueryStop stop;
+  // hashing the query and mapping it to its vertex
+  double mapping_seconds;
+  // walking the Hamming cube, not counting the distance checks
+  double probing_seconds;
+  // checking the candidates
+  double distance_seconds;
+
+  QueryStats()
+    : hamming_radius(0), vertices_probed(0), empty_vertices(0), candidates_checked(0), stop(STOPPED_BY_EXHAUSTION),
+    mapping_seconds(0), probing_seconds(0), distance_seconds(0)
+  {}
+
+  double total_seconds() const { return mapping_seconds + probing_seconds + distance_seconds; }
+};
+
+/**
+ * Counts of values in buckets: one per value below 'BUCKETS' - 1 on a linear scale, or
+ * one per power of two on a log scale, where bucket b > 0 holds [2^(b-1), 2^b). The last
+ * bucket also holds all larger values.
+ */
+class Histogram
+{
+  public:
+    static const int BUCKETS = 64;
+  private:
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    double sum;
+    uint64_t largest;
+    bool log_scale;
+  public:
+    explicit Histogram(const bool log_scale = true)
+      : total(0), sum(0), largest(0), log_scale(log_scale)
+    {
+      std::fill(counts, counts + BUCKETS, 0);
+    }
+
+    /** \brief Bucket of a value.
+     *
+     * @param value  - the value
+     * @return       - index of the bucket
+     */
+    int bucket(const uint64_t value) const
+    {
+      if(!log_scale)
+        return (int)std::min<uint64_t>(value, BUCKETS - 1);
+      int b = 0;
+      for(uint64_t v = value; v; v >>= 1)
+        ++b;
+      return std::min(b, BUCKETS - 1);
+    }
+
+    /** \brief Smallest value of a bucket.
+     *
+     * @param b  - index of the bucket
+     * @return   - the value
+     */
+    uint64_t lower_bound(const int b) const
+    {
+      return (log_scale && b) ? (uint64_t)1 << (b - 1) : b;
+    }
+
+    void add(const uint64_t value)
+    {
+      ++counts[bucket(value)];
+      ++total;
+      sum += value;
+      largest = std::max(largest, value);
+    }
+
+    void merge(const Histogram& other)
+    {
+      for(int b = 0; b < BUCKETS; ++b)
+        counts[b] += other.counts[b];
+      total += other.total;
+      sum += other.sum;
+      largest = std::max(largest, other.largest);
+    }
+
+    /** \brief Approximate quantile: the smallest value of the bucket that holds it.
+     *
+     * @param fraction  - e.g. 0.99
+     * @return          - the value
+     */
+    uint64_t quantile(const double fraction) const
+    {
+      const uint64_t rank = (uint64_t)(fraction * total);
+      uint64_t seen = 0;
+      for(int b = 0; b < BUCKETS; ++b)
+      {
+        seen += counts[b];
+        if(seen > rank)
+          return std::min(lower_bound(b), largest);
+      }
+      return largest;
+    }
+
+    uint64_t count(const int b) const { return counts[b]; }
+    uint64_t size() const { return total; }
+    uint64_t max() const { return largest; }
+    double mean() const { return total ? sum / total : 0; }
+};
+
+/**
+ * Histograms of the statistics of many queries.
+ */
+struct QueryHistograms
+{
+  uint64_t queries;
+  // number of queries per QueryStop
+  uint64_t stopped_by[3];
+  Histogram hamming_radius;
+  Histogram vertices_probed;
+  Histogram empty_vertices;
+  Histogram candidates_checked;
+  // microseconds of a whole query
+  Histogram latency_us;
+  // total seconds of all queries, per phase
+  double mapping_seconds;
+  double probing_seconds;
+  double distance_seconds;
+
+  QueryHistograms()
+    : queries(0), hamming_radius(false), mapping_seconds(0), probing_seconds(0), distance_seconds(0)
+  {
+    std::fill(stopped_by, stopped_by + 3, 0);
+  }
+
+  void add(const QueryStats& stats)
+  {
+    ++queries;
+    ++stopped_by[stats.stop];
+    hamming_radius.add(stats.hamming_radius);
+    vertices_probed.add(stats.vertices_probed);
+    empty_vertices.add(stats.empty_vertices);
+    candidates_checked.add(stats.candidates_checked);
+    latency_us.add((uint64_t)(stats.total_seconds() * 1e6));
+    mapping_seconds += stats.mapping_seconds;
+    probing_seconds += stats.probing_seconds;
+    distance_seconds += stats.distance_seconds;
+  }
+
+  void merge(const QueryHistograms& other)
+  {
+    queries += other.queries;
+    for(int s = 0; s < 3; ++s)
+      stopped_by[s] += other.stopped_by[s];
+    hamming_radius.merge(other.hamming_radius);
+    vertices_probed.merge(other.vertices_probed);
+    empty_vertices.merge(other.empty_vertices);
+    candidates_checked.merge(other.candidates_checked);
+    latency_us.merge(other.latency_us);
+    mapping_seconds += other.mapping_seconds;
+    probing_seconds += other.probing_seconds;
+    distance_seconds += other.distance_seconds;
+  }
+};
+
+/**
+ * Records the walk of a query on the Hamming cube into its QueryStats, if it has one.
+ * Without stats, every call is a test of a null pointer, and the clock is not read.
+ */
+class QueryRecorder
+{
+    typedef std::chrono::steady_clock clock;
+    QueryStats* stats;
+    clock::time_point check_start;
+  public:
+    explicit QueryRecorder(QueryStats* stats)
+      : stats(stats)
+    {}
+
+    /** \brief A vertex is probed.
+     *
+     * @param mask  - the query's vertex XOR the probed vertex
+     */
+    void probe(const vertex_t mask)
+    {
+      if(!stats)
+        return;
+      ++stats->vertices_probed;
+      stats->hamming_radius = std::max(stats->hamming_radius, (int)std::bitset<32>(mask).count());
+    }
+
+    /** \brief The probed vertex had no points.
+     */
+    void empty_vertex()
+    {
+      if(stats)
+        ++stats->empty_vertices;
+    }
+
+    /** \brief Candidates are handed to the checker.
+     */
+    void start_check()
+    {
+      if(stats)
+        check_start = clock::now();
+    }
+
+    /** \brief The checker is done with the candidates.
+     */
+    void end_check()
+    {
+      if(stats)
+        stats->distance_seconds += std::chrono::duration<double>(clock::now() - check_start).count();
+    }
+
+    /** \brief The walk is over.
+     *
+     * @param points_checked  - candidates handed to the checker
+     * @param stop            - why the walk stopped
+     */
+    void finish(const int points_checked, const QueryStop stop)
+    {
+      if(!stats)
+        return;
+      stats->candidates_checked = points_checked;
+      stats->stop = stop;
+    }
+};
+
+/**
+ * Splits the time of a query between mapping and probing, if it has QueryStats. The time of
+ * the distance checks, recorded by QueryRecorder, is taken out of the probing.
+ */
+class QueryTimer
+{
+    typedef std::chrono::steady_clock clock;
+    QueryStats* stats;
+    clock::time_point last;
+  public:
+    explicit QueryTimer(QueryStats* stats)
+      : stats(stats)
+    {
+      if(stats)
+        last = clock::now();
+    }
+
+    /** \brief The query is mapped to its vertex.
+     */
+    void mapped()
+    {
+      if(!stats)
+        return;
+      const clock::time_point now = clock::now();
+      stats->mapping_seconds += std::chrono::duration<double>(now - last).count();
+      last = now;
+    }
+
+    /** \brief The walk on the Hamming cube is over.
+     */
+    void probed()
+    {
+      if(stats)
+        stats->probing_seconds += std::chrono::duration<double>(clock::now() - last).count() - stats->distance_seconds;
+    }
+};
+
+#endif /*QUERY_STATS_H*/
@@ -0,0 +1,139 @@
+#ifndef SERIALIZATION_H
+#define SERIALIZATION_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+
+/**
+ * The binary format of a saved index is a sequence of values and arrays, in the native
+ * byte order. An array is its number of elements (uint64_t), followed by its elements,
+ * which start at a multiple of 'ALIGNMENT' bytes from the start of the file. A mapped
+ * file is aligned to a page, so the arrays can be used in place, without copying them.
+ */
+namespace Serialization
+{
+  const size_t ALIGNMENT = 64;
+
+  /** \brief Writes values and arrays to a file.
+   */
+  class Writer
+  {
+      std::ofstream out;
+      uint64_t position;
+
+      void write(const void* data, const size_t bytes)
+      {
+        out.write((const char*)data, bytes);
+        position += bytes;
+      }
+    public:
+      /** \brief Constructor that creates (or truncates) the file. Check 'good()' afterwards.
+       *
+       * @param path  - path of the file
+       */
+      explicit Writer(const std::string& path)
+        : out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc), position(0)
+      {}
+
+      /** \brief Write a value.
+       *
+       * @param value  - the value, of a trivially copyable type
+       */
+      template <typename V>
+      void value(const V& value)
+      {
+        write(&value, sizeof(V));
+      }
+
+      /** \brief Write an array, aligned.
+       *
+       * @param data  - the elements, of a trivially copyable type
+       * @param n     - number of elements
+       */
+      template <typename V>
+      void array(const V* data, const uint64_t n)
+      {
+        value(n);
+        static const char padding[ALIGNMENT] = {0};
+        write(padding, (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+        write(data, n * sizeof(V));
+      }
+
+      /** \brief Flush the file.
+       *
+       * @return  - true if everything was written
+       */
+      bool good()
+      {
+        out.flush();
+        return out.good();
+      }
+  };
+
+  /** \brief Reads values and arrays from a file in memory, e.g. a MappedFile.
+   * Arrays are not copied. After a read fails, all reads fail.
+   */
+  class Reader
+  {
+      const char* data;
+      size_t size;
+      size_t position;
+      bool ok;
+    public:
+      /** \brief Constructor.
+       *
+       * @param data  - the file, aligned to 'ALIGNMENT' bytes
+       * @param size  - size of the file in bytes
+       */
+      Reader(const char* data, const size_t size)
+        : data(data), size(size), position(0), ok(data != NULL)
+      {}
+
+      /** \brief Read a value.
+       *
+       * @param value  - the value (to be populated)
+       * @return       - false if the file is too short
+       */
+      template <typename V>
+      bool value(V& value)
+      {
+        if(!ok || size - position < sizeof(V))
+          return ok = false;
+        std::memcpy(&value, data + position, sizeof(V));
+        position += sizeof(V);
+        return true;
+      }
+
+      /** \brief Read an array, in place.
+       *
+       * @param elements  - pointer to the elements in the file (to be populated)
+       * @param n         - number of elements (to be populated)
+       * @return          - false if the file is too short
+       */
+      template <typename V>
+      bool array(const V*& elements, uint64_t& n)
+      {
+        if(!value(n))
+          return false;
+        position += (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT;
+        if(position > size || n > (size - position) / sizeof(V))
+          return ok = false;
+        elements = (const V*)(data + position);
+        position += n * sizeof(V);
+        return true;
+      }
+
+      /** \brief Mark the file as invalid, e.g. when a value is out of range.
+       */
+      void fail()
+      {
+        ok = false;
+      }
+
+      bool good() const { return ok; }
+  };
+}
+
+#endif /*SERIALIZATION_H*/
@@ -0,0 +1,590 @@
+#ifndef SNAPSHOT_HYPERCUBE_H
+#define SNAPSHOT_HYPERCUBE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#include "hypercube.h"
+#include "epoch.h"
+
+namespace Dolphinn
+{
+  /**
+   * A Hypercube that answers queries while points are inserted and erased. Every query runs
+   * on a snapshot: the index as it was when the query started, unaffected by the updates that
+   * follow. Queries take no lock; they pin an epoch (see EpochDomain) and read the current snapshot.
+   *
+   * A snapshot is a compacted Hypercube, which is never changed, plus the points inserted and
+   * erased since it was built. Updates are appended to a Delta that the snapshots of a Hypercube
+   * share: a new point goes to a row past those of the published snapshots, and an erased point
+   * is stamped with the snapshot that erased it, so older snapshots still see it. Every update
+   * publishes a new snapshot. When the Delta is full, or too many points are erased, the writer
+   * merges it into a copy of the Hypercube, and publishes that; the old Hypercube is freed when
+   * the last query that may hold it has finished. Updates run one at a time.
+   *
+   * Queries check the original points, exactly: the compressed copy of 'Hypercube::quantize()' is not used.
+   */
+  template <typename T, typename bitT>
+  class SnapshotHypercube
+  {
+    typedef Hypercube<T, bitT> Cube;
+    // stamp of a point that is not erased
+    static const uint32_t LIVE = UINT32_MAX;
+    // least number of points a Delta can hold
+    static const int MIN_DELTA_ROWS = 1024;
+
+    /**
+     * Points inserted and erased since a Hypercube was built. Only the writer changes it, and only
+     * where the published snapshots do not look: rows past theirs, and stamps newer than theirs.
+     */
+    struct Delta
+    {
+      // number of rows it can hold
+      const int capacity;
+      // the inserted points, D coordinates each
+      std::unique_ptr<T[]> rows;
+      // vertex of every row
+      std::unique_ptr<vertex_t[]> vertex_of;
+      // per row, the previous row of the same bucket, or -1
+      std::unique_ptr<int[]> next;
+      // per bucket of vertices, the last row inserted, or -1
+      std::unique_ptr<std::atomic<int>[]> heads;
+      // number of bits of a bucket
+      int bucket_bits;
+      // per row of the Hypercube, and per row of the Delta, the snapshot that erased it, or LIVE
+      std::unique_ptr<std::atomic<uint32_t>[]> base_erased;
+      std::unique_ptr<std::atomic<uint32_t>[]> delta_erased;
+      // row of the Hypercube of every id, -1 if the point is not there or is erased already. Only the writer uses it.
+      std::vector<int> base_row_of_id;
+      // number of points erased, of the Hypercube and of the Delta. Only the writer uses it.
+      int erased_no;
+
+      /** \brief Constructor of an empty Delta.
+        *
+        * @param base      - the Hypercube
+        * @param capacity  - number of points it can hold
+      */
+      Delta(const Cube& base, const int capacity)
+        : capacity(capacity), rows(new T[(size_t)capacity * base.get_D()]), vertex_of(new vertex_t[capacity]), next(new int[capacity]),
+        bucket_bits(1), delta_erased(new std::atomic<uint32_t>[capacity]), base_row_of_id(base.get_ids_no(), -1), erased_no(0)
+      {
+        // a bucket per two rows, so that chains are short
+        while((1 << bucket_bits) < 2 * capacity)
+          ++bucket_bits;
+        heads.reset(new std::atomic<int>[1 << bucket_bits]);
+        for(int b = 0; b < (1 << bucket_bits); ++b)
+          heads[b].store(-1, std::memory_order_relaxed);
+        for(int row = 0; row < capacity; ++row)
+          delta_erased[row].store(LIVE, std::memory_order_relaxed);
+        const int base_rows = base.points().size();
+        base_erased.reset(new std::atomic<uint32_t>[base_rows]);
+        for(int row = 0; row < base_rows; ++row)
+        {
+          base_erased[row].store(LIVE, std::memory_order_relaxed);
+          if(!base.is_erased(row))
+            base_row_of_id[base.original_index(row)] = row;
+        }
+      }
+
+      /** \brief Bucket of a vertex.
+        *
+        * @param vertex  - vertex id
+        * @return        - index of 'heads'
+      */
+      int bucket(const vertex_t vertex) const
+      {
+        return (int)(((uint64_t)vertex * 0x9E3779B97F4A7C15ULL) >> (64 - bucket_bits));
+      }
+    };
+
+    /**
+     * The index as a query sees it. Never changed after it is published.
+     */
+    struct Snapshot
+    {
+      std::shared_ptr<const Cube> base;
+      std::shared_ptr<const Delta> delta;
+      // rows of the Delta that belong to the snapshot
+      int delta_rows;
+      // points stamped with this or an older snapshot are erased
+      uint32_t stamp;
+      // number of points that queries can report
+      int live_no;
+    };
+
+    // original dimension of points
+    const int D;
+    // dimension of the Hypercube
+    const int K;
+    // the snapshot of new queries
+    std::atomic<const Snapshot*> current;
+    // the Delta of the current snapshot, which the writer appends to
+    std::shared_ptr<Delta> delta;
+    // one update at a time
+    std::mutex writer_mutex;
+    // fraction of the points that may be inserted or erased before the Delta is merged, see 'set_compaction_threshold()'
+    float compaction_threshold;
+    // order in which queries probe the vertices, see 'set_probing()'
+    Probing probing;
+    // threads of the queries and updates of more than one thread, and of the merges; created once
+    std::shared_ptr<ThreadPool> pool;
+    EpochDomain& domain;
+
+    /** \brief Make a snapshot current, and free the previous one when no query holds it.
+      *
+      * @param next  - the snapshot
+    */
+    void publish(const Snapshot* next)
+    {
+      const Snapshot* previous = current.exchange(next, std::memory_order_seq_cst);
+      if(previous)
+        domain.retire(std::shared_ptr<const Snapshot>(previous));
+    }
+
+    /** \brief Number of points a Delta of a Hypercube holds before it is merged.
+      *
+      * @param base  - the Hypercube
+      * @return      - the capacity
+    */
+    int delta_capacity(const Cube& base) const
+    {
+      return std::max((int)MIN_DELTA_ROWS, (int)(compaction_threshold * base.size()));
+    }
+
+    /** \brief Merge the current snapshot, and optionally new points, into a copy of its Hypercube,
+      * and publish it with an empty Delta. The caller holds 'writer_mutex'.
+      *
+      * @param extra       - points to insert after those of the Delta, or NULL
+      * @param threads_no  - number of threads that hash the points
+    */
+    void merge(const PointsetView<T>* extra, const int threads_no)
+    {
+      const Snapshot& s = *current.load(std::memory_order_relaxed);
+      std::shared_ptr<Cube> next = std::make_shared<Cube>(*s.base);
+      next->set_compaction_threshold(1);
+      if(s.delta_rows)
+        next->insert(PointsetView<T>(delta->rows.get(), s.delta_rows, D), threads_no);
+      if(extra && extra->size())
+        next->insert(*extra, threads_no);
+      std::vector<int> erased_ids;
+      for(int row = 0; row < s.base->points().size(); ++row)
+        if(delta->base_erased[row].load(std::memory_order_relaxed) != LIVE)
+          erased_ids.push_back(s.base->original_index(row));
+      for(int row = 0; row < s.delta_rows; ++row)
+        if(delta->delta_erased[row].load(std::memory_order_relaxed) != LIVE)
+          erased_ids.push_back(s.base->get_ids_no() + row);
+      next->erase(erased_ids);
+      next->compact();
+      delta = std::make_shared<Delta>(*next, delta_capacity(*next));
+      Snapshot* merged = new Snapshot();
+      merged->base = next;
+      merged->delta = delta;
+      merged->delta_rows = 0;
+      merged->stamp = 0;
+      merged->live_no = next->size();
+      publish(merged);
+    }
+
+    /** \brief Compute the keys of points on the Hypercube of a snapshot: on the calling thread alone
+      * for a single thread, which takes no lock, or on at most 'threads_no' threads of 'pool'.
+      *
+      * @param base        - the Hypercube of the snapshot
+      * @param points      - n points, D coordinates each
+      * @param keys        - n x K keys (to be populated)
+      * @param fractions   - optional n x K positions of the projections inside their buckets (to be populated)
+      * @param threads_no  - number of threads
+    */
+    void hash_points(const Cube& base, const PointsetView<T>& points, std::vector<int>& keys, float* fractions, const int threads_no) const
+    {
+      if(threads_no > 1)
+        base.hash_pointset(points, keys, *pool, fractions, threads_no);
+      else
+        base.hash_pointset(points, keys.data(), fractions);
+    }
+    public:
+    /** \brief Constructor that serves queries from a built Hypercube. The Hypercube is compacted,
+      * and must not be used directly afterwards.
+      *
+      * @param cube        - the Hypercube
+      * @param fraction    - see 'set_compaction_threshold()'. Default value is 0.1.
+      * @param threads_no  - most threads of the queries and updates, and of the merges. They are created here, and
+      *                      shared with the Hypercube. Default value is 'std::thread::hardware_concurrency()'.
+    */
+    explicit SnapshotHypercube(const std::shared_ptr<Cube>& cube, const float fraction = 0.1, const int threads_no = std::thread::hardware_concurrency())
+      : D(cube->get_D()), K(cube->get_K()), current(NULL), compaction_threshold(fraction), probing(HAMMING_PROBING),
+      pool(std::make_shared<ThreadPool>(threads_no)), domain(EpochDomain::global())
+    {
+      cube->set_thread_pool(pool);
+      cube->compact();
+      delta = std::make_shared<Delta>(*cube, delta_capacity(*cube));
+      Snapshot* first = new Snapshot();
+      first->base = cube;
+      first->delta = delta;
+      first->delta_rows = 0;
+      first->stamp = 0;
+      first->live_no = cube->size();
+      publish(first);
+    }
+
+    ~SnapshotHypercube()
+    {
+      publish(NULL);
+      domain.reclaim();
+    }
+
+    SnapshotHypercube(const SnapshotHypercube&) = delete;
+    SnapshotHypercube& operator=(const SnapshotHypercube&) = delete;
+
+    /** \brief Set when updates merge the inserted and erased points into a new Hypercube.
+      * Takes effect at the next merge.
+      *
+      * @param fraction  - fraction of the points that may be inserted, or erased, before the merge. Default value is 0.1.
+    */
+    void set_compaction_threshold(const float fraction)
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      compaction_threshold = fraction;
+    }
+
+    /** \brief Set the order in which queries probe the vertices, see 'Hypercube::set_probing()'.
+      * Must not run concurrently with queries.
+      *
+      * @param mode  - HAMMING_PROBING (default) or MARGIN_PROBING
+    */
+    void set_probing(const Probing mode)
+    {
+      probing = mode;
+    }
+
+    /** \brief Insert points. They get the ids that follow the last one, as in 'Hypercube::insert()',
+      * and queries that start after the call returns see them. Takes time proportional to the number
+      * of new points, except when the Delta is full, which merges it first.
+      *
+      * @param points      - the new points, D coordinates each
+      * @param threads_no  - number of threads that hash the points. Default value is 1.
+      * @return            - id of the first new point; the rest follow it
+    */
+    int insert(const PointsetView<T>& points, const int threads_no = 1)
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      const Snapshot& s = *current.load(std::memory_order_relaxed);
+      const int n = points.size();
+      const int first_id = s.base->get_ids_no() + s.delta_rows;
+      if(s.delta_rows + n > delta->capacity)
+      {
+        merge(&points, threads_no);
+        return first_id;
+      }
+      std::vector<int> keys((size_t)n * K);
+      hash_points(*s.base, points, keys, NULL, threads_no);
+      for(int i = 0; i < n; ++i)
+      {
+        const int row = s.delta_rows + i;
+        std::copy(points.row(i), points.row(i) + D, delta->rows.get() + (size_t)row * D);
+        const vertex_t vertex = s.base->map_query(&keys[(size_t)i * K]);
+        delta->vertex_of[row] = vertex;
+        std::atomic<int>& head = delta->heads[delta->bucket(vertex)];
+        delta->next[row] = head.load(std::memory_order_relaxed);
+        head.store(row, std::memory_order_release);
+      }
+      Snapshot* next = new Snapshot(s);
+      next->delta_rows += n;
+      next->live_no += n;
+      publish(next);
+      return first_id;
+    }
+
+    /** \brief Insert points, see above.
+      *
+      * @param points      - 1D vector of points, emulating a 2D, with n rows and D columns per row
+      * @param n           - number of points
+      * @param threads_no  - number of threads that hash the points. Default value is 1.
+      * @return            - id of the first new point; the rest follow it
+    */
+    int insert(const std::vector<T>& points, const int n, const int threads_no = 1)
+    {
+      return insert(PointsetView<T>(points.data(), n, D), threads_no);
+    }
+
+    /** \brief Erase points. Queries that start after the call returns skip them. Ids out of range,
+      * or of points already erased, are ignored.
+      *
+      * @param ids         - ids of the points
+      * @param threads_no  - number of threads of a merge. Default value is 1.
+      * @return            - number of points erased
+    */
+    int erase(const std::vector<int>& ids, const int threads_no = 1)
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      const Snapshot& s = *current.load(std::memory_order_relaxed);
+      const uint32_t stamp = s.stamp + 1;
+      const int base_ids = s.base->get_ids_no();
+      int erased_now = 0;
+      for(const int id: ids)
+      {
+        std::atomic<uint32_t>* mark = NULL;
+        if(id >= 0 && id < base_ids && delta->base_row_of_id[id] != -1)
+          mark = &delta->base_erased[delta->base_row_of_id[id]];
+        else if(id >= base_ids && id - base_ids < s.delta_rows)
+          mark = &delta->delta_erased[id - base_ids];
+        if(!mark || mark->load(std::memory_order_relaxed) != LIVE)
+          continue;
+        mark->store(stamp, std::memory_order_relaxed);
+        ++erased_now;
+      }
+      if(!erased_now)
+        return 0;
+      delta->erased_no += erased_now;
+      const bool full = delta->erased_no > compaction_threshold * s.base->size() || stamp == LIVE - 1;
+      Snapshot* next = new Snapshot(s);
+      next->stamp = stamp;
+      next->live_no -= erased_now;
+      // 's' may be freed from now on
+      publish(next);
+      if(full)
+        merge(NULL, threads_no);
+      return erased_now;
+    }
+
+    /** \brief Merge the inserted and erased points into a new Hypercube, which queries that start
+      * afterwards use. Takes time linear in the number of points; queries are not held up.
+      *
+      * @param threads_no  - number of threads that hash the points. Default value is 1.
+    */
+    void compact(const int threads_no = 1)
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      const Snapshot& s = *current.load(std::memory_order_relaxed);
+      if(s.delta_rows || delta->erased_no)
+        merge(NULL, threads_no);
+    }
+
+    /** \brief Number of points that queries can report.
+      *
+      * @return - the number of points
+    */
+    int size() const
+    {
+      EpochGuard guard(domain);
+      return current.load(std::memory_order_seq_cst)->live_no;
+    }
+
+    /** \brief Radius query, see 'Hypercube::radius_query()'.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param radius              - find a point within r with query
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param results_idxs        - ids of Q points, where Eucl(point[i], query[i]) <= r, -1 if not found
+      * @param threads_no          - number of threads that run the queries, at most those of the constructor. Default value is 1, which takes no lock.
+    */
+    void radius_query(const std::vector<T>& query, const int Q, const float radius, const int MAX_PNTS_TO_SEARCH, std::vector<int>& results_idxs, const int threads_no = 1) const
+    {
+      typedef const T* iterator;
+      results_idxs.resize(Q);
+      run(query, Q, threads_no, [&](const Snapshot& s, const int q, const int* keys, const float* fractions, std::vector<int>& candidates)
+      {
+        ExactCandidateChecker<iterator> base_checker(s.base->points().data(), query.data() + (size_t)q * D, D, L2Metric::radius_threshold(radius), s.base->points().stride());
+        ExactCandidateChecker<iterator> delta_checker(s.delta->rows.get(), query.data() + (size_t)q * D, D, L2Metric::radius_threshold(radius));
+        results_idxs[q] = probe<true>(s, keys, fractions, MAX_PNTS_TO_SEARCH, candidates, base_checker, delta_checker);
+      });
+    }
+
+    /** \brief Nearest Neighbor query, see 'Hypercube::nearest_neighbor_query()'.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param results_idxs_dists  - ids and squared distances of Q points, where the (Approximate) Nearest Neighbors are stored.
+      * @param threads_no          - number of threads that run the queries, at most those of the constructor. Default value is 1, which takes no lock.
+    */
+    void nearest_neighbor_query(const std::vector<T>& query, const int Q, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = 1) const
+    {
+      typedef const T* iterator;
+      results_idxs_dists.resize(Q);
+      run(query, Q, threads_no, [&](const Snapshot& s, const int q, const int* keys, const float* fractions, std::vector<int>& candidates)
+      {
+        ExactCandidateChecker<iterator> base_checker(s.base->points().data(), query.data() + (size_t)q * D, D, 0, s.base->points().stride());
+        ExactCandidateChecker<iterator> delta_checker(s.delta->rows.get(), query.data() + (size_t)q * D, D);
+        probe<false>(s, keys, fractions, MAX_PNTS_TO_SEARCH, candidates, base_checker, delta_checker);
+        std::pair<int, float> base_answer = base_checker.nearest_neighbor_result(), delta_answer = delta_checker.nearest_neighbor_result();
+        base_answer.first = s.base->original_index(base_answer.first);
+        if(delta_answer.first != -1 && delta_answer.second < base_answer.second)
+          base_answer = std::make_pair(s.base->get_ids_no() + delta_answer.first, delta_answer.second);
+        results_idxs_dists[q] = base_answer;
+      });
+    }
+
+    /** \brief k Nearest Neighbors query, see 'Hypercube::knn_query()'.
+      *
+      * @param query               - vector of queries
+      * @param Q                   - number of queries
+      * @param k                   - number of neighbors per query
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param results_idxs_dists  - Q x k ids and squared distances, nearest first, padded with (-1, 1000000.0)
+      * @param threads_no          - number of threads that run the queries, at most those of the constructor. Default value is 1, which takes no lock.
+    */
+    void knn_query(const std::vector<T>& query, const int Q, const int k, const int MAX_PNTS_TO_SEARCH, std::vector<std::pair<int, float>>& results_idxs_dists, const int threads_no = 1) const
+    {
+      typedef const T* iterator;
+      results_idxs_dists.resize((size_t)Q * k);
+      run(query, Q, threads_no, [&](const Snapshot& s, const int q, const int* keys, const float* fractions, std::vector<int>& candidates)
+      {
+        KNearestCandidateChecker<iterator> base_checker(s.base->points().data(), query.data() + (size_t)q * D, D, k, s.base->points().stride());
+        KNearestCandidateChecker<iterator> delta_checker(s.delta->rows.get(), query.data() + (size_t)q * D, D, k);
+        probe<false>(s, keys, fractions, MAX_PNTS_TO_SEARCH, candidates, base_checker, delta_checker);
+        // the k nearest of both
+        std::vector<std::pair<int, float>> base_answers(k), delta_answers(k);
+        base_checker.nearest_neighbors_result(k, base_answers.data());
+        delta_checker.nearest_neighbors_result(k, delta_answers.data());
+        for(auto& answer: base_answers)
+          answer.first = s.base->original_index(answer.first);
+        for(auto& answer: delta_answers)
+          if(answer.first != -1)
+            answer.first += s.base->get_ids_no();
+        std::pair<int, float>* out = &results_idxs_dists[(size_t)q * k];
+        size_t b = 0, d = 0;
+        for(int i = 0; i < k; ++i)
+          out[i] = (delta_answers[d].second < base_answers[b].second) ? delta_answers[d++] : base_answers[b++];
+      });
+    }
+
+    private:
+    /** \brief Run queries on the current snapshot, which is held until they finish.
+      *
+      * @param query       - vector of queries
+      * @param Q           - number of queries
+      * @param threads_no  - number of threads that run the queries
+      * @param execute     - called with the snapshot, the index, the K keys and the K fractions (with MARGIN_PROBING) of a query, and a buffer of the thread
+    */
+    template <typename Execute>
+    void run(const std::vector<T>& query, const int Q, const int threads_no, const Execute& execute) const
+    {
+      EpochGuard guard(domain);
+      const Snapshot& s = *current.load(std::memory_order_seq_cst);
+      const int threads = pool->size(threads_no);
+      std::vector<int> keys((size_t)Q * K);
+      std::vector<float> fractions(probing == MARGIN_PROBING ? (size_t)Q * K : 0);
+      hash_points(*s.base, PointsetView<T>(query.data(), Q, D), keys, fractions.empty() ? NULL : fractions.data(), threads);
+      const auto queries = [&](const int q_start, const int q_end)
+      {
+        std::vector<int> candidates;
+        for(int q = q_start; q < q_end; ++q)
+          execute(s, q, &keys[(size_t)q * K], fractions.empty() ? NULL : &fractions[(size_t)q * K], candidates);
+      };
+      // a single thread runs them itself, without the pool
+      if(threads > 1)
+        pool->parallel_for(0, Q, Cube::query_chunk(Q, threads), queries, threads);
+      else
+        queries(0, Q);
+    }
+
+    /** \brief Hand the candidates of one query to the checkers, probing in the order set by 'set_probing()'.
+      *
+      * @param s                   - the snapshot
+      * @param keys                - K keys of the query
+      * @param fractions           - K positions of the projections in their buckets, with MARGIN_PROBING
+      * @param MAX_PNTS_TO_SEARCH  - threshold, shared by both checkers
+      * @param candidates          - buffer of this thread
+      * @param base_checker        - checks rows of the Hypercube
+      * @param delta_checker       - checks rows of the Delta
+      * @return                    - for radius queries, id of a point within the radius, or -1
+    */
+    template <bool RADIUS_QUERY, typename Checker>
+    int probe(const Snapshot& s, const int* keys, const float* fractions, const int MAX_PNTS_TO_SEARCH, std::vector<int>& candidates,
+      Checker& base_checker, Checker& delta_checker) const
+    {
+      const vertex_t vertex = s.base->map_query(keys);
+      if(probing == MARGIN_PROBING)
+      {
+        std::vector<float> scores(K);
+        s.base->margin_scores(keys, fractions, scores.data());
+        MarginProber prober(scores.data(), K);
+        return walk<RADIUS_QUERY>(s, vertex, prober, MAX_PNTS_TO_SEARCH, candidates, base_checker, delta_checker);
+      }
+      HammingProber prober(s.base->probe_masks());
+      return walk<RADIUS_QUERY>(s, vertex, prober, MAX_PNTS_TO_SEARCH, candidates, base_checker, delta_checker);
+    }
+
+    /** \brief Check the points of the probed vertices that the snapshot holds, until all vertices
+      * are probed, MAX_PNTS_TO_SEARCH points are checked, or a radius query ('RADIUS_QUERY') finds a point.
+      *
+      * @param s                   - the snapshot
+      * @param vertex              - vertex of the query
+      * @param prober              - order of the vertices
+      * @param MAX_PNTS_TO_SEARCH  - threshold, shared by both checkers
+      * @param candidates          - buffer of this thread
+      * @param base_checker        - checks rows of the Hypercube
+      * @param delta_checker       - checks rows of the Delta
+      * @return                    - for radius queries, id of a point within the radius, or -1
+    */
+    template <bool RADIUS_QUERY, typename Prober, typename Checker>
+    int walk(const Snapshot& s, const vertex_t vertex, Prober& prober, const int MAX_PNTS_TO_SEARCH, std::vector<int>& candidates,
+      Checker& base_checker, Checker& delta_checker) const
+    {
+      const Delta& delta = *s.delta;
+      int points_checked = 0;
+      vertex_t mask;
+      while(points_checked < MAX_PNTS_TO_SEARCH && prober.next(mask))
+      {
+        const vertex_t probed = vertex ^ mask;
+        int size;
+        const int* points_idxs = s.base->vertex_points(probed, size);
+        candidates.clear();
+        for(int i = 0; i < size; ++i)
+          if(delta.base_erased[points_idxs[i]].load(std::memory_order_relaxed) > s.stamp)
+            candidates.push_back(points_idxs[i]);
+        int answer = check<RADIUS_QUERY>(base_checker, candidates, MAX_PNTS_TO_SEARCH, points_checked);
+        if(answer != -1)
+          return s.base->original_index(answer);
+        // rows inserted after the snapshot come first in the chain; they are skipped
+        candidates.clear();
+        for(int row = delta.heads[delta.bucket(probed)].load(std::memory_order_acquire); row != -1; row = delta.next[row])
+          if(row < s.delta_rows && delta.vertex_of[row] == probed && delta.delta_erased[row].load(std::memory_order_relaxed) > s.stamp)
+            candidates.push_back(row);
+        answer = check<RADIUS_QUERY>(delta_checker, candidates, MAX_PNTS_TO_SEARCH, points_checked);
+        if(answer != -1)
+          return s.base->get_ids_no() + answer;
+      }
+      return -1;
+    }
+
+    /** \brief Check candidates within what is left of the threshold.
+      *
+      * @param checker             - checks the candidate points
+      * @param candidates          - the candidates
+      * @param MAX_PNTS_TO_SEARCH  - threshold
+      * @param points_checked      - points checked so far (to be updated)
+      * @return                    - for radius queries, index of a point within the radius, or -1
+    */
+    template <bool RADIUS_QUERY, typename Checker>
+    static int check(Checker& checker, const std::vector<int>& candidates, const int MAX_PNTS_TO_SEARCH, int& points_checked)
+    {
+      if(candidates.empty() || points_checked >= MAX_PNTS_TO_SEARCH)
+        return -1;
+      const int remaining = MAX_PNTS_TO_SEARCH - points_checked;
+      points_checked += std::min((int)candidates.size(), remaining);
+      return check(checker, candidates.data(), candidates.size(), remaining, std::integral_constant<bool, RADIUS_QUERY>());
+    }
+
+    template <typename Checker>
+    static int check(Checker& checker, const int* points_idxs, const int size, const int threshold, std::true_type)
+    {
+      return checker.within_radius(points_idxs, size, threshold);
+    }
+
+    template <typename Checker>
+    static int check(Checker& checker, const int* points_idxs, const int size, const int threshold, std::false_type)
+    {
+      checker.nearest_neighbor(points_idxs, size, threshold);
+      return -1;
+    }
+  };
+}
+
+#endif /* SNAPSHOT_HYPERCUBE_H */
@@ -0,0 +1,111 @@
+/**
+ * Test of the vectorized distance kernels. Compares the SSE2, AVX2 and AVX-512 variants of
+ * 'squared_distance_*' of Euclidean_dist_simd.h, and the dispatched 'squared_Eucl_distance',
+ * with 'squared_Eucl_distance_scalar', for float, int and uint8_t rows of every dimension up to
+ * MAX_D, so that every tail and masked load runs. Rows start at odd offsets too, to catch aligned
+ * loads. Variants the CPU does not support are skipped.
+ *
+ *   make test_distance && ./test_distance
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdint>
+
+#include "Euclidean_dist.h"
+
+#define MAX_D 200
+// of the sum of the squares, for the reordered float additions of the vectorized kernels
+#define RELATIVE_ERROR 1e-5
+
+/** \brief Compare a kernel with the scalar distance on rows of every dimension and two offsets.
+ *
+ * @param name    - name of the kernel, for the report
+ * @param kernel  - the kernel
+ * @param a       - first rows, MAX_D + 1 coordinates
+ * @param b       - second rows, MAX_D + 1 coordinates
+ * @return        - the number of mismatches
+ */
+template <typename V, typename Kernel>
+int check_kernel(const std::string& name, Kernel kernel, const std::vector<V>& a, const std::vector<V>& b)
+{
+  int mismatches = 0;
+  for(int offset = 0; offset < 2; ++offset)
+    for(int D = 0; D <= MAX_D; ++D)
+    {
+      const V* x = a.data() + offset;
+      const V* y = b.data() + offset;
+      const float expected = squared_Eucl_distance_scalar(x, x + D, y);
+      const float found = kernel(x, y, D);
+      if(std::fabs(found - expected) > RELATIVE_ERROR * expected)
+      {
+        if(mismatches++ < 5)
+          std::cout << "  " << name << ", D = " << D << ", offset " << offset << ": " << found << " instead of " << expected << std::endl;
+      }
+    }
+  std::cout << (mismatches ? "FAILED " : "ok ") << name << std::endl;
+  return mismatches;
+}
+
+template <typename V>
+float dispatched(const V* a, const V* b, const int D)
+{
+  return squared_Eucl_distance(a, a + D, b);
+}
+
+/** \brief Check every supported kernel of an element type.
+ *
+ * @param type  - name of the element type, for the report
+ * @param a     - first rows, MAX_D + 1 coordinates
+ * @param b     - second rows, MAX_D + 1 coordinates
+ * @return      - the number of mismatches
+ */
+template <typename V>
+int check_type(const std::string& type, const std::vector<V>& a, const std::vector<V>& b)
+{
+  int mismatches = check_kernel(type + " squared_Eucl_distance", dispatched<V>, a, b);
+#ifdef DOLPHINN_X86_SIMD
+  mismatches += check_kernel(type + " squared_distance_sse2", (float (*)(const V*, const V*, const int))squared_distance_sse2, a, b);
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    mismatches += check_kernel(type + " squared_distance_avx2", (float (*)(const V*, const V*, const int))squared_distance_avx2, a, b);
+  else
+    std::cout << "skipped " << type << " squared_distance_avx2: not supported by the CPU" << std::endl;
+  // the uint8_t kernel also needs the byte instructions of AVX-512
+  if(__builtin_cpu_supports("avx512f") && (!std::is_same<V, uint8_t>::value || __builtin_cpu_supports("avx512bw")))
+    mismatches += check_kernel(type + " squared_distance_avx512", (float (*)(const V*, const V*, const int))squared_distance_avx512, a, b);
+  else
+    std::cout << "skipped " << type << " squared_distance_avx512: not supported by the CPU" << std::endl;
+#endif
+  return mismatches;
+}
+
+int main()
+{
+#ifdef DOLPHINN_X86_SIMD
+  __builtin_cpu_init();
+#endif
+  std::mt19937 generator(1);
+  std::normal_distribution<float> normal(0, 10);
+  std::uniform_int_distribution<int> small_int(-100, 100);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  std::vector<float> float_a(MAX_D + 1), float_b(MAX_D + 1);
+  std::vector<int> int_a(MAX_D + 1), int_b(MAX_D + 1);
+  std::vector<uint8_t> byte_a(MAX_D + 1), byte_b(MAX_D + 1);
+  for(int d = 0; d <= MAX_D; ++d)
+  {
+    float_a[d] = normal(generator);
+    float_b[d] = normal(generator);
+    int_a[d] = small_int(generator);
+    int_b[d] = small_int(generator);
+    byte_a[d] = byte(generator);
+    byte_b[d] = byte(generator);
+  }
+
+  int mismatches = check_type("float", float_a, float_b);
+  mismatches += check_type("int", int_a, int_b);
+  mismatches += check_type("uint8_t", byte_a, byte_b);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * Test of the memory of the construction. Builds Hypercubes over a synthetic pointset, with drawn
+ * and with hashed bits, and checks that the peak memory of every build, over the memory before it,
+ * stays within a bound per point: the construction must never hold the N x K keys of the points.
+ * So must the resident memory once the build returns: its temporaries must have been freed.
+ *
+ *   make test_memory && ./test_memory
+ *
+ * Reads the peak from /proc/self/status, so it runs on Linux only, and is skipped if the peak
+ * cannot be reset.
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "memory.h"
+#include "hypercube.h"
+
+#define N (1 << 20)
+#define D 16
+#define K 20
+// a vertex and a position in the Hypercube per point, and slack; the N x K keys alone would take 4 * K = 80
+#define MAX_BYTES_PER_POINT 32
+// what the Hypercube holds: a position per point, and an offset and a probing mask per vertex of the 2^K.
+// Temporaries of N elements that outlive the build would add 4 bytes per point or more to the slack.
+#define RESIDENT_BYTES_PER_POINT 4
+#define RESIDENT_BYTES_PER_VERTEX 8
+#define RESIDENT_SLACK_PER_POINT 2
+
+/** \brief Hand the memory that was freed, but that the allocator keeps, back to the system, so that
+ * the resident memory counts only what is held.
+ */
+void release_freed_memory()
+{
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+/** \brief Build a Hypercube and check its peak memory, and its resident memory afterwards.
+ *
+ * @param points       - the N points
+ * @param hashed_bits  - derive the bits instead of drawing them
+ * @return             - true if both are within their bounds and the Hypercube finds a point
+ */
+bool check_build(const std::vector<float>& points, const bool hashed_bits)
+{
+  const std::string name = hashed_bits ? "hashed bits" : "drawn bits";
+  release_freed_memory();
+  reset_peak_memory();
+  const size_t resident_kb = process_memory_kb("VmRSS");
+  Dolphinn::Hypercube<float, char> cube(points, N, D, K, 1, 4, hashed_bits);
+  const size_t peak_kb = process_memory_kb("VmHWM");
+  release_freed_memory();
+  const size_t built_kb = process_memory_kb("VmRSS");
+  const double bytes_per_point = peak_kb > resident_kb ? (peak_kb - resident_kb) * 1024.0 / N : 0;
+  const double resident_bytes_per_point = built_kb > resident_kb ? (built_kb - resident_kb) * 1024.0 / N : 0;
+  const double max_resident_bytes_per_point = RESIDENT_BYTES_PER_POINT + RESIDENT_SLACK_PER_POINT + RESIDENT_BYTES_PER_VERTEX * (double)(1 << K) / N;
+
+  std::vector<float> query(points.begin(), points.begin() + D);
+  std::vector<std::pair<int, float>> found(1);
+  cube.knn_query(query, 1, 1, N, found, 1);
+
+  const bool ok = bytes_per_point <= MAX_BYTES_PER_POINT && resident_bytes_per_point <= max_resident_bytes_per_point && found[0].second == 0;
+  std::cout << (ok ? "ok " : "FAILED ") << name << ": " << bytes_per_point << " bytes per point at the peak of the build (at most "
+    << MAX_BYTES_PER_POINT << "), " << resident_bytes_per_point << " after it (at most " << max_resident_bytes_per_point
+    << "), nearest neighbor of point 0 at distance " << found[0].second << std::endl;
+  return ok;
+}
+
+int main()
+{
+  std::vector<float> points((size_t)N * D);
+  std::mt19937 generator(1);
+  std::normal_distribution<float> normal(0, 1);
+  for(auto& x: points)
+    x = normal(generator);
+
+  if(!reset_peak_memory() || !process_memory_kb("VmHWM"))
+  {
+    std::cout << "skipped: the peak memory of the process cannot be reset" << std::endl;
+    return 0;
+  }
+  bool ok = check_build(points, false);
+  ok = check_build(points, true) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <algorithm>
+
+/**
+ * Persistent worker threads that run parallel loops. The range of a loop is cut into
+ * chunks, every participant (the calling thread and the workers that join it) gets a
+ * contiguous share, and a participant that runs out of chunks steals from the back of the
+ * others' shares, so that a few expensive iterations do not leave the rest of the threads idle.
+ * Every call has its own loop, so loops of concurrent callers, and loops called from the body
+ * of another, run at the same time: the calling thread runs whatever chunks no idle worker takes.
+ */
+class ThreadPool
+{
+    // chunks [start, end) of one participant
+    struct Share
+    {
+      std::mutex mutex;
+      std::deque<std::pair<int, int>> chunks;
+    };
+    // one call of 'parallel_for()'
+    struct Loop
+    {
+      const std::function<void(int, int)>* body;
+      // one per participant; the calling thread is the last
+      std::unique_ptr<Share[]> shares;
+      int participants;
+      // workers that joined the loop, and those of them still running it
+      int joined;
+      int active;
+    };
+    std::vector<std::thread> workers;
+    // loops that idle workers may still join
+    std::vector<Loop*> loops;
+    bool stop;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+
+    /** \brief Take a chunk of a loop: the front of our own share, or the back of another's.
+     *
+     * @param loop   - the loop
+     * @param id     - index of the participant
+     * @param chunk  - the chunk (to be populated)
+     * @return       - false if there are no chunks left
+     */
+    static bool take(Loop& loop, const int id, std::pair<int, int>& chunk)
+    {
+      for(int i = 0; i < loop.participants; ++i)
+      {
+        Share& share = loop.shares[(id + i) % loop.participants];
+        std::lock_guard<std::mutex> lock(share.mutex);
+        if(share.chunks.empty())
+          continue;
+        if(i == 0)
+        {
+          chunk = share.chunks.front();
+          share.chunks.pop_front();
+        }
+        else
+        {
+          chunk = share.chunks.back();
+          share.chunks.pop_back();
+        }
+        return true;
+      }
+      return false;
+    }
+
+    static void run_chunks(Loop& loop, const int id)
+    {
+      std::pair<int, int> chunk;
+      while(take(loop, id, chunk))
+        (*loop.body)(chunk.first, chunk.second);
+    }
+
+    void worker()
+    {
+      while(true)
+      {
+        Loop* loop;
+        int id;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          while(!stop && loops.empty())
+            work_available.wait(lock);
+          if(stop)
+            return;
+          loop = loops.front();
+          id = loop->joined++;
+          ++loop->active;
+          if(loop->joined == loop->participants - 1)
+            loops.erase(loops.begin());
+        }
+        run_chunks(*loop, id);
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--loop->active == 0)
+          work_done.notify_all();
+      }
+    }
+  public:
+    /** \brief Constructor that starts 'threads_no' - 1 workers. The thread that
+     * calls 'parallel_for()' is the last participant.
+     *
+     * @param threads_no  - number of threads that run a loop
+     */
+    explicit ThreadPool(const int threads_no)
+      : stop(false)
+    {
+      for(int i = 0; i < std::max(1, threads_no) - 1; ++i)
+        workers.push_back(std::thread(&ThreadPool::worker, this));
+    }
+
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      work_available.notify_all();
+      for(auto& th : workers)
+        th.join();
+    }
+
+    /** \brief Number of threads that run a loop, including the calling thread.
+     *
+     * @return - the number of threads
+     */
+    int size() const
+    {
+      return workers.size() + 1;
+    }
+
+    /** \brief Number of threads that run a loop of a call that asks for 'threads_no' of them.
+     *
+     * @param threads_no  - number of threads asked for, 0 for all
+     * @return            - the number of threads, at most 'size()'
+     */
+    int size(const int threads_no) const
+    {
+      return threads_no > 0 ? std::min(threads_no, size()) : size();
+    }
+
+    /** \brief Run 'body' on [start, end), cut into chunks of 'chunk' iterations,
+     * and return when all chunks are done. Safe to call concurrently, and from 'body'.
+     *
+     * @param start       - first iteration
+     * @param end         - one past the last iteration
+     * @param chunk       - number of iterations per chunk
+     * @param body        - called with the range [chunk_start, chunk_end) of every chunk
+     * @param threads_no  - most threads that run the loop, including the calling thread. Default value is 0, i.e. 'size()'.
+     */
+    void parallel_for(const int start, const int end, const int chunk, const std::function<void(int, int)>& body, const int threads_no = 0)
+    {
+      if(start >= end)
+        return;
+      const int step = std::max(1, chunk);
+      const int chunks_no = (end - start + step - 1) / step;
+      const int participants = std::min(size(threads_no), chunks_no);
+      if(participants == 1)
+      {
+        for(int i = start; i < end; i += step)
+          body(i, std::min(end, i + step));
+        return;
+      }
+      Loop loop;
+      loop.body = &body;
+      loop.shares.reset(new Share[participants]);
+      loop.participants = participants;
+      loop.joined = 0;
+      loop.active = 0;
+      // contiguous shares, so that every participant starts on neighboring iterations
+      for(int c = 0; c < chunks_no; ++c)
+      {
+        const int i = start + c * step;
+        loop.shares[(long long)c * participants / chunks_no].chunks.push_back(std::make_pair(i, std::min(end, i + step)));
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        loops.push_back(&loop);
+      }
+      for(int i = 0; i < participants - 1; ++i)
+        work_available.notify_one();
+      run_chunks(loop, participants - 1);
+      // no chunks are left: no more workers join, and those that did finish their last chunks
+      std::unique_lock<std::mutex> lock(mutex);
+      const std::vector<Loop*>::iterator waiting = std::find(loops.begin(), loops.end(), &loop);
+      if(waiting != loops.end())
+        loops.erase(waiting);
+      while(loop.active)
+        work_done.wait(lock);
+    }
+};
+
+#endif /*THREAD_POOL_H*/
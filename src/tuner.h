@@ -0,0 +1,213 @@
+#ifndef TUNER_H
+#define TUNER_H
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include "hypercube.h"
+#include "exact_search.h"
+#include "pointset_view.h"
+
+/**
+ * Tuning of K, r and MAX_PNTS_TO_SEARCH for a dataset. 'tune()' builds Hypercubes on a sample of
+ * the points, runs k Nearest Neighbor queries that are not in the sample, and compares their
+ * answers with the exact ones, for every candidate (K, r) and increasing budgets. It returns the
+ * cheapest configuration that reaches a target recall, or the one with the best recall within
+ * a target p99 latency. Build the Hypercube from it with the HypercubeConfig constructor. Tune
+ * with the metric of that Hypercube; for the metrics of sign projections, only K and the budget matter.
+ */
+
+namespace Dolphinn
+{
+  struct TuningOptions
+  {
+    // recall@k that the configuration must reach, at the lowest mean latency; 0 to tune for 'target_p99_ms'
+    double target_recall;
+    // if 'target_recall' is 0: the 99th percentile of the latency of a query must not exceed this many
+    // milliseconds, at the highest recall
+    double target_p99_ms;
+    // neighbors per query
+    int k;
+    // points of the Hypercubes of the tuner, drawn from the dataset
+    int sample_points;
+    // queries, drawn from the given queries, or from the points and held out of the sample
+    int sample_queries;
+    // candidate values; empty for defaults around floor(log2(n)/2), the spread of the k-th nearest
+    // neighbor distances, and steps of sqrt(2) up to half the sample, respectively
+    std::vector<int> Ks;
+    std::vector<float> rs;
+    std::vector<int> budgets;
+    // threads that build the Hypercubes and run the queries
+    int threads_no;
+    // seed of the sampling, 0 for the time
+    uint64_t seed;
+
+    TuningOptions()
+      : target_recall(0.9), target_p99_ms(0), k(10), sample_points(100000), sample_queries(200),
+      threads_no(std::thread::hardware_concurrency()), seed(0)
+    {}
+  };
+
+  /** \brief Copy rows of a pointset.
+    *
+    * @param points  - the pointset
+    * @param rows    - indices of the rows to copy
+    * @return        - the rows, D coordinates each
+  */
+  template <typename T>
+  std::vector<T> gather_rows(const PointsetView<T>& points, const std::vector<int>& rows)
+  {
+    const int D = points.dimension();
+    std::vector<T> gathered(rows.size() * D);
+    for(size_t i = 0; i < rows.size(); ++i)
+      std::copy(points.row(rows[i]), points.row(rows[i]) + D, gathered.begin() + i * D);
+    return gathered;
+  }
+
+  /** \brief True if configuration 'a' is preferred over 'b' for the target of the options: among those that
+    * meet the target, the fastest for a recall target and the most accurate for a latency target; otherwise
+    * the closest to the target.
+    *
+    * @param a        - a configuration
+    * @param b        - another configuration
+    * @param options  - the target
+    * @return         - true if 'a' is better
+  */
+  inline bool better_config(const HypercubeConfig& a, const HypercubeConfig& b, const TuningOptions& options)
+  {
+    if(a.meets_target != b.meets_target)
+      return a.meets_target;
+    if(options.target_recall > 0)
+    {
+      if(!a.meets_target && a.recall != b.recall)
+        return a.recall > b.recall;
+      return a.mean_ms != b.mean_ms ? a.mean_ms < b.mean_ms : a.p99_ms < b.p99_ms;
+    }
+    if(!a.meets_target && a.p99_ms != b.p99_ms)
+      return a.p99_ms < b.p99_ms;
+    return a.recall != b.recall ? a.recall > b.recall : a.mean_ms < b.mean_ms;
+  }
+
+  /** \brief Choose K, r and MAX_PNTS_TO_SEARCH for a dataset, see above. Recall and latency are measured
+    * on n sampled points; the configuration is scaled to the N points: K grows by log2(N / n), so that
+    * vertices hold as many points, and the budget by N / n. The measurements are those of the sample.
+    *
+    * @param points   - the N points
+    * @param options  - the target and the search space
+    * @param queries  - queries to sample; default none, i.e. queries are drawn from the points
+    * @param tried    - optional measurements of every configuration tried, unscaled (to be populated)
+    * @return         - the chosen configuration; 'meets_target' is false if none met the target, and
+    *                   then it is the one closest to it
+  */
+  template <typename T, typename bitT = char, typename Metric = L2Metric>
+  HypercubeConfig tune(const PointsetView<T>& points, const TuningOptions& options = TuningOptions(),
+    const PointsetView<T>& queries = PointsetView<T>(), std::vector<HypercubeConfig>* tried = NULL)
+  {
+    const int N = points.size(), D = points.dimension(), k = std::max(1, options.k);
+    std::mt19937_64 generator(options.seed ? options.seed : std::chrono::system_clock::now().time_since_epoch().count());
+    std::vector<int> order(N);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), generator);
+
+    // held-out queries come first in 'order', the sample follows
+    const bool held_out = queries.size() == 0;
+    const int Q = std::max(1, std::min(options.sample_queries, held_out ? N / 2 : queries.size()));
+    std::vector<int> query_rows;
+    if(held_out)
+      query_rows.assign(order.begin(), order.begin() + Q);
+    else
+    {
+      std::vector<int> all(queries.size());
+      std::iota(all.begin(), all.end(), 0);
+      std::shuffle(all.begin(), all.end(), generator);
+      query_rows.assign(all.begin(), all.begin() + Q);
+    }
+    const int first = held_out ? Q : 0;
+    const int n = std::max(1, std::min(options.sample_points, N - first));
+    std::vector<int> sample_rows(order.begin() + first, order.begin() + first + n);
+    // rows in their order in memory, for the copy
+    std::sort(sample_rows.begin(), sample_rows.end());
+    const std::vector<T> sample = gather_rows(points, sample_rows);
+    const std::vector<T> query = gather_rows(held_out ? points : queries, query_rows);
+    const PointsetView<T> sample_view(sample.data(), n, D);
+
+    std::vector<std::pair<int, float>> exact;
+    exact_knn<T, Metric>(sample_view, PointsetView<T>(query.data(), Q, D), k, exact, options.threads_no);
+
+    std::vector<int> Ks = options.Ks;
+    if(Ks.empty())
+    {
+      const int K0 = std::max(1, (int)std::floor(std::log2(n) / 2));
+      for(int K = K0 - 2; K <= K0 + 4; K += 2)
+        if(K >= 1)
+          Ks.push_back(K);
+    }
+    std::vector<float> rs = options.rs;
+    // sign projections have no window
+    if(Metric::FAMILY == SIGN_PROJECTION)
+      rs.assign(1, 4);
+    if(rs.empty())
+    {
+      // windows around the median distance of the k-th nearest neighbor, which projections preserve in expectation
+      std::vector<float> distances(Q);
+      for(int q = 0; q < Q; ++q)
+      {
+        const float distance = std::max(0.0f, exact[(size_t)q * k + k - 1].second);
+        distances[q] = (Metric::FAMILY == GAUSSIAN_PROJECTION) ? std::sqrt(distance) : distance;
+      }
+      std::nth_element(distances.begin(), distances.begin() + Q / 2, distances.end());
+      const float median = distances[Q / 2] > 0 ? distances[Q / 2] : 4;
+      for(const float factor: {0.5f, 1.0f, 2.0f, 4.0f})
+        rs.push_back(median * factor);
+    }
+    std::vector<int> budgets = options.budgets;
+    if(budgets.empty())
+      for(double budget = std::max(2 * k, n / 1024); budget <= std::max(2 * k, n / 2); budget *= std::sqrt(2.0))
+        budgets.push_back((int)budget);
+    std::sort(budgets.begin(), budgets.end());
+
+    HypercubeConfig best;
+    bool any = false;
+    std::vector<std::pair<int, float>> found((size_t)Q * k);
+    std::vector<QueryStats> stats;
+    std::vector<double> latencies(Q);
+    for(const int K: Ks)
+      for(const float r: rs)
+      {
+        const Hypercube<T, bitT, Metric> cube(sample_view, K, options.threads_no, r);
+        for(const int budget: budgets)
+        {
+          cube.knn_query(query, Q, k, budget, found, options.threads_no, &stats);
+          HypercubeConfig config(K, r, budget);
+          config.recall = knn_recall(found, exact, Q, k);
+          for(int q = 0; q < Q; ++q)
+            latencies[q] = 1000 * stats[q].total_seconds();
+          config.mean_ms = std::accumulate(latencies.begin(), latencies.end(), 0.0) / Q;
+          std::sort(latencies.begin(), latencies.end());
+          config.p99_ms = latencies[std::min(Q - 1, (int)(0.99 * Q))];
+          config.meets_target = options.target_recall > 0 ? config.recall >= options.target_recall : config.p99_ms <= options.target_p99_ms;
+          if(tried)
+            tried->push_back(config);
+          if(!any || better_config(config, best, options))
+            best = config;
+          any = true;
+          // larger budgets are slower, and reach at least this recall
+          if(options.target_recall > 0 ? config.meets_target : !config.meets_target)
+            break;
+        }
+      }
+
+    // from the sample to the whole pointset
+    const double scale = (double)N / n;
+    best.K = std::min(26, best.K + std::max(0, (int)std::lround(std::log2(scale))));
+    best.budget = (int)std::min<double>(N, std::ceil(best.budget * scale));
+    return best;
+  }
+}
+
+#endif /*TUNER_H*/